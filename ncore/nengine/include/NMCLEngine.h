@@ -16,6 +16,7 @@
 #include "TextSpotting.h"
 #include "PlaceRecognition.h"
 #include "Camera.h"
+#include "BeamSelection.h"
 #include <fstream>
 //#include "CustomEigenVec.h"
 
@@ -96,6 +97,12 @@ public:
 		return o_renmcl->Stats();
 	}
 
+	//! The k strongest pose hypotheses, see ReNMCL::Modes. Cheaper to pass on than the full particle set
+	std::vector<PoseMode> Modes(int k = 5) const
+	{
+		return o_renmcl->Modes(k);
+	}
+
 	std::vector<Particle> Particles() const
 	{
 		return o_renmcl->Particles();
@@ -114,6 +121,7 @@ private:
 
 	std::shared_ptr<TextSpotting> o_textSpotter;
 	std::shared_ptr<ReNMCL> o_renmcl;
+	std::shared_ptr<BeamSelection> o_beamSelection;
 	std::vector<double> o_scanMask;
 	std::shared_ptr<PlaceRecognition> o_placeRec;
 	Eigen::Vector3f o_wheelPrevPose = Eigen::Vector3f(0, 0, 0);
@@ -21,12 +21,15 @@
 NMCLEngine::NMCLEngine(const std::string& nmclConfigPath, const std::string& sensorConfigFolder, const std::string& textMapDir)
 {
 
+	// the beam selection picks from the full scan instead of every o_dsFactor-th beam
+	o_beamSelection = NMCLFactory::CreateBeamSelection(nmclConfigPath);
+	if (o_beamSelection) o_dsFactor = 1;
+
 	std::vector<double> mask(1041 * 2, 1.0);
 	o_scanMask = Downsample(mask, o_dsFactor);   
 
 	o_renmcl = NMCLFactory::Create(nmclConfigPath);
-	std::vector<std::string> dict = o_renmcl->GetFloorMap()->GetRoomNames();
-	o_placeRec = std::make_shared<PlaceRecognition>(PlaceRecognition(dict, textMapDir));
+	o_placeRec = NMCLFactory::CreatePlaceRecognition(nmclConfigPath, o_renmcl->GetFloorMap(), textMapDir);
 
 	o_cameras.push_back(std::make_shared<Camera>(Camera(sensorConfigFolder + "cam0.config")));
 	o_cameras.push_back(std::make_shared<Camera>(Camera(sensorConfigFolder + "cam1.config")));
@@ -88,7 +91,7 @@ int NMCLEngine::Correct(const std::vector<Eigen::Vector3f>& fullScan)
 		o_step = false;
 		//if (scanRatio > 0.5)
 		{
-			LidarData data = LidarData(scan, o_scanMask);
+			LidarData data = o_beamSelection ? LidarData(scan, o_beamSelection->Select(scan, o_scanMask)) : LidarData(scan, o_scanMask);
 			o_renmcl->Correct(std::make_shared<LidarData>(data)); 
 		
 			SetStatistics stas = o_renmcl->Stats();
@@ -309,7 +312,7 @@ void NMCLEngine::TextMask(const std::vector<std::string>& places, int camID)
 		{
 			std::vector<std::string> confirmedMatches;
 			TextData textData = o_placeRec->TextBoundingBoxes(validMatches, confirmedMatches);
-			o_renmcl->Relocalize(textData.BottomRight(), textData.TopLeft(), textData.Orientation(), camAngle);
+			o_renmcl->Relocalize(textData, camAngle);
 		}
 	} 
 }
@@ -0,0 +1,61 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: AliasTable.h                                                          #
+# ##############################################################################
+**/
+
+#ifndef ALIASTABLE_H
+#define ALIASTABLE_H
+
+#include <vector>
+#include "Random.h"
+
+//! Walker/Vose alias table. Draws an index i with probability weights[i] / sum(weights) in O(1), after an O(n) build
+class AliasTable
+{
+	public:
+
+		AliasTable() {};
+
+		//! A constructor
+	    /*!
+	     \param weights are non-negative, and don't need to be normalized
+	    */
+		AliasTable(const std::vector<double>& weights);
+
+		int Sample(RandomStream& stream) const
+		{
+			int i = int(stream.Uniform() * o_prob.size());
+			if (stream.Uniform() < o_prob[i]) return i;
+			return o_alias[i];
+		}
+
+		int Size() const
+		{
+			return o_prob.size();
+		}
+
+		//! True if there is nothing to draw, i.e. no entries or all weights are zero
+		bool Empty() const
+		{
+			return o_total <= 0;
+		}
+
+		double Total() const
+		{
+			return o_total;
+		}
+
+	private:
+
+		std::vector<float> o_prob;
+		std::vector<int> o_alias;
+		double o_total = 0;
+};
+
+#endif
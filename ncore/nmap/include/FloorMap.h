@@ -19,6 +19,9 @@
 #include "GMap.h" 
 #include "Room.h"
 #include "Lift.h"
+#include "FreeSpaceIndex.h"
+#include "TiledMap.h"
+#include "MapBundle.h"
 
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
@@ -34,6 +37,17 @@ public:
 
 	FloorMap(nlohmann::json config, std::string folderPath);
 
+	//! A constructor that takes the grid map and the room segmentation from a compiled bundle instead of the images, see NMCLFactory::Compile
+	/*!
+	  \param config is the floor config, it provides the name, the classes and the rooms
+	  \param bundle is a bundle written with Save
+	  \param folderPath is the folder of the floor config
+	*/
+	FloorMap(nlohmann::json config, std::shared_ptr<const MapBundle> bundle, std::string folderPath);
+
+	//! Adds the grid map (as augmented when loading the config) and the room segmentation to a bundle
+	void Save(MapBundleWriter& writer) const;
+
 
 	int GetRoomID(float x, float y);
 
@@ -41,6 +55,27 @@ public:
 
 	void CreateSemMaps();
 
+	//! Renders the map of one semantic class from the objects in all rooms, 255 where an object of the class is. CreateSemMaps writes these to SemMaps/
+	cv::Mat SemMap(int label) const;
+
+	//! The semantic classes whose objects are painted into the occupancy map when the floor is built, e.g. large furniture that blocks the lidar
+	static const std::vector<int>& AugmentedClasses();
+
+	//! Adds an object to a room. The edits only change the rooms and the class maps, not the occupancy map or the layers derived from it
+	// (Raster, FreeSpace, the EDT of BeamEnd), so objects of the AugmentedClasses can't be edited and throw std::runtime_error
+	/*!
+	  \param roomID is the index of the room, see GetRoom
+	  \param obj is the object, its Position() is its footprint in pixels
+	  \return the bounding box of the pixels of SemMap(obj.SemLabel()) that changed, for SemanticVisibility::UpdateClass
+	*/
+	cv::Rect AddObject(int roomID, Object& obj);
+
+	//! Removes an object from a room, returns the bounding box of the pixels that changed (empty if there is no such object). See AddObject
+	cv::Rect RemoveObject(int roomID, int objectID);
+
+	//! Moves an object to a new footprint (u1, v1, u2, v2) in pixels, returns the bounding box of the old and the new footprint (empty if there is no such object). See AddObject
+	cv::Rect MoveObject(int roomID, int objectID, const Eigen::Vector4f& position);
+
 	std::string Name() const
 	{
 		return o_name;
@@ -104,6 +139,17 @@ public:
 		return o_classes;
 	}
 
+	//! A getter for the index of the free cells, globally, per room and per room purpose. It is built on first use
+	const std::shared_ptr<FreeSpaceIndex>& FreeSpace();
+
+	//! Rebuilds the free space index, needed after the rooms or their purposes were edited
+	void UpdateFreeSpace();
+
+	//! A getter for the tiled raster with the occupancy and room layers of this floor. It is built on first use, and grown in place if it has 
+	// less than margin pixels around the known part of the map, so every holder keeps sharing the same raster. Sensor models can add their
+	// own layer to it, see BeamEnd::SetRaster
+	const std::shared_ptr<TiledMap>& Raster(int margin = 1);
+
 
 
 	cv::Mat ColorizeRoomSeg();
@@ -121,8 +167,17 @@ private:
     }
 
 	void extractRoomSegmentation();
+
+	//! The classes, categories and rooms of a floor config
+	void loadRooms(const nlohmann::json& config);
+
+	//! The pixels an object covers in SemMap
+	static cv::Rect footprint(const Object& obj);
 	std::vector<int> extractRoomIDs();
 	cv::Mat augmentGMap(const cv::Mat& img, const std::vector<int>& augmentedClasses);
+
+	//! Throws std::runtime_error if the object is of an augmented class, see AddObject
+	static void checkEditable(const Object& obj);
 	//void fingNeighbours();
 
 
@@ -136,6 +191,8 @@ private:
 	std::vector<std::string> o_classes;
 	std::vector<std::string> o_categories;
 	std::string o_folderPath;
+	std::shared_ptr<FreeSpaceIndex> o_freeSpace;
+	std::shared_ptr<TiledMap> o_raster;
 
 
 };
@@ -0,0 +1,113 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: FreeSpaceIndex.h                                                      #
+# ##############################################################################
+**/
+
+#ifndef FREESPACEINDEX_H
+#define FREESPACEINDEX_H
+
+#include <memory>
+#include <vector>
+#include <map>
+#include "GMap.h"
+#include "AliasTable.h"
+#include "Random.h"
+
+//! Precomputed index of the free cells of a GMap, for sampling positions without rejection.
+// A position (x, y) is valid iff GMap::IsValid accepts it, i.e. iff the cell it rounds to is free. Drawing (x, y) uniformly in a box and
+// rejecting invalid ones is therefore the same as drawing a free cell with probability proportional to its overlap with the box, and then
+// a point uniformly inside that overlap. Draws are kept a small margin off the cell borders, so every position rounds to its free cell and
+// no rejection is needed. The tables for the whole map, per room and per room purpose are built once, boxes are indexed on demand.
+class FreeSpaceIndex
+{
+	public:
+
+		//! A constructor
+	    /*!
+	      \param map is the occupancy map, the global table covers the free cells between its TopLeft() and BottomRight()
+	      \param roomSeg is the room segmentation (CV_8UC1, room id per pixel), can be empty
+	      \param purposes holds the purpose of each room id, rooms without an entry are not added to any purpose table
+	    */
+		FreeSpaceIndex(std::shared_ptr<GMap> map, const cv::Mat& roomSeg = cv::Mat(), const std::vector<int>& purposes = std::vector<int>());
+
+		//! Draws a uniform position in the free space inside the map's bounding box
+		/*!
+		   \return false if there is no free space
+		*/
+		bool SampleUniform(RandomStream& stream, Eigen::Vector2f& xy) const;
+
+		//! Draws a uniform position in the free space of a room
+		bool SampleRoom(int roomID, RandomStream& stream, Eigen::Vector2f& xy) const;
+
+		//! Draws a uniform position in the free space of all rooms with a given purpose
+		bool SamplePurpose(int purpose, RandomStream& stream, Eigen::Vector2f& xy) const;
+
+		//! Draws n uniform positions in the free part of a box given in world coordinates. The corners can come in any order,
+		// and a box that is degenerate in x and/or y returns the exact coordinate in that dimension
+		/*!
+		   \return false if the box has no free space, xy is then left empty
+		*/
+		bool SampleBox(const Eigen::Vector2f& corner1, const Eigen::Vector2f& corner2, int n, RandomStream& stream, std::vector<Eigen::Vector2f>& xy) const;
+
+		//! Number of free cells inside the map's bounding box
+		int NumFree() const
+		{
+			return o_global.cells.size();
+		}
+
+		int NumFree(int roomID) const
+		{
+			if ((roomID < 0) || (roomID >= int(o_rooms.size()))) return 0;
+			return o_rooms[roomID].cells.size();
+		}
+
+		//! The free area in m^2 of all rooms with a given purpose
+		double PurposeArea(int purpose) const
+		{
+			auto it = o_purposes.find(purpose);
+			if (it == o_purposes.end()) return 0;
+			return it->second.alias.Total();
+		}
+
+
+		//! The distance of draws from the cell borders, in pixels. Enough for GMap::World2Map to round every draw to its own cell
+		static constexpr float borderMargin = 0.01;
+
+	private:
+
+		struct Box
+		{
+			float xmin;
+			float xmax;
+			float ymin;
+			float ymax;
+		};
+
+		struct Table
+		{
+			std::vector<int> cells;
+			AliasTable alias;
+		};
+
+		Box makeBox(const Eigen::Vector2f& corner1, const Eigen::Vector2f& corner2) const;
+		double overlap(int cell, const Box& box, Box& part) const;
+		void collect(const Box& box, Table& table) const;
+		Eigen::Vector2f sampleCell(int cell, const Box& box, RandomStream& stream) const;
+		bool sample(const Table& table, RandomStream& stream, Eigen::Vector2f& xy) const;
+
+		std::shared_ptr<GMap> o_map;
+		float o_resolution = 0;
+		int o_cols = 0;
+		Box o_box;
+		Table o_global;
+		std::vector<Table> o_rooms;
+		std::map<int, Table> o_purposes;
+};
+
+#endif
@@ -73,6 +73,26 @@ class GMap : public IMap2D
 		Eigen::Vector2f Map2World(Eigen::Vector2f uv) const;
 
 
+		float Resolution() const
+		{
+			return o_resolution;
+		}
+
+		//! A getter for the origin, the 2D pose of the bottom right corner of the map as found in the yaml
+		const Eigen::Vector3f& Origin() const
+		{
+			return o_origin;
+		}
+
+
+		//! The region of the raster that derived rasters need to cover: the bounding box of all free and occupied cells up to BottomRight(),
+		// grown by margin pixels and clipped to the raster. Everything outside it is unknown margin, as gmapping produces it
+		/*!
+		   \param margin is the padding in pixels, e.g. the truncation distance of a distance field
+		   \return cv::Rect in (u, v) pixel coordinates
+		*/
+		cv::Rect Crop(int margin = 0) const;
+
 		bool IsValid(Eigen::Vector3f pose) const;
 
 		bool IsValid2D(Eigen::Vector2f mp) const;
@@ -93,6 +113,7 @@ class GMap : public IMap2D
 		Eigen::Vector3f o_origin;
 		Eigen::Vector2f o_bottomRight;
 		Eigen::Vector2f o_topLeft;
+		cv::Rect o_known;
 
 		void getBorders();
 		
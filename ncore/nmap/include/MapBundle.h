@@ -0,0 +1,118 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: MapBundle.h                                                           #
+# ##############################################################################
+**/
+
+#ifndef MAPBUNDLE_H
+#define MAPBUNDLE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+
+
+//! A compiled map: one file of named binary sections, e.g. the grid map, the distance field of the sensor model and the semantic visibility table.
+// The file is mapped read-only and shared, so loading it costs no parsing or copying, and all processes on a host that load the same bundle
+// share its physical pages. Sections are 64 byte aligned and each carries a checksum. Only the section table is checked by default, checking the
+// sections reads the whole file. The data is stored in the byte order of the host that wrote it.
+// Bundles are written by MapBundleWriter, see NMCLFactory::Compile
+class MapBundle
+{
+	public:
+
+		static const uint32_t version = 1;
+
+		//! A constructor, throws std::runtime_error if the file can't be mapped, isn't a bundle, has another version or fails a checksum
+		/*!
+		  \param path is the path of the bundle file
+		  \param verify also checks the checksums of all sections, which reads the whole file once instead of paging it in on use
+		*/
+		MapBundle(const std::string& path, bool verify = false);
+
+		~MapBundle();
+
+		MapBundle(const MapBundle&) = delete;
+		MapBundle& operator=(const MapBundle&) = delete;
+
+		bool Has(const std::string& name) const;
+
+		//! The start of a section, throws std::runtime_error if there is no such section
+		const void* Data(const std::string& name) const;
+
+		//! The size of a section in bytes
+		size_t Size(const std::string& name) const;
+
+		//! A section as an array of count elements, throws std::runtime_error if its size doesn't match
+		template<class T>
+		const T* Array(const std::string& name, size_t count) const
+		{
+			checkSize(name, count * sizeof(T));
+			return static_cast<const T*>(Data(name));
+		}
+
+		//! A section as text, e.g. json
+		std::string Text(const std::string& name) const;
+
+		//! A section as an image without copying it. The pixels are read-only and live as long as the bundle
+		cv::Mat Image(const std::string& name, int rows, int cols, int type) const;
+
+		const std::string& Path() const
+		{
+			return o_path;
+		}
+
+		//! FNV-1a 64 bit hash, the checksum of the sections
+		static uint64_t Checksum(const void* data, size_t size);
+
+	private:
+
+		struct Section
+		{
+			uint64_t offset;
+			uint64_t size;
+		};
+
+		void checkSize(const std::string& name, size_t size) const;
+
+		std::string o_path;
+		const uint8_t* o_data = nullptr;
+		size_t o_size = 0;
+		std::map<std::string, Section> o_sections;
+};
+
+
+//! Collects the sections of a MapBundle and writes them to a file
+class MapBundleWriter
+{
+	public:
+
+		void Add(const std::string& name, const void* data, size_t size);
+
+		void Add(const std::string& name, const std::string& text);
+
+		//! Adds the pixels of an image row by row, the size and type have to be stored separately
+		void Add(const std::string& name, const cv::Mat& image);
+
+		template<class T>
+		void Add(const std::string& name, const std::vector<T>& values)
+		{
+			Add(name, values.data(), values.size() * sizeof(T));
+		}
+
+		//! Writes the bundle. The file is written under a temporary name and then renamed, so processes that mapped an older bundle keep a valid file
+		void Write(const std::string& path) const;
+
+	private:
+
+		std::vector<std::pair<std::string, std::vector<uint8_t>>> o_sections;
+};
+
+#endif
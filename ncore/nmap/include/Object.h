@@ -59,6 +59,12 @@ public:
 		return o_posistion;
 	}
 
+	//! Sets the footprint (u1, v1, u2, v2) of the object in map pixels
+	void Position(Eigen::Vector4f position) 
+	{
+		o_posistion = position;
+	}
+
 	void Pose(Eigen::Vector3f pose) 
 	{
 		o_pose = pose;
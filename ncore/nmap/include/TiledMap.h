@@ -0,0 +1,144 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: TiledMap.h                                                            #
+# ##############################################################################
+**/
+
+#ifndef TILEDMAP_H
+#define TILEDMAP_H
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "GMap.h"
+#include "AlignedAllocator.h"
+
+
+//! The per-cell record of TiledMap. 4 bytes, so a cache line holds two rows of a tile
+struct MapCell
+{
+	//! the per-cell term of the sensor model, see BeamEnd. TiledMap::outside where the model gives no information
+	uint16_t likelihood = 0xFFFF;
+	//! the GMap value, 255 outside the bounding box of the occupied area. A cell is valid iff occupancy <= 1, as in GMap::IsValid2D
+	uint8_t occupancy = 255;
+	//! the room id, 0 (background) if unknown
+	uint8_t room = 0;
+};
+
+
+//! A single raster that interleaves the occupancy, room id and sensor model term of each map cell. The semantic models keep their own
+// per-class layers (see SemanticVisibility and SemanticLikelihood), as they are looked up per detection and not per particle.
+// The cells are stored in 8x8 tiles, so nearby particles and beam ends touch few cache lines. Only GMap::Crop(margin) is stored, surrounded by a guard band
+// of cells that hold the "nothing there" values. Lookups clamp (u, v) into the guard band instead of testing bounds, so they are branch-free.
+class TiledMap
+{
+	public:
+
+		static const int tileBits = 3;
+		static const int tileSize = 1 << tileBits;
+		static const uint16_t outside = 0xFFFF;
+		static const int guard = 1;
+
+		//! A constructor
+	    /*!
+	      \param map is the occupancy map the raster is aligned with, its cells are (u, v) in GMap pixel coordinates
+	      \param margin is the padding around the known part of the map in pixels, it has to cover the reach of the layers, e.g. the truncation of a distance field
+	    */
+		TiledMap(std::shared_ptr<GMap> map, int margin = 1);
+
+		//! Enlarges the stored part of the map to GMap::Crop(margin) in place, so everyone holding the raster sees the larger one.
+		// The layers of the cells that were stored are kept, the new cells get the occupancy and the "nothing there" values. Pointers from Cells() are invalidated
+		void Grow(int margin);
+
+		//! Fills the room layer from a room segmentation (CV_8UC1, room id per pixel, same size as the map)
+		void SetRooms(const cv::Mat& roomSeg);
+
+		//! Fills the sensor model layer from a row-major table that covers region of the map. Cells outside the region or [0, maxU] x [0, maxV] get outside
+		void SetLikelihood(const uint16_t* table, const cv::Rect& region, int maxU, int maxV);
+
+		//! Sets the sensor model term of one cell, cells the raster doesn't store are ignored
+		void SetLikelihood(int u, int v, uint16_t likelihood)
+		{
+			if ((u < o_crop.x) || (v < o_crop.y) || (u >= o_crop.x + o_crop.width) || (v >= o_crop.y + o_crop.height)) return;
+			o_cells[Index(u, v)].likelihood = likelihood;
+		}
+
+		//! The index of cell (u, v) in Cells(). Cells outside the map are clamped into the guard band
+		int Index(int u, int v) const
+		{
+			int x = std::min(std::max(u - o_crop.x + guard, 0), o_width - 1);
+			int y = std::min(std::max(v - o_crop.y + guard, 0), o_height - 1);
+
+			return ((((y >> tileBits) * o_tilesX) + (x >> tileBits)) << (2 * tileBits)) | ((y & (tileSize - 1)) << tileBits) | (x & (tileSize - 1));
+		}
+
+		const MapCell& Cell(int u, int v) const
+		{
+			return o_cells[Index(u, v)];
+		}
+
+		const MapCell* Cells() const
+		{
+			return o_cells.data();
+		}
+
+		//! The cell of a position in the map frame, rounded like GMap::World2Map
+		Eigen::Vector2i World2Map(float x, float y) const
+		{
+			int u = round((x - o_origin(0)) / o_resolution);
+			int v = o_rows - round((y - o_origin(1)) / o_resolution);
+
+			return Eigen::Vector2i(u, v);
+		}
+
+		//! Same as GMap::IsValid, for a position in the map frame
+		bool IsValid(float x, float y) const
+		{
+			Eigen::Vector2i uv = World2Map(x, y);
+			return Cell(uv(0), uv(1)).occupancy <= 1;
+		}
+
+		int RoomID(float x, float y) const
+		{
+			Eigen::Vector2i uv = World2Map(x, y);
+			return Cell(uv(0), uv(1)).room;
+		}
+
+		int Margin() const
+		{
+			return o_margin;
+		}
+
+		//! The part of the map the raster stores, in (u, v) pixel coordinates
+		const cv::Rect& Crop() const
+		{
+			return o_crop;
+		}
+
+		const std::shared_ptr<GMap>& Map() const
+		{
+			return o_map;
+		}
+
+	private:
+
+		std::shared_ptr<GMap> o_map;
+		AlignedVector<MapCell> o_cells;
+		int o_margin = 1;
+		cv::Rect o_crop;
+		int o_rows = 0;
+		// the padded size, a multiple of tileSize
+		int o_width = 0;
+		int o_height = 0;
+		int o_tilesX = 0;
+		Eigen::Vector3f o_origin;
+		float o_resolution = 1;
+};
+
+#endif
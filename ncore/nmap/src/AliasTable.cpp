@@ -0,0 +1,58 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                                      #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                                     #
+#                                                                              #
+#  File: AliasTable.cpp                                                        #
+# ##############################################################################
+**/
+
+#include "AliasTable.h"
+
+AliasTable::AliasTable(const std::vector<double>& weights)
+{
+	int n = weights.size();
+	o_prob = std::vector<float>(n, 1.0);
+	o_alias = std::vector<int>(n);
+
+	o_total = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		o_total += weights[i];
+		o_alias[i] = i;
+	}
+	if (o_total <= 0) return;
+
+	std::vector<double> scaled(n);
+	std::vector<int> small;
+	std::vector<int> large;
+	for(int i = 0; i < n; ++i)
+	{
+		scaled[i] = weights[i] * n / o_total;
+		if (scaled[i] < 1.0) small.push_back(i);
+		else large.push_back(i);
+	}
+
+	while (small.size() && large.size())
+	{
+		int s = small.back();
+		small.pop_back();
+		int l = large.back();
+
+		o_prob[s] = scaled[s];
+		o_alias[s] = l;
+
+		scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+		if (scaled[l] < 1.0)
+		{
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+
+	// whatever is left is 1 up to rounding
+	for(int i : large) o_prob[i] = 1.0;
+	for(int i : small) o_prob[i] = 1.0;
+}
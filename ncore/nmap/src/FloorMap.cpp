@@ -13,7 +13,9 @@
 #include <string>
 #include <nlohmann/json.hpp>
 #include <fstream>
+#include <algorithm>
 #include <boost/filesystem.hpp>
+#include <stdexcept>
 
 FloorMap::FloorMap(std::shared_ptr<GMap> map, cv::Mat& roomSeg, std::string name)
 {
@@ -42,6 +44,59 @@ FloorMap::FloorMap(nlohmann::json config, std::string folderPath)
     cv::split(roomSeg, split);
     o_roomSeg = split[2];
 
+    loadRooms(config);
+
+    const std::vector<int>& augmentedClasses = AugmentedClasses();
+
+    if(config["map"]["type"] == "GMap")
+    {
+        float resolution = config["map"]["resolution"];
+        std::vector<float> origin = config["map"]["origin"];
+        std::string imgPath = config["map"]["image"];
+        cv::Mat img = cv::imread(folderPath + imgPath);
+        cv::Mat augmentedGmap = augmentGMap(img, augmentedClasses);
+        //cv::imwrite("augmentedGmap.png", augmentedGmap);
+        o_map = std::make_shared<GMap>(GMap(augmentedGmap, Eigen::Vector3f(origin[0], origin[1], origin[2]), resolution));
+    }
+
+    CreateSemMaps();
+}
+
+FloorMap::FloorMap(nlohmann::json config, std::shared_ptr<const MapBundle> bundle, std::string folderPath)
+{
+    o_name = config["name"];
+    o_folderPath = folderPath;
+
+    // the map is stored as compiled, augmented and with the image convention of GMap's constructor, so nothing is written back to disk
+    nlohmann::json info = nlohmann::json::parse(bundle->Text("floor/info"));
+    int rows = info["rows"];
+    int cols = info["cols"];
+    o_roomSeg = bundle->Image("floor/roomSeg", rows, cols, CV_8UC1).clone();
+    cv::Mat img = bundle->Image("floor/map", rows, cols, CV_8UC1);
+    std::vector<float> origin = info["origin"];
+    o_map = std::make_shared<GMap>(GMap(img, Eigen::Vector3f(origin[0], origin[1], origin[2]), info["resolution"]));
+
+    loadRooms(config);
+}
+
+void FloorMap::Save(MapBundleWriter& writer) const
+{
+    const cv::Mat& grid = o_map->Map();
+    const Eigen::Vector3f& origin = o_map->Origin();
+    nlohmann::json info;
+    info["rows"] = grid.rows;
+    info["cols"] = grid.cols;
+    info["origin"] = {origin(0), origin(1), origin(2)};
+    info["resolution"] = o_map->Resolution();
+
+    writer.Add("floor/info", info.dump());
+    cv::Mat img = 255 - grid;
+    writer.Add("floor/map", img);
+    writer.Add("floor/roomSeg", o_roomSeg);
+}
+
+void FloorMap::loadRooms(const nlohmann::json& config)
+{
     std::vector<std::string> classes = config["semantic"]["classes"];
     std::vector<std::string> categories = config["semantic"]["categories"];
     o_classes = classes;
@@ -59,21 +114,6 @@ FloorMap::FloorMap(nlohmann::json config, std::string folderPath)
         //std::cout << room.ID() << std::endl;
         o_rooms.push_back(room);
     }
-
-    std::vector<int> augmentedClasses = {9};
-
-    if(config["map"]["type"] == "GMap")
-    {
-        float resolution = config["map"]["resolution"];
-        std::vector<float> origin = config["map"]["origin"];
-        std::string imgPath = config["map"]["image"];
-        cv::Mat img = cv::imread(folderPath + imgPath);
-        cv::Mat augmentedGmap = augmentGMap(img, augmentedClasses);
-        //cv::imwrite("augmentedGmap.png", augmentedGmap);
-        o_map = std::make_shared<GMap>(GMap(augmentedGmap, Eigen::Vector3f(origin[0], origin[1], origin[2]), resolution));
-    }
-
-    CreateSemMaps();
 }
 
 FloorMap::FloorMap(std::string jsonPath)
@@ -188,34 +228,90 @@ cv::Mat FloorMap::augmentGMap(const cv::Mat& img, const std::vector<int>& augmen
 
 void FloorMap::CreateSemMaps()
 {
-    int h = o_roomSeg.rows;
-    int w = o_roomSeg.cols;
-    std::vector<cv::Mat> semMaps = std::vector<cv::Mat>(o_classes.size());
-
     for(int c = 0; c < o_classes.size(); ++c)
     {    
-        semMaps[c] = cv::Mat::zeros(o_roomSeg.size(), CV_8UC1);
+        cv::imwrite(o_folderPath + "SemMaps/" + o_classes[c] + ".png", SemMap(c));
     }
+}
+
+cv::Mat FloorMap::SemMap(int label) const
+{
+    cv::Mat semMap = cv::Mat::zeros(o_roomSeg.size(), CV_8UC1);
 
     for (int r = 0; r <  o_rooms.size(); ++r)
     {
-        Room room = o_rooms[r];
-        const std::vector<Object> objs = room.Objects();
+        const std::vector<Object> objs = o_rooms[r].Objects();
         for (int o = 0; o <  objs.size(); ++o)
         {
-            int semLabel = objs[o].SemLabel();
-            Eigen::Vector4f pos = objs[o].Position();
-            cv::Rect rect(pos(0), pos(1), pos(2) - pos(0), pos(3) - pos(1));
-            cv::rectangle(semMaps[semLabel], rect, 255, -1);
+            if (objs[o].SemLabel() != label) continue;
+
+            cv::rectangle(semMap, footprint(objs[o]), 255, -1);
         }
     }
 
-    for(int c = 0; c < o_classes.size(); ++c)
-    {    
-        cv::imwrite(o_folderPath + "SemMaps/" + o_classes[c] + ".png", semMaps[c]);
+    return semMap;
+}
+
+cv::Rect FloorMap::footprint(const Object& obj)
+{
+    Eigen::Vector4f pos = obj.Position();
+    return cv::Rect(pos(0), pos(1), pos(2) - pos(0), pos(3) - pos(1));
+}
+
+const std::vector<int>& FloorMap::AugmentedClasses()
+{
+    static const std::vector<int> augmentedClasses = {9};
+
+    return augmentedClasses;
+}
+
+void FloorMap::checkEditable(const Object& obj)
+{
+    const std::vector<int>& augmented = AugmentedClasses();
+    if (std::find(augmented.begin(), augmented.end(), obj.SemLabel()) != augmented.end())
+    {
+        throw std::runtime_error("FloorMap| objects of class " + std::to_string(obj.SemLabel()) + " are part of the occupancy map and can't be edited");
     }
 }
 
+cv::Rect FloorMap::AddObject(int roomID, Object& obj)
+{
+    checkEditable(obj);
+    o_rooms[roomID].AddObject(obj);
+
+    return footprint(obj);
+}
+
+cv::Rect FloorMap::RemoveObject(int roomID, int objectID)
+{
+    Room& room = o_rooms[roomID];
+    const std::vector<Object> objs = room.Objects();
+    auto it = std::find_if(objs.begin(), objs.end(), [&objectID](const Object& obj) {return obj.ID() == objectID;});
+    if (it == objs.end()) return cv::Rect();
+
+    checkEditable(*it);
+    cv::Rect changed = footprint(*it);
+    room.RemoveObject(objectID);
+
+    return changed;
+}
+
+cv::Rect FloorMap::MoveObject(int roomID, int objectID, const Eigen::Vector4f& position)
+{
+    Room& room = o_rooms[roomID];
+    const std::vector<Object> objs = room.Objects();
+    auto it = std::find_if(objs.begin(), objs.end(), [&objectID](const Object& obj) {return obj.ID() == objectID;});
+    if (it == objs.end()) return cv::Rect();
+
+    Object& obj = room.GetObject(objectID);
+    checkEditable(obj);
+    cv::Rect before = footprint(obj);
+    obj.Position(position);
+
+    // both the pixels it left and the ones it covers now changed
+    return before | footprint(obj);
+}
+
 
 int FloorMap::GetRoomID(float x, float y)
 {
@@ -225,9 +321,8 @@ int FloorMap::GetRoomID(float x, float y)
 
 int FloorMap::GetRoomID(Eigen::Vector3f pose)
 {
-    Eigen::Vector2f uv = o_map->World2Map(Eigen::Vector2f(pose(0), pose(1)));
-    uchar val = o_roomSeg.at<uchar>(uv(1), uv(0));
-    return val;
+    // the raster clamps poses off the map to the background
+    return Raster()->RoomID(pose(0), pose(1));
 }
 
 
@@ -395,4 +490,39 @@ void FloorMap::Seed(int id, const Eigen::Vector2f& seed)
 {
     Eigen::Vector2f p = o_map->Map2World(seed);
     o_seeds[id] = Eigen::Vector3f(p(0), p(1), 0);
+}
+
+
+const std::shared_ptr<FreeSpaceIndex>& FloorMap::FreeSpace()
+{
+    if (!o_freeSpace) UpdateFreeSpace();
+
+    return o_freeSpace;
+}
+
+void FloorMap::UpdateFreeSpace()
+{
+    std::vector<int> purposes(o_rooms.size());
+    for(long unsigned int i = 0; i < o_rooms.size(); ++i)
+    {
+        purposes[i] = o_rooms[i].Purpose();
+    }
+
+    o_freeSpace = std::make_shared<FreeSpaceIndex>(FreeSpaceIndex(o_map, o_roomSeg, purposes));
+}
+
+const std::shared_ptr<TiledMap>& FloorMap::Raster(int margin)
+{
+    if (!o_raster)
+    {
+        o_raster = std::make_shared<TiledMap>(TiledMap(o_map, margin));
+        o_raster->SetRooms(o_roomSeg);
+    }
+    else if (o_raster->Margin() < margin)
+    {
+        o_raster->Grow(margin);
+        o_raster->SetRooms(o_roomSeg);
+    }
+
+    return o_raster;
 }
\ No newline at end of file
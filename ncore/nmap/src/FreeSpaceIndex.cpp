@@ -0,0 +1,215 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                                      #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                                     #
+#                                                                              #
+#  File: FreeSpaceIndex.cpp                                                    #
+# ##############################################################################
+**/
+
+#include "FreeSpaceIndex.h"
+#include <algorithm>
+
+FreeSpaceIndex::FreeSpaceIndex(std::shared_ptr<GMap> map, const cv::Mat& roomSeg, const std::vector<int>& purposes)
+{
+	o_map = map;
+	o_resolution = o_map->Resolution();
+	o_cols = o_map->Map().cols;
+	o_box = makeBox(o_map->Map2World(o_map->TopLeft()), o_map->Map2World(o_map->BottomRight()));
+
+	std::vector<double> weights;
+	Box part;
+
+	collect(o_box, o_global);
+	for(int cell : o_global.cells)
+	{
+		weights.push_back(overlap(cell, o_box, part));
+	}
+	o_global.alias = AliasTable(weights);
+
+	bool useRooms = (!roomSeg.empty()) && (roomSeg.rows == o_map->Map().rows) && (roomSeg.cols == o_cols);
+	if (!useRooms) return;
+
+	// the room tables partition the global one, the purpose tables group rooms
+	std::vector<std::vector<double>> roomWeights;
+	std::map<int, std::vector<double>> purposeWeights;
+
+	for(long unsigned int i = 0; i < o_global.cells.size(); ++i)
+	{
+		int cell = o_global.cells[i];
+		int roomID = roomSeg.at<uchar>(cell / o_cols, cell % o_cols);
+
+		if (roomID >= int(o_rooms.size()))
+		{
+			o_rooms.resize(roomID + 1);
+			roomWeights.resize(roomID + 1);
+		}
+		o_rooms[roomID].cells.push_back(cell);
+		roomWeights[roomID].push_back(weights[i]);
+
+		if (roomID < int(purposes.size()))
+		{
+			int purpose = purposes[roomID];
+			o_purposes[purpose].cells.push_back(cell);
+			purposeWeights[purpose].push_back(weights[i]);
+		}
+	}
+
+	for(long unsigned int r = 0; r < o_rooms.size(); ++r)
+	{
+		o_rooms[r].alias = AliasTable(roomWeights[r]);
+	}
+
+	for(auto& it : o_purposes)
+	{
+		it.second.alias = AliasTable(purposeWeights[it.first]);
+	}
+}
+
+FreeSpaceIndex::Box FreeSpaceIndex::makeBox(const Eigen::Vector2f& corner1, const Eigen::Vector2f& corner2) const
+{
+	Box box;
+	box.xmin = std::min(corner1(0), corner2(0));
+	box.xmax = std::max(corner1(0), corner2(0));
+	box.ymin = std::min(corner1(1), corner2(1));
+	box.ymax = std::max(corner1(1), corner2(1));
+
+	return box;
+}
+
+double FreeSpaceIndex::overlap(int cell, const Box& box, Box& part) const
+{
+	// a cell holds every (x, y) that GMap::World2Map rounds to it, so it extends half a pixel around its center
+	Eigen::Vector2f c = o_map->Map2World(Eigen::Vector2f(cell % o_cols, cell / o_cols));
+	float half = 0.5 * o_resolution;
+
+	double wx = 1.0;
+	double wy = 1.0;
+
+	if (box.xmax > box.xmin)
+	{
+		part.xmin = std::max(c(0) - half, box.xmin);
+		part.xmax = std::min(c(0) + half, box.xmax);
+		wx = std::max(0.0f, part.xmax - part.xmin);
+	}
+	else
+	{
+		part.xmin = box.xmin;
+		part.xmax = box.xmin;
+	}
+
+	if (box.ymax > box.ymin)
+	{
+		part.ymin = std::max(c(1) - half, box.ymin);
+		part.ymax = std::min(c(1) + half, box.ymax);
+		wy = std::max(0.0f, part.ymax - part.ymin);
+	}
+	else
+	{
+		part.ymin = box.ymin;
+		part.ymax = box.ymin;
+	}
+
+	return wx * wy;
+}
+
+void FreeSpaceIndex::collect(const Box& box, Table& table) const
+{
+	// the range of cells the box corners round to, limited to the area GMap::IsValid2D accepts
+	Eigen::Vector2f uvMin = o_map->World2Map(Eigen::Vector2f(box.xmin, box.ymax));
+	Eigen::Vector2f uvMax = o_map->World2Map(Eigen::Vector2f(box.xmax, box.ymin));
+	Eigen::Vector2f br = o_map->BottomRight();
+
+	int uMin = std::max(0, int(uvMin(0)));
+	int vMin = std::max(0, int(uvMin(1)));
+	int uMax = std::min(int(br(0)), int(uvMax(0)));
+	int vMax = std::min(int(br(1)), int(uvMax(1)));
+
+	for(int v = vMin; v <= vMax; ++v)
+	{
+		for(int u = uMin; u <= uMax; ++u)
+		{
+			if (o_map->IsValid2D(Eigen::Vector2f(u, v)))
+			{
+				table.cells.push_back(v * o_cols + u);
+			}
+		}
+	}
+}
+
+Eigen::Vector2f FreeSpaceIndex::sampleCell(int cell, const Box& box, RandomStream& stream) const
+{
+	Box part;
+	overlap(cell, box, part);
+
+	float x = part.xmin + stream.Uniform() * (part.xmax - part.xmin);
+	float y = part.ymin + stream.Uniform() * (part.ymax - part.ymin);
+
+	// keep the draw off the cell borders, where float rounding in GMap::World2Map could pick the neighbouring cell. A degenerate box
+	// dimension is left as is, the cell was found by rounding that exact coordinate
+	Eigen::Vector2f c = o_map->Map2World(Eigen::Vector2f(cell % o_cols, cell / o_cols));
+	float inner = (0.5 - borderMargin) * o_resolution;
+	if (box.xmax > box.xmin) x = std::min(std::max(x, c(0) - inner), c(0) + inner);
+	if (box.ymax > box.ymin) y = std::min(std::max(y, c(1) - inner), c(1) + inner);
+
+	return Eigen::Vector2f(x, y);
+}
+
+bool FreeSpaceIndex::sample(const Table& table, RandomStream& stream, Eigen::Vector2f& xy) const
+{
+	if (table.alias.Empty()) return false;
+
+	int cell = table.cells[table.alias.Sample(stream)];
+	xy = sampleCell(cell, o_box, stream);
+
+	return true;
+}
+
+bool FreeSpaceIndex::SampleUniform(RandomStream& stream, Eigen::Vector2f& xy) const
+{
+	return sample(o_global, stream, xy);
+}
+
+bool FreeSpaceIndex::SampleRoom(int roomID, RandomStream& stream, Eigen::Vector2f& xy) const
+{
+	if ((roomID < 0) || (roomID >= int(o_rooms.size()))) return false;
+
+	return sample(o_rooms[roomID], stream, xy);
+}
+
+bool FreeSpaceIndex::SamplePurpose(int purpose, RandomStream& stream, Eigen::Vector2f& xy) const
+{
+	auto it = o_purposes.find(purpose);
+	if (it == o_purposes.end()) return false;
+
+	return sample(it->second, stream, xy);
+}
+
+bool FreeSpaceIndex::SampleBox(const Eigen::Vector2f& corner1, const Eigen::Vector2f& corner2, int n, RandomStream& stream, std::vector<Eigen::Vector2f>& xy) const
+{
+	xy.clear();
+
+	Box box = makeBox(corner1, corner2);
+	Table table;
+	collect(box, table);
+
+	std::vector<double> weights(table.cells.size());
+	Box part;
+	for(long unsigned int i = 0; i < table.cells.size(); ++i)
+	{
+		weights[i] = overlap(table.cells[i], box, part);
+	}
+	table.alias = AliasTable(weights);
+	if (table.alias.Empty()) return false;
+
+	xy.resize(n);
+	for(int i = 0; i < n; ++i)
+	{
+		int cell = table.cells[table.alias.Sample(stream)];
+		xy[i] = sampleCell(cell, box, stream);
+	}
+
+	return true;
+}
@@ -83,8 +83,37 @@ void GMap::getBorders()
 	cv::Point br = rect.br();
 	o_topLeft = Eigen::Vector2f(tl.x, tl.y);
 	o_bottomRight = Eigen::Vector2f((br.x < o_gridmap.cols) ? br.x : o_gridmap.cols - 1, (br.y < o_maxy) ? br.y : (o_maxy - 1));
+
+	// the known cells are the free (<= 1) and the occupied (> 127) ones, the rest is the unknown margin
+	int umin = o_gridmap.cols, vmin = o_maxy, umax = -1, vmax = -1;
+	for(int v = 0; v <= o_bottomRight(1); ++v)
+	{
+		const uchar* row = o_gridmap.ptr<uchar>(v);
+		for(int u = 0; u <= o_bottomRight(0); ++u)
+		{
+			if ((row[u] <= 1) || (row[u] > 127))
+			{
+				umin = std::min(umin, u);
+				umax = std::max(umax, u);
+				vmin = std::min(vmin, v);
+				vmax = std::max(vmax, v);
+			}
+		}
+	}
+	if (umax < 0) o_known = cv::Rect(0, 0, 0, 0);
+	else o_known = cv::Rect(umin, vmin, umax - umin + 1, vmax - vmin + 1);
 } 
 
+cv::Rect GMap::Crop(int margin) const
+{
+	int u0 = std::max(o_known.x - margin, 0);
+	int v0 = std::max(o_known.y - margin, 0);
+	int u1 = std::min(o_known.x + o_known.width + margin, o_gridmap.cols);
+	int v1 = std::min(o_known.y + o_known.height + margin, o_maxy);
+
+	return cv::Rect(u0, v0, std::max(u1 - u0, 0), std::max(v1 - v0, 0));
+}
+
 Eigen::Vector2f GMap::World2Map(Eigen::Vector2f xy) const
 {
 	int u = round((xy(0) - o_origin(0)) / o_resolution);
@@ -0,0 +1,239 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: MapBundle.cpp                                                         #
+# ##############################################################################
+**/
+
+#include "MapBundle.h"
+
+#include <stdexcept>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace
+{
+	const char magic[8] = {'N', 'M', 'C', 'L', 'B', 'N', 'D', 'L'};
+	const size_t alignment = 64;
+	const size_t nameLength = 48;
+
+	// the file starts with the header, followed by the section table and the 64 byte aligned sections
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t numSections;
+		// checksum of the section table
+		uint64_t checksum;
+	};
+
+	struct Entry
+	{
+		char name[nameLength];
+		uint64_t offset;
+		uint64_t size;
+		uint64_t checksum;
+	};
+
+	size_t align(size_t offset)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+}
+
+
+MapBundle::MapBundle(const std::string& path, bool verify)
+{
+	o_path = path;
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		throw std::runtime_error("MapBundle| can't open " + path);
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		close(fd);
+		throw std::runtime_error("MapBundle| can't stat " + path);
+	}
+	o_size = st.st_size;
+	void* data = (o_size > 0) ? mmap(nullptr, o_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		throw std::runtime_error("MapBundle| can't map " + path);
+	}
+	o_data = static_cast<const uint8_t*>(data);
+
+	try
+	{
+		if (o_size < sizeof(Header)) throw std::runtime_error("MapBundle| " + path + " is too small");
+
+		Header header;
+		std::memcpy(&header, o_data, sizeof(Header));
+		if (std::memcmp(header.magic, magic, sizeof(magic)) != 0) throw std::runtime_error("MapBundle| " + path + " is not a map bundle");
+		if (header.version != version)
+		{
+			throw std::runtime_error("MapBundle| " + path + " has version " + std::to_string(header.version) + ", expected " + std::to_string(version));
+		}
+
+		size_t tableSize = header.numSections * sizeof(Entry);
+		if (sizeof(Header) + tableSize > o_size) throw std::runtime_error("MapBundle| " + path + " is truncated");
+		const uint8_t* table = o_data + sizeof(Header);
+		if (Checksum(table, tableSize) != header.checksum) throw std::runtime_error("MapBundle| " + path + " has a corrupt section table");
+
+		for(uint32_t s = 0; s < header.numSections; ++s)
+		{
+			Entry entry;
+			std::memcpy(&entry, table + s * sizeof(Entry), sizeof(Entry));
+			std::string name(entry.name, strnlen(entry.name, nameLength));
+			if ((entry.offset > o_size) || (entry.size > o_size - entry.offset)) throw std::runtime_error("MapBundle| section " + name + " of " + path + " is truncated");
+			if (verify && (Checksum(o_data + entry.offset, entry.size) != entry.checksum))
+			{
+				throw std::runtime_error("MapBundle| section " + name + " of " + path + " fails its checksum");
+			}
+			o_sections[name] = Section{entry.offset, entry.size};
+		}
+	}
+	catch (...)
+	{
+		munmap(const_cast<uint8_t*>(o_data), o_size);
+		throw;
+	}
+}
+
+MapBundle::~MapBundle()
+{
+	if (o_data) munmap(const_cast<uint8_t*>(o_data), o_size);
+}
+
+bool MapBundle::Has(const std::string& name) const
+{
+	return o_sections.count(name) > 0;
+}
+
+const void* MapBundle::Data(const std::string& name) const
+{
+	auto it = o_sections.find(name);
+	if (it == o_sections.end()) throw std::runtime_error("MapBundle| " + o_path + " has no section " + name);
+
+	return o_data + it->second.offset;
+}
+
+size_t MapBundle::Size(const std::string& name) const
+{
+	auto it = o_sections.find(name);
+	if (it == o_sections.end()) throw std::runtime_error("MapBundle| " + o_path + " has no section " + name);
+
+	return it->second.size;
+}
+
+void MapBundle::checkSize(const std::string& name, size_t size) const
+{
+	if (Size(name) != size)
+	{
+		throw std::runtime_error("MapBundle| section " + name + " of " + o_path + " has " + std::to_string(Size(name)) + " bytes, expected " + std::to_string(size));
+	}
+}
+
+std::string MapBundle::Text(const std::string& name) const
+{
+	return std::string(static_cast<const char*>(Data(name)), Size(name));
+}
+
+cv::Mat MapBundle::Image(const std::string& name, int rows, int cols, int type) const
+{
+	cv::Mat header(rows, cols, type, const_cast<void*>(Data(name)));
+	checkSize(name, header.total() * header.elemSize());
+
+	return header;
+}
+
+uint64_t MapBundle::Checksum(const void* data, size_t size)
+{
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	uint64_t hash = 14695981039346656037ull;
+	for(size_t i = 0; i < size; ++i)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+
+	return hash;
+}
+
+
+void MapBundleWriter::Add(const std::string& name, const void* data, size_t size)
+{
+	if (name.size() >= nameLength) throw std::runtime_error("MapBundleWriter| section name " + name + " is too long");
+
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	o_sections.push_back(std::make_pair(name, std::vector<uint8_t>(bytes, bytes + size)));
+}
+
+void MapBundleWriter::Add(const std::string& name, const std::string& text)
+{
+	Add(name, text.data(), text.size());
+}
+
+void MapBundleWriter::Add(const std::string& name, const cv::Mat& image)
+{
+	cv::Mat continuous = image.isContinuous() ? image : image.clone();
+	Add(name, continuous.data, continuous.total() * continuous.elemSize());
+}
+
+void MapBundleWriter::Write(const std::string& path) const
+{
+	Header header;
+	std::memcpy(header.magic, magic, sizeof(magic));
+	header.version = MapBundle::version;
+	header.numSections = o_sections.size();
+
+	std::vector<Entry> table(o_sections.size());
+	size_t offset = align(sizeof(Header) + table.size() * sizeof(Entry));
+	for(size_t s = 0; s < o_sections.size(); ++s)
+	{
+		Entry& entry = table[s];
+		std::memset(&entry, 0, sizeof(Entry));
+		std::memcpy(entry.name, o_sections[s].first.data(), o_sections[s].first.size());
+		entry.offset = offset;
+		entry.size = o_sections[s].second.size();
+		entry.checksum = MapBundle::Checksum(o_sections[s].second.data(), entry.size);
+		offset = align(offset + entry.size);
+	}
+	header.checksum = MapBundle::Checksum(table.data(), table.size() * sizeof(Entry));
+
+	std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!file) throw std::runtime_error("MapBundleWriter| can't write " + tmpPath);
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		file.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(Entry));
+		const char zeros[alignment] = {0};
+		size_t pos = sizeof(Header) + table.size() * sizeof(Entry);
+		for(size_t s = 0; s < o_sections.size(); ++s)
+		{
+			file.write(zeros, table[s].offset - pos);
+			file.write(reinterpret_cast<const char*>(o_sections[s].second.data()), table[s].size);
+			pos = table[s].offset + table[s].size;
+		}
+		if (!file) throw std::runtime_error("MapBundleWriter| can't write " + tmpPath);
+	}
+
+	if (std::rename(tmpPath.c_str(), path.c_str()) != 0)
+	{
+		throw std::runtime_error("MapBundleWriter| can't rename " + tmpPath + " to " + path);
+	}
+}
@@ -0,0 +1,98 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: TiledMap.cpp                                                          #
+# ##############################################################################
+**/
+
+#include "TiledMap.h"
+
+
+TiledMap::TiledMap(std::shared_ptr<GMap> map, int margin)
+{
+	o_map = map;
+	o_margin = std::max(margin, 0);
+	o_crop = map->Crop(o_margin);
+	o_origin = map->Origin();
+	o_resolution = map->Resolution();
+
+	const cv::Mat& grid = map->Map();
+	o_rows = grid.rows;
+	o_width = ((o_crop.width + 2 * guard + tileSize - 1) / tileSize) * tileSize;
+	o_height = ((o_crop.height + 2 * guard + tileSize - 1) / tileSize) * tileSize;
+	o_tilesX = o_width / tileSize;
+
+	// the guard band and the padding keep the default record, which is invalid and outside
+	o_cells.assign(o_width * o_height, MapCell());
+
+	// IsValid2D rejects everything beyond the bottom right corner of the occupied area
+	Eigen::Vector2f br = map->BottomRight();
+	int maxU = std::min(int(br(0)), o_crop.x + o_crop.width - 1);
+	int maxV = std::min(int(br(1)), o_crop.y + o_crop.height - 1);
+
+	#pragma omp parallel for
+	for(int v = o_crop.y; v <= maxV; ++v)
+	{
+		const uchar* row = grid.ptr<uchar>(v);
+		for(int u = o_crop.x; u <= maxU; ++u)
+		{
+			o_cells[Index(u, v)].occupancy = row[u];
+		}
+	}
+}
+
+
+void TiledMap::Grow(int margin)
+{
+	if (margin <= o_margin) return;
+
+	TiledMap grown(o_map, margin);
+
+	#pragma omp parallel for
+	for(int v = o_crop.y; v < o_crop.y + o_crop.height; ++v)
+	{
+		for(int u = o_crop.x; u < o_crop.x + o_crop.width; ++u)
+		{
+			const MapCell& cell = o_cells[Index(u, v)];
+			MapCell& target = grown.o_cells[grown.Index(u, v)];
+			target.likelihood = cell.likelihood;
+			target.room = cell.room;
+		}
+	}
+
+	*this = std::move(grown);
+}
+
+
+void TiledMap::SetRooms(const cv::Mat& roomSeg)
+{
+	#pragma omp parallel for
+	for(int v = o_crop.y; v < o_crop.y + o_crop.height; ++v)
+	{
+		const uchar* row = roomSeg.ptr<uchar>(v);
+		for(int u = o_crop.x; u < o_crop.x + o_crop.width; ++u)
+		{
+			o_cells[Index(u, v)].room = row[u];
+		}
+	}
+}
+
+
+void TiledMap::SetLikelihood(const uint16_t* table, const cv::Rect& region, int maxU, int maxV)
+{
+	#pragma omp parallel for
+	for(int v = o_crop.y; v < o_crop.y + o_crop.height; ++v)
+	{
+		for(int u = o_crop.x; u < o_crop.x + o_crop.width; ++u)
+		{
+			int ru = u - region.x;
+			int rv = v - region.y;
+			bool in = (u <= maxU) && (v <= maxV) && (ru >= 0) && (rv >= 0) && (ru < region.width) && (rv < region.height);
+			o_cells[Index(u, v)].likelihood = in ? table[rv * region.width + ru] : outside;
+		}
+	}
+}
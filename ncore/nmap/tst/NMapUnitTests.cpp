@@ -20,6 +20,7 @@
 #include <string>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
+#include <boost/filesystem.hpp>
 
 #include "GMap.h"
 #include "Utils.h"
@@ -27,6 +28,10 @@
 #include <fstream>
 #include "Room.h"
 #include "FloorMap.h"
+#include "FreeSpaceIndex.h"
+#include "AliasTable.h"
+#include "TiledMap.h"
+#include "MapBundle.h"
 #include <nlohmann/json.hpp>
 
 
@@ -487,9 +492,158 @@ TEST(TestFloorMap, test1) {
 
 }
 
+TEST(TestAliasTable, test1) {
 
+    std::vector<double> weights{1.0, 0.0, 3.0, 4.0};
+    AliasTable table(weights);
+    RandomStream stream(3);
 
+    std::vector<int> hist(4, 0);
+    int n = 80000;
+    for(int i = 0; i < n; ++i) ++hist[table.Sample(stream)];
 
+    ASSERT_EQ(hist[1], 0);
+    ASSERT_NEAR(hist[0] / float(n), 0.125, 0.01);
+    ASSERT_NEAR(hist[2] / float(n), 0.375, 0.01);
+    ASSERT_NEAR(hist[3] / float(n), 0.5, 0.01);
+}
+
+TEST(TestFreeSpaceIndex, test1) {
+
+    std::string jsonPath = testPath + "floor.config";
+
+    using json = nlohmann::json;
+    std::ifstream file(jsonPath);
+    json config;
+    file >> config;
+
+    FloorMap floor(config, testPath);
+    std::shared_ptr<FreeSpaceIndex> freeSpace = floor.FreeSpace();
+    std::shared_ptr<GMap> gmap = floor.Map();
+    RandomStream stream(0);
+
+    ASSERT_GT(freeSpace->NumFree(), 0);
+
+    for(int i = 0; i < 1000; ++i)
+    {
+        Eigen::Vector2f xy;
+        ASSERT_TRUE(freeSpace->SampleUniform(stream, xy));
+        ASSERT_TRUE(gmap->IsValid(Eigen::Vector3f(xy(0), xy(1), 0)));
+    }
+
+    int roomID = 1;
+    for(int i = 0; i < 100; ++i)
+    {
+        Eigen::Vector2f xy;
+        ASSERT_TRUE(freeSpace->SampleRoom(roomID, stream, xy));
+        ASSERT_EQ(floor.GetRoomID(Eigen::Vector3f(xy(0), xy(1), 0)), roomID);
+    }
+
+    // every draw in a box rounds to a free cell, including the ones on the borders of the box
+    std::vector<Eigen::Vector2f> xy;
+    ASSERT_TRUE(freeSpace->SampleBox(Eigen::Vector2f(-3, -3), Eigen::Vector2f(3, 3), 1000, stream, xy));
+    for(const Eigen::Vector2f& p : xy)
+    {
+        ASSERT_TRUE(gmap->IsValid(Eigen::Vector3f(p(0), p(1), 0)));
+    }
+
+    // a degenerate box returns the exact point
+    ASSERT_TRUE(freeSpace->SampleBox(Eigen::Vector2f(0.1, 0.1), Eigen::Vector2f(0.1, 0.1), 3, stream, xy));
+    ASSERT_EQ(xy[2], Eigen::Vector2f(0.1, 0.1));
+}
+
+
+
+TEST(TestTiledMap, test1) {
+
+    std::string jsonPath = testPath + "floor.config";
+
+    using json = nlohmann::json;
+    std::ifstream file(jsonPath);
+    json config;
+    file >> config;
+
+    FloorMap floor(config, testPath);
+    std::shared_ptr<GMap> gmap = floor.Map();
+    std::shared_ptr<TiledMap> raster = floor.Raster();
+    const cv::Mat& grid = gmap->Map();
+
+    // the raster agrees with GMap everywhere on the map, and with the room segmentation on the free cells
+    for(int v = 0; v < grid.rows; v += 3)
+    {
+        for(int u = 0; u < grid.cols; u += 3)
+        {
+            Eigen::Vector2f xy = gmap->Map2World(Eigen::Vector2f(u, v));
+            bool valid = gmap->IsValid(Eigen::Vector3f(xy(0), xy(1), 0));
+            ASSERT_EQ(raster->IsValid(xy(0), xy(1)), valid);
+            if (valid)
+            {
+                ASSERT_EQ(raster->RoomID(xy(0), xy(1)), floor.GetRoomID(float(u), float(v)));
+            }
+        }
+    }
+
+    // only the known part of the map is stored
+    cv::Rect crop = raster->Crop();
+    ASSERT_LE(crop.width, grid.cols);
+    ASSERT_LE(crop.height, grid.rows);
+
+    // off the map the lookups land in the guard band
+    const MapCell& far = raster->Cell(-100000, 5 * grid.rows);
+    ASSERT_EQ(far.occupancy, 255);
+    ASSERT_EQ(far.room, 0);
+    ASSERT_EQ(far.likelihood, TiledMap::outside);
+    ASSERT_FALSE(raster->IsValid(1e6, -1e6));
+
+    // a larger margin grows the same raster, the layers stay
+    int room = raster->RoomID(1.0, -7.5);
+    int margin = raster->Margin();
+    std::shared_ptr<TiledMap> grown = floor.Raster(margin + 5);
+    ASSERT_EQ(grown.get(), raster.get());
+    ASSERT_EQ(raster->Margin(), margin + 5);
+    ASSERT_GE(raster->Crop().width, crop.width);
+    ASSERT_EQ(raster->RoomID(1.0, -7.5), room);
+}
+
+
+
+TEST(TestMapBundle, test1)
+{
+	// written to the system temp directory, not to the test data
+	boost::filesystem::path tempPath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("test-%%%%-%%%%.bundle");
+	std::string path = tempPath.string();
+	std::vector<uint32_t> values = {1, 2, 3, 0xDEADBEEF};
+	cv::Mat image(3, 5, CV_8UC1, cv::Scalar(7));
+
+	MapBundleWriter writer;
+	writer.Add("info", std::string("{\"rows\": 3}"));
+	writer.Add("values", values);
+	writer.Add("image", image);
+	writer.Write(path);
+
+	{
+		MapBundle bundle(path);
+		ASSERT_TRUE(bundle.Has("values"));
+		ASSERT_FALSE(bundle.Has("other"));
+		ASSERT_EQ(bundle.Text("info"), "{\"rows\": 3}");
+		const uint32_t* mapped = bundle.Array<uint32_t>("values", values.size());
+		ASSERT_EQ(std::vector<uint32_t>(mapped, mapped + values.size()), values);
+		// sections are aligned for vector loads
+		ASSERT_EQ(reinterpret_cast<uintptr_t>(mapped) % 64, 0);
+		ASSERT_EQ(cv::countNonZero(bundle.Image("image", 3, 5, CV_8UC1) != image), 0);
+		ASSERT_THROW(bundle.Array<uint32_t>("values", 3), std::runtime_error);
+	}
+
+	// a flipped byte in the last section fails its checksum
+	{
+		std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+		file.seekp(-1, std::ios::end);
+		file.put(1);
+	}
+	ASSERT_THROW(MapBundle bundle(path, true), std::runtime_error);
+	ASSERT_NO_THROW(MapBundle bundle(path));
+	std::remove(path.c_str());
+}
 
 int main(int argc, char **argv) {
    ::testing::InitGoogleTest(&argc, argv);
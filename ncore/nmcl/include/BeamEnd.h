@@ -17,9 +17,14 @@
 #include <string>
 #include "GMap.h"
 #include <vector>
+#include <unordered_map>
 #include <eigen3/Eigen/Dense>
 #include "LidarData.h"
 #include "Particle.h"
+#include "ParticleSet.h"
+#include "AlignedAllocator.h"
+#include "TiledMap.h"
+#include "MapBundle.h"
 
 class BeamEnd
 {
@@ -46,13 +51,98 @@ class BeamEnd
 
 		BeamEnd(std::shared_ptr<GMap> Gmap, float sigma = 8, float maxRange = 15, Weighting weighting = Weighting::LAPLACE);
 
-		//! Computes weights for all particles based on how well the observation matches the map
+		//! A constructor that takes the EDT from a compiled bundle instead of computing it, see NMCLFactory::Compile. 
+		// Throws std::runtime_error if the bundle was compiled for another map or maxRange
+		/*!
+	      \param Gmap is a ptr to the GMAP object the bundle was compiled from
+	      \param bundle is a bundle written with Save, the EDT stays in the mapped file
+	    */
+		BeamEnd(std::shared_ptr<GMap> Gmap, std::shared_ptr<const MapBundle> bundle, float sigma = 8, float maxRange = 15, Weighting weighting = Weighting::LAPLACE);
+
+		//! Adds the EDT to a bundle
+		void Save(MapBundleWriter& writer) const;
+
+		//! Makes map cells obstacles for the sensor model, e.g. a blocked corridor or a closed door. The EDT and the likelihood layer are updated
+		// by a brushfire from the new obstacles that stops at maxRange, so the cost depends on the size of the edit and not of the map.
+		// The result is the same as recomputing the EDT on the edited map. The GMap itself is not changed. Not safe to call during ComputeWeights
+		/*!
+		  \param cells are (u, v) in GMap pixel coordinates, cells outside the region the EDT covers are ignored
+		*/
+		void InsertObstacles(const std::vector<Eigen::Vector2i>& cells);
+
+		//! Frees obstacle cells again. The cells whose distance came through them are reset and filled from the cells around them
+		/*!
+		  \param cells are (u, v) in GMap pixel coordinates, cells that aren't obstacles are ignored
+		*/
+		void RemoveObstacles(const std::vector<Eigen::Vector2i>& cells);
+
+		//! Computes weights for all particles based on how well the observation matches the map. The beams are converted to arrays once,
+		// then each particle projects all of them into the map and gathers their EDT values in one vectorized loop, see projectBeams
 		/*!
 		  \param particles is a vector of Particle elements
 		  \param SensorData is an abstract container for sensor data. This function expects LidarData type
 		*/
 
+		void ComputeWeights(ParticleSet& particles, std::shared_ptr<LidarData> data);
+
 		void ComputeWeights(std::vector<Particle>& particles, std::shared_ptr<LidarData> data);
+
+		//! Moves the likelihood layer into a shared raster, e.g. FloorMap::Raster(), so that one cell record serves the sensor model, 
+		// IsValid and the room lookups. The raster must be built on the same map
+		void SetRaster(std::shared_ptr<TiledMap> raster);
+
+		const std::shared_ptr<TiledMap>& Raster() const
+		{
+			return o_raster;
+		}
+
+		//! The margin around the known part of the map that the raster passed to SetRaster has to cover, the truncation distance of the EDT
+		int RasterMargin() const;
+
+		//! Scores all particles on a subset of the beams first, and only gives the full scan to the particles whose coarse weight
+		// is within margin (in log-weight) of the best coarse weight. The others keep the coarse weight, scaled up to the full scan. 0 beams switches it off
+		/*!
+		  \param coarseBeams is the size of the beam subset, taken at an even stride over the beams that pass the mask
+		  \param margin is the log-weight difference to the best coarse weight beyond which a particle is stopped
+		*/
+		void SetCoarseToFine(int coarseBeams, float margin = 10);
+
+		//! The number of particles the last ComputeWeights stopped after the coarse pass
+		int NumPruned() const
+		{
+			return o_numPruned;
+		}
+
+		//! Scores only one particle per (map cell, heading bin) and gives its weight to all other particles there. 
+		// With the same number of bins as SetRotationBins this is exact, as the binned projection only depends on the cell and the bin. 0 switches it off
+		/*!
+		  \param headingBins is the number of heading bins over [-pi, pi)
+		*/
+		void SetMemoization(int headingBins);
+
+		//! The fraction of the particles since SetMemoization that got the weight of another particle instead of being scored
+		double MemoHitRate() const
+		{
+			return o_memoLookups ? double(o_memoHits) / o_memoLookups : 0.0;
+		}
+
+		//! Approximates the projection by rotating the scan once per heading bin into integer cell offsets, each particle then only adds its own cell.
+		// A beam end lands at most MaxProjectionError cells away from the exact projection. 0 bins switches back to the exact projection
+		/*!
+		  \param bins is the number of heading bins over [-pi, pi), e.g. 360 for 1 degree bins
+		*/
+		void SetRotationBins(int bins);
+
+		int RotationBins() const
+		{
+			return o_rotationBins;
+		}
+
+		//! Bound on the per-axis displacement, in cells, of a beam end of the given range under the binned projection
+		/*!
+		  \param beamRange is the distance of the beam end from the sensor in meters
+		*/
+		float MaxProjectionError(float beamRange) const;
 		
 		//! Returns truth if a particle is in an occupied grid cell, false otherwise. Notice that for particles in unknown areas the return is false.
 		/*!
@@ -68,22 +158,88 @@ class BeamEnd
 
 		float getLikelihood(float distance);
 
+		//! The constants of the schemes, the raster and the table, once the EDT is there
+		void setup();
+
+		//! The table code of a distance, (d / sigma)^2 or d quantized to o_step
+		uint16_t code(float distance) const;
+
+		//! Recovers the fixed point distances of the EDT, for the incremental updates
+		void initDynamic();
+
+		//! Lowers the distances from the seeds (distance, cell id) outwards, the cells that get a new distance are added to changed
+		void propagate(std::vector<std::pair<int32_t, int>>& seeds, std::vector<int>& changed);
+
+		//! Writes the new distances of the changed cells to the EDT and the likelihood layer
+		void applyChanges(const std::vector<int>& changed);
+
 		void plotScan(Eigen::Vector3f laser, std::vector<Eigen::Vector2f>& zMap); 
 
 		std::vector<Eigen::Vector2f> scan2Map(Eigen::Vector3f pose, const std::vector<Eigen::Vector3f>& scan);
 
-		double naive(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask);
+		//! Sums over the beams of one particle, in the units of the weighting scheme, i.e. (d / sigma)^2 or d
+		struct BeamSums
+		{
+			//! beams that end inside the map, and beams that don't
+			int valid = 0;
+			int outside = 0;
+			//! beams closer than sigma (or 1 for the quadratic term) to an obstacle
+			int near = 0;
+			//! beams closer than maxRange to an obstacle
+			int inRange = 0;
+			double sum = 0;
+			double sumNear = 0;
+			double sumInRange = 0;
+		};
+
+		//! Quantizes the per-cell term of the weighting scheme into the likelihood layer of o_raster
+		void buildTable();
+
+		//! Transforms the n beams in o_beamX, o_beamY by the pose and writes the table code at each beam end to codes. 
+		// Beams that end where the scheme has no information get the code outside. The loop is branch-free, so it vectorizes with gathers where the target has them
+		void projectBeams(float x, float y, float theta, int n, uint16_t* codes) const;
+
+		//! Fills the offsets of the heading bins used by the n particles with the theta values pt
+		void rotateBins(const float* pt, int n, int numActive);
+
+		int headingBin(float theta) const;
 
-		double geometric(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask);
+		//! Like projectBeams, but for a particle in cell (u0, v0) with the beams already rotated to the cell offsets du, dv
+		void projectBinned(int u0, int v0, const int* du, const int* dv, int n, uint16_t* codes) const;
 
-		double gPoE(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask);
+		//! Integer reduction over the codes written by projectBeams, only the sums the scheme W reads are computed
+		template<Weighting W>
+		BeamSums sumBeams(const uint16_t* codes, int n) const;
 
-		double giorgio(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask);
+		//! The per-particle loop of ComputeWeights, specialized for one weighting scheme. Scores the m particles in ids, or all of them if ids is nullptr
+		template<Weighting W>
+		void weighParticles(ParticleSet& particles, const int* ids, int m, int numActive, int numCoarse, int numBeams);
 
+		//! Hashes the particles by (u, v, heading bin), fills o_memoIds with one particle per key and o_memoRep with the representative of each particle
+		void memoize(const ParticleSet& particles);
 
-		double integration(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask);
+		//! Extrapolates the sums of a beam subset to a scan scale times larger
+		BeamSums scaleSums(const BeamSums& sums, double scale) const;
 
-		double laplace(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask);
+		//! The weight of the scheme W for a particle at (x, y)
+		template<Weighting W>
+		double weigh(const BeamSums& sums, int numBeams, float x, float y);
+
+		// the weighting schemes need one exp or pow per particle on top of the sums
+		double naive(const BeamSums& sums);
+
+		double geometric(const BeamSums& sums);
+
+		double gPoE(const BeamSums& sums, int numBeams);
+
+		double giorgio(const BeamSums& sums);
+
+		//! giorgio gives a zero weight to particles that are outside the raster or closer than 3 cells to an obstacle
+		bool giorgioInside(float x, float y) const;
+
+		double integration(const BeamSums& sums, int numBeams);
+
+		double laplace(const BeamSums& sums);
 
 
 
@@ -92,8 +248,51 @@ class BeamEnd
 		float maxRange = 15;
 		float sigma = 8;
 		cv::Mat edt;
+		// keeps the file edt points into mapped, if it came from a bundle
+		std::shared_ptr<const MapBundle> o_bundle;
+		// the EDT in the fixed point of cv::distanceTransform, built by the first InsertObstacles or RemoveObstacles. farAway is beyond maxRange
+		static const int fixedShift = 16;
+		static const int32_t farAway = INT32_MAX;
+		std::vector<int32_t> o_fixedDist;
+		int32_t o_hvStep = 0;
+		int32_t o_diagStep = 0;
 		Weighting o_weighting;
 		float o_coeff = 1;
+		double o_logCoeff = 0;
+		double o_logPenalty = 0;
+		double o_rangeTerm = 0;
+		float o_penalty = 0;
+
+		//! Holds the per-cell term of the weighting scheme, (d / sigma)^2 or d, quantized to o_step, in its likelihood layer
+		std::shared_ptr<TiledMap> o_raster;
+		//! the part of the map the EDT covers, see GMap::Crop
+		cv::Rect o_crop;
+		static const int outside = TiledMap::outside;
+		bool o_quadratic = false;
+		float o_step = 1;
+		int o_sigmaCode = 0;
+		int o_rangeCode = 0;
+
+		// the beams of the current scan that pass the mask, in the sensor frame
+		AlignedVector<float> o_beamX;
+		AlignedVector<float> o_beamY;
+
+		int o_coarseBeams = 0;
+		float o_pruneMargin = 10;
+		int o_numPruned = 0;
+
+		int o_memoBins = 0;
+		std::unordered_map<int64_t, int> o_memo;
+		std::vector<int> o_memoIds;
+		std::vector<int> o_memoRep;
+		uint64_t o_memoHits = 0;
+		uint64_t o_memoLookups = 0;
+
+		// rotation bins of the current scan, numActive offsets per bin, only bins that some particle uses are filled
+		int o_rotationBins = 0;
+		AlignedVector<int> o_binU;
+		AlignedVector<int> o_binV;
+		std::vector<char> o_binUsed;
 
 };
 
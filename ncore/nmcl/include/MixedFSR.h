@@ -15,17 +15,40 @@
 
 #include <eigen3/Eigen/Dense>
 #include <vector>
+#include "ParticleSet.h"
+#include "Random.h"
 
 class MixedFSR 
 {
 	public:
 
+		//! A constructor
+	    /*!
+	     \param seed is the seed of the random streams used for sampling the noise
+	    */
+		MixedFSR(uint64_t seed = 0);
+
 		Eigen::Vector3f SampleMotion(const Eigen::Vector3f& p1, const std::vector<Eigen::Vector3f>& command, const std::vector<float>& weights, const Eigen::Vector3f& noise);
 
+		//! Advances every particle of the set by a noisy sample of the command, working directly on the pose arrays.
+		// The set is split into blocks of blockSize particles that run in parallel. Each block draws its noise in one batch from its own stream,
+		// so the result does not depend on the number of threads. The pose update uses the vectorized FastSinCos
+		void SampleMotion(ParticleSet& particles, const std::vector<Eigen::Vector3f>& command, const std::vector<float>& weights, const Eigen::Vector3f& noise);
+
 		Eigen::Vector3f Forward(Eigen::Vector3f p1, Eigen::Vector3f u);
 
 	    Eigen::Vector3f Backward(Eigen::Vector3f p1, Eigen::Vector3f p2);
 
+	    void SetSeed(uint64_t seed);
+
+	    //! Number of particles that share one random stream
+	    static const int blockSize = 256;
+
+
+	private:
+
+		RandomGenerator o_rng;
+		RandomStream o_stream;
 
 };
 
@@ -13,6 +13,9 @@
 #define NMCLFACTORY
 
 #include "ReNMCL.h"
+#include "BeamSelection.h"
+#include "PlaceRecognition.h"
+#include "MapBundle.h"
 #include <memory>
 
 
@@ -22,11 +25,34 @@ public:
 	
 	static std::shared_ptr<ReNMCL> Create(const std::string& configPath);
 
+	//! The beam selection of the optional beamSelection block, nullptr if the block is missing or its mode is off
+	static std::shared_ptr<BeamSelection> CreateBeamSelection(const std::string& configPath);
+
+	//! The place recognition of a floor, loaded from the bundle of the config if it is up to date and holds the text maps, otherwise built
+	// from the text maps in textMapDir
+	static std::shared_ptr<PlaceRecognition> CreatePlaceRecognition(const std::string& configPath, std::shared_ptr<FloorMap> floorMap, const std::string& textMapDir);
+
+	//! Bakes the floor map, the EDT of the sensor model, the semantic visibility table and the text map regions (of TextMaps/ next to
+	// the config, if there is one) of a config into one MapBundle.
+	// Create loads the bundle instead of recomputing them if the config names it under "bundle", relative to the config folder
+	static void Compile(const std::string& configPath, const std::string& bundlePath);
+
+	//! True if the bundle was compiled from the current state of a config: the same floor config, grid map and room segmentation (checked
+	// by their checksums, as are the text maps) and model parameters. Create ignores bundles that are out of date
+	static bool IsCompiledFrom(const MapBundle& bundle, const std::string& configPath);
+
 	static void Dump(const std::string& configPath);
 
 
 private:
 
+	//! What a bundle of the config is compiled from, the floor config, the checksums of the grid map, the room segmentation and the text maps
+	// and the parameters of the models. The SemMaps images are rendered from the objects of the floor config, so the config covers them
+	static nlohmann::json sources(const std::string& configPath);
+
+	//! The bundle the config names, nullptr if it names none or the bundle is out of date
+	static std::shared_ptr<const MapBundle> openBundle(const std::string& configPath);
+
 };
 
 
@@ -0,0 +1,81 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                                      #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                                     #
+#                                                                              #
+#  File: ParticleClusters.h          			                           	   #
+# ##############################################################################
+**/
+
+
+#ifndef PARTICLECLUSTERS_H
+#define PARTICLECLUSTERS_H
+
+#include <eigen3/Eigen/Dense>
+#include <vector>
+#include <unordered_map>
+#include "ParticleSet.h"
+#include "SetStatistics.h"
+
+
+//! A single mode of the particle set
+struct PoseMode
+{
+	//! Weighted mean and covariance of the particles in the mode
+	SetStatistics stats;
+	//! Fraction of the total weight of the set
+	double weight = 0;
+	int numParticles = 0;
+};
+
+
+//! Splits a particle set into modes in linear time. The particles are hashed into a (x, y, theta) grid, and occupied cells 
+// that touch, including diagonally and across the heading wrap-around, form one mode
+class ParticleClusters
+{
+	public:
+
+		//! A constructor
+	    /*!
+	     \param cellSize is the size of the grid cells in meters and radians. Modes closer than one cell are merged
+	    */
+		ParticleClusters(const Eigen::Vector3f& cellSize = Eigen::Vector3f(0.5, 0.5, M_PI / 6.0));
+
+		//! Clusters the set, the modes are sorted by decreasing weight
+		void Compute(const ParticleSet& particles);
+
+		//! A getter for the k strongest modes of the last Compute
+		std::vector<PoseMode> Modes(int k) const;
+
+		int NumModes() const
+		{
+			return o_modes.size();
+		}
+
+
+	private:
+
+		uint64_t key(int ix, int iy, int it) const;
+
+		struct Cell
+		{
+			int ix;
+			int iy;
+			int it;
+			int count;
+			SetStatistics stats;
+		};
+
+		Eigen::Vector3f o_cellSize;
+		int o_numHeadings = 1;
+		std::unordered_map<uint64_t, int> o_index;
+		std::vector<Cell> o_cells;
+		std::vector<int> o_labels;
+		std::vector<int> o_stack;
+		std::vector<PoseMode> o_modes;
+};
+
+
+#endif
@@ -14,16 +14,25 @@
 #define PARTICLEFILTER_H
 
 #include "Particle.h"
+#include "ParticleSet.h"
 #include "GMap.h"
 #include "SetStatistics.h"
 #include "FloorMap.h"
+#include "Random.h"
+#include "PlaceRecognition.h"
 
 class ParticleFilter
 {
 public:
 
-	ParticleFilter(std::shared_ptr<FloorMap> floorMap);
+	//! A constructor
+    /*!
+     \param floorMap is a ptr to a FloorMap object
+     \param seed is the seed of the random stream used to draw new particles
+    */
+	ParticleFilter(std::shared_ptr<FloorMap> floorMap, uint64_t seed = 0);
 
+	//! Draws the particles in rooms of a purpose drawn in proportion to roomProbabilities times the free area of the purpose
 	void InitByRoomType(std::vector<Particle>& particles, int n_particles, const std::vector<float>& roomProbabilities);
 
 	void InitUniform(std::vector<Particle>& particles, int n_particles);
@@ -40,10 +49,48 @@ public:
 
 	void AddBoundingBox(std::vector<Particle>& particles, int n_particles, const std::vector<Eigen::Vector2f>& tls, const std::vector<Eigen::Vector2f>& brs, const std::vector<float>& yaws);
 
+	//! Redraws the particles with the given ids uniformly over the free space, in place
+	/*!
+	  \param particles is the set to update
+	  \param ids are the indices of the particles to replace
+	  \param weight is assigned to every new particle
+	*/
+	void ReplaceUniform(ParticleSet& particles, const std::vector<int>& ids, double weight);
+
+	//! Redraws the particles with the given ids in rooms of a purpose drawn from roomProbabilities, in place. A purpose is drawn in proportion
+	// to its probability times its free area, as the rejection sampler did
+	void ReplaceByRoomType(ParticleSet& particles, const std::vector<int>& ids, const std::vector<float>& roomProbabilities, double weight);
+
+	//! Redraws the particles with the given ids around initGuess, in place. All of them share one box drawn from the covariance
+	void ReplaceGaussian(ParticleSet& particles, const std::vector<int>& ids, const Eigen::Vector3f& initGuess, const Eigen::Matrix3d& covariance, double weight);
+
+	//! Redraws the particles with the given ids in the free part of a text bounding box given in pixel coordinates, in place
+	/*!
+	  \param yaw is the orientation of the text, the particles are spread over a half circle around it
+	*/
+	void ReplaceBoundingBox(ParticleSet& particles, const std::vector<int>& ids, const Eigen::Vector2f& tl, const Eigen::Vector2f& br, float yaw, double weight);
+
+	//! Redraws the particles with the given ids from a precomputed text region, in place. Cells are drawn by their heatmap weight
+	/*!
+	  \param yawOffset is added to the orientation of each cell, e.g. minus the camera angle
+	*/
+	void ReplaceTextRegion(ParticleSet& particles, const std::vector<int>& ids, const TextRegion& region, float yawOffset, double weight);
+
+	//! Finds the n particles with the lowest weights by partial selection. Ties are broken by index, so the result is deterministic
+	/*!
+	   \return the indices of the weakest particles, in ascending order
+	*/
+	std::vector<int> Weakest(const ParticleSet& particles, int n) const;
+
 	SetStatistics ComputeStatistics(const std::vector<Particle>& particles);
 
 	void NormalizeWeights(std::vector<Particle>& particles);
 
+	void NormalizeWeights(ParticleSet& particles);
+
+	//! Normalizes the weights with a known sum, e.g. SetStatistics::SumWeights(), in a single pass
+	void NormalizeWeights(ParticleSet& particles, double sumWeights);
+
 	std::vector<Particle>& Particles()
 	{
 		return o_particles;
@@ -64,12 +111,20 @@ public:
 
 private:
 
+	// all sampling goes through the free space index of the floor map instead of rejection sampling in the map's bounding box.
+	// The index is fetched on every draw, so a FloorMap::UpdateFreeSpace after a map edit is picked up
+	Eigen::Vector3f sampleUniform();
+	Eigen::Vector3f sampleRoomType(const std::vector<float>& roomProbabilities);
+	void sampleGaussian(const Eigen::Vector3f& initGuess, const Eigen::Matrix3d& cov, int n, std::vector<Eigen::Vector3f>& poses);
+	void sampleBox(const Eigen::Vector3f& tl, const Eigen::Vector3f& br, int n, std::vector<Eigen::Vector3f>& poses);
+	void sampleTextBox(const Eigen::Vector2f& tl, const Eigen::Vector2f& br, float yaw, int n, std::vector<Eigen::Vector3f>& poses);
 
 
 	std::shared_ptr<FloorMap> o_floorMap;
 	std::shared_ptr<GMap> o_gmap;
 	std::vector<Particle> o_particles;
 	SetStatistics o_stats;
+	RandomStream o_stream;
 };
 
 #endif
\ No newline at end of file
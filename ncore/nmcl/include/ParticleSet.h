@@ -0,0 +1,117 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                                      #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                                     #
+#                                                                              #
+#  File: ParticleSet.h           				                           	   #
+# ##############################################################################
+**/
+
+#ifndef PARTICLESET_H
+#define PARTICLESET_H
+
+#include <vector>
+#include <eigen3/Eigen/Dense>
+#include "Particle.h"
+#include "AlignedAllocator.h"
+
+
+//! Structure-of-arrays container for the particle set. The poses and weights are kept in separate, cache-line aligned arrays,
+// so passes that only need the weights (normalization, ESS) or only the poses (motion update) stream over contiguous memory.
+// For callers that still work with Particle objects, Get/Set and the conversion to std::vector<Particle> serve as a compatibility view.
+class ParticleSet
+{
+	public:
+
+		ParticleSet(int n = 0);
+
+		ParticleSet(const std::vector<Particle>& particles);
+
+
+		int Size() const
+		{
+			return o_x.size();
+		}
+
+		void Resize(int n);
+
+		void Reserve(int n);
+
+		void Clear();
+
+		void PushBack(const Particle& p);
+
+		void Append(const ParticleSet& other);
+
+		//! Copies particle src of other into slot dst of this set
+		void Copy(int dst, const ParticleSet& other, int src)
+		{
+			o_x[dst] = other.o_x[src];
+			o_y[dst] = other.o_y[src];
+			o_theta[dst] = other.o_theta[src];
+			o_weight[dst] = other.o_weight[src];
+		}
+
+		void Swap(ParticleSet& other);
+
+
+		Particle Get(int id) const
+		{
+			return Particle(Pose(id), o_weight[id]);
+		}
+
+		void Set(int id, const Particle& p)
+		{
+			Pose(id, p.pose);
+			o_weight[id] = p.weight;
+		}
+
+		Eigen::Vector3f Pose(int id) const
+		{
+			return Eigen::Vector3f(o_x[id], o_y[id], o_theta[id]);
+		}
+
+		void Pose(int id, const Eigen::Vector3f& pose)
+		{
+			o_x[id] = pose(0);
+			o_y[id] = pose(1);
+			o_theta[id] = pose(2);
+		}
+
+
+		float* X() { return o_x.data(); }
+		float* Y() { return o_y.data(); }
+		float* Theta() { return o_theta.data(); }
+		double* Weight() { return o_weight.data(); }
+
+		const float* X() const { return o_x.data(); }
+		const float* Y() const { return o_y.data(); }
+		const float* Theta() const { return o_theta.data(); }
+		const double* Weight() const { return o_weight.data(); }
+
+
+		//! Sets all weights to w
+		void FillWeights(double w);
+
+		//! Writes the weights of the set back into a vector of Particle of the same size
+		void CopyWeights(std::vector<Particle>& particles) const;
+
+		std::vector<Particle> ToVector() const;
+
+		operator std::vector<Particle>() const
+		{
+			return ToVector();
+		}
+
+
+	private:
+
+		AlignedVector<float> o_x;
+		AlignedVector<float> o_y;
+		AlignedVector<float> o_theta;
+		AlignedVector<double> o_weight;
+};
+
+#endif
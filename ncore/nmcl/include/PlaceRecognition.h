@@ -18,39 +18,72 @@
 #include <vector>
 #include "opencv2/opencv.hpp"
 #include <eigen3/Eigen/Dense>
+#include "GMap.h"
+#include "AliasTable.h"
+#include "MapBundle.h"
+
+
+//! The free cells from which a text of one dictionary entry is visible, precomputed from its text map.
+// Each cell is drawn with probability proportional to its heatmap value, and carries its own orientation from the yaw map
+struct TextRegion
+{
+	//! Centers of the cells, in the map frame
+	std::vector<Eigen::Vector2f> positions;
+	//! Orientation of each cell in the map frame, in [-pi, pi)
+	std::vector<float> yaws;
+	//! Heatmap value of each cell, what alias draws by
+	std::vector<double> weights;
+	AliasTable alias;
+	float resolution = 0;
+
+	bool Empty() const
+	{
+		return alias.Empty();
+	}
+};
+
 
 class TextData
 {
 public:
 
-	TextData(const std::vector<Eigen::Vector2f>& tl, const std::vector<Eigen::Vector2f>& br, const std::vector<float>& orientation)
+	TextData(const std::vector<Eigen::Vector2f>& tl, const std::vector<Eigen::Vector2f>& br, const std::vector<float>& orientation, 
+		const std::vector<std::shared_ptr<const TextRegion>>& regions = std::vector<std::shared_ptr<const TextRegion>>())
 	{
 		o_tl = tl;
 		o_br = br;
 		o_orientation = orientation;
+		o_regions = regions;
 	}
 
-	std::vector<Eigen::Vector2f> TopLeft()
+	std::vector<Eigen::Vector2f> TopLeft() const
 	{
 		return o_tl;
 	}
 
-	std::vector<Eigen::Vector2f> BottomRight()
+	std::vector<Eigen::Vector2f> BottomRight() const
 	{
 		return o_br;
 	}
 
-	std::vector<float> Orientation()
+	std::vector<float> Orientation() const
 	{
 		return o_orientation;
 	}
 
+	//! The injection region of each match, a null or empty region means only the bounding box is known
+	const std::vector<std::shared_ptr<const TextRegion>>& Regions() const
+	{
+		return o_regions;
+	}
+
 
 private:
 
 	std::vector<Eigen::Vector2f> o_tl;
 	std::vector<Eigen::Vector2f> o_br;
 	std::vector<float> o_orientation;
+	std::vector<std::shared_ptr<const TextRegion>> o_regions;
 
 };
 
@@ -59,21 +92,48 @@ private:
 class PlaceRecognition
 {
 public:
-	PlaceRecognition(const std::vector<std::string>& dict, const std::string& textMapDir);
+	//! A constructor
+    /*!
+     \param dict is the list of room names, entry 0 is reserved for no match
+     \param textMapDir is the folder holding a <room name>.png text map per entry (heatmap, yaw map and text map in the B, G, R channels)
+     \param map is the occupancy map. If given, an injection region of the free cells is precomputed for each text map
+    */
+	PlaceRecognition(const std::vector<std::string>& dict, const std::string& textMapDir, std::shared_ptr<GMap> map = nullptr);
+
+	//! A constructor from the dictionary, the bounding boxes and the injection regions Save wrote to a bundle, so no text map is read.
+	// Throws std::runtime_error if the bundle has no text maps
+	PlaceRecognition(std::shared_ptr<const MapBundle> bundle);
+
+	//! Adds the dictionary, the bounding boxes and the injection regions to a bundle
+	void Save(MapBundleWriter& writer) const;
 
 	std::vector<int> Match(const std::vector<std::string>& places);
 
 	TextData TextBoundingBoxes(const std::vector<int> matches, std::vector<std::string>& confirmedMatches);
 
+	//! A getter for the injection region of a dictionary entry
+	/*!
+	   \return nullptr if the entry has no text map or no map was given
+	*/
+	std::shared_ptr<const TextRegion> Region(int id) const
+	{
+		return o_textRegions[id];
+	}
+
 private:
 
+	void setDict(const std::vector<std::string>& dict);
+
 	std::vector<std::string> divideWord(const std::string& word, const char delim = ' ');
 
+	std::shared_ptr<const TextRegion> buildRegion(const cv::Mat& heatmap, const cv::Mat& yawmap, const std::vector<cv::Point2i>& locations, std::shared_ptr<GMap> map) const;
+
 	std::vector<std::string> o_dict;
 	std::vector<std::vector<std::string>> o_extDict;
 	std::vector<cv::Mat> o_textMaps;
 	std::vector<cv::Rect> o_textBBs;
 	std::vector<float> o_textOrientations;
+	std::vector<std::shared_ptr<const TextRegion>> o_textRegions;
 
 };
 
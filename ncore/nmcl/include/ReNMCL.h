@@ -16,12 +16,14 @@
 #include "BeamEnd.h"
 #include "Resampling.h"
 #include "SetStatistics.h"
+#include "ParticleClusters.h"
 #include "FloorMap.h"
 #include "PlaceRecognition.h"
 #include <memory>
 #include "SemanticData.h"
 #include "LidarData.h"
 #include "ParticleFilter.h"
+#include "ParticleSet.h"
 #include "SemanticLikelihood.h"
 #include "SemanticVisibility.h"
 
@@ -46,9 +48,10 @@ class ReNMCL
 	      \param rs is a ptr to a Resampling object, which is an abstract class. LowVarianceResampling is the implementation 
 	      \param n_particles is an int, and it defines how many particles the particle filter will use
 	      \param injectionRatio is an float, and it determines which portions of the particles are replaced when relocalizing
+	      \param seed is the seed for drawing new particles. The motion model and resampler are seeded separately
 	    */
 		ReNMCL(std::shared_ptr<FloorMap> fm, std::shared_ptr<MixedFSR> mm, std::shared_ptr<BeamEnd> sm, 
-			std::shared_ptr<Resampling> rs, std::shared_ptr<SemanticVisibility> sem, int n_particles, float injectionRatio = 0.2);
+			std::shared_ptr<Resampling> rs, std::shared_ptr<SemanticVisibility> sem, int n_particles, float injectionRatio = 0.2, uint64_t seed = 0);
 
 
 		//! A constructor
@@ -61,33 +64,56 @@ class ReNMCL
 	      \param initGuess is a vector of initial guess for the location of the robots
 	      \param covariances is a vector of covariances (uncertainties) corresponding to the initial guesses
 	      \param injectionRatio is an float, and it determines which portions of the particles are replaced when relocalizing
+	      \param seed is the seed for drawing new particles. The motion model and resampler are seeded separately
 	    */
 		ReNMCL(std::shared_ptr<FloorMap> fm, std::shared_ptr<MixedFSR> mm, std::shared_ptr<BeamEnd> sm, 
 			std::shared_ptr<Resampling> rs, std::shared_ptr<SemanticVisibility> sem, int n_particles, std::vector<Eigen::Vector3f> initGuess, 
-			std::vector<Eigen::Matrix3d> covariances, float injectionRatio = 0.2);
+			std::vector<Eigen::Matrix3d> covariances, float injectionRatio = 0.2, uint64_t seed = 0);
 
 
-		//! A getter for the mean and covariance of the particles
+		//! A getter for the mean and covariance of the particles, as of the last correction. They are computed over the weighted set before resampling
 		/*!
 		   \return an object SetStatistics, that has fields for mean and covariance
 		*/
-		SetStatistics Stats()
+		const SetStatistics& Stats() const
 		{
 			return o_stats;
 		}
 
 
+		//! Clusters the current particle set and returns its strongest modes. Unlike Stats(), this stays meaningful while the belief 
+		// is multimodal, e.g. right after Relocalize
+		/*!
+		   \param k is the maximal number of modes
+		   \return the modes sorted by decreasing weight, each with its mean, covariance and fraction of the total weight
+		*/
+		std::vector<PoseMode> Modes(int k = 5)
+		{
+			o_clusters.Compute(o_particles);
+			return o_clusters.Modes(k);
+		}
+
+
 		//! A getter particles representing the pose hypotheses 
 		/*!
-		   \return A vector of points, where each is Eigen::Vector3f = (x, y, theta)
+		   \return The particle set. It converts implicitly to std::vector<Particle> for callers that need Particle objects
 		*/
-		std::vector<Particle> Particles()
+		const ParticleSet& Particles() const
 		{
 			return o_particles;
 		}
 
 
-		//! Advanced all particles according to the control and noise, using the chosen MotionModel's forward function
+		//! A getter for the current number of particles. With KLD-sampling enabled in the resampler it changes on every resampling step,
+		// while (re)initialization always starts from the number given at construction
+		int NumParticles() const
+		{
+			return o_particles.Size();
+		}
+
+
+		//! Advanced all particles according to the control and noise, using the chosen MotionModel's forward function.
+		// The motion update runs in parallel over particle blocks. Particles that leave the map are then replaced in index order, so runs stay reproducible
 		/*!
 		  \param control is a 3d control command. In the FSR model it's (forward, sideways, rotation)
 		  \param odomWeights is the corresponding weight to each odometry source
@@ -130,6 +156,14 @@ class ReNMCL
 		*/
 		void Relocalize(const std::vector<Eigen::Vector2f>& br, const std::vector<Eigen::Vector2f>& tl, const std::vector<float>& orientations, float camAngle);
 
+		//! Removes the fraction of weakest particles, and injects an equal number from the precomputed text regions of the matches.
+		// Matches without a region fall back to their bounding box
+		/*!
+		  \param textData holds the matches, as returned by PlaceRecognition::TextBoundingBoxes
+		  \param camAngle is a float describing the orientation of the camera from which the image was taken.
+		*/
+		void Relocalize(const TextData& textData, float camAngle);
+
 		//! Initializes filter with new particles upon localization failure
 		void Recover();
 
@@ -170,6 +204,12 @@ class ReNMCL
 		void predictGiorgio(const std::vector<Eigen::Vector3f>& control, const std::vector<float>& odomWeights, const Eigen::Vector3f& noise);
 		void predictRoom(const std::vector<Eigen::Vector3f>& u, const std::vector<float>& odomWeights, const Eigen::Vector3f& noise);
 
+		//! Computes the statistics of the weighted set, then either resamples it or normalizes its weights
+		void update();
+
+		//! Indices of the particles that left the free space, in ascending order. The map lookups run in parallel
+		std::vector<int> invalidParticles() const;
+
 
 	
 		Strategy o_predictStrategy = Strategy(0);
@@ -183,8 +223,9 @@ class ReNMCL
 		std::shared_ptr<Resampling> o_resampler; 
 		std::shared_ptr<FloorMap> o_floorMap;
 		int o_numParticles = 0;
-		std::vector<Particle> o_particles;
+		ParticleSet o_particles;
 		SetStatistics o_stats;
+		ParticleClusters o_clusters;
 		float o_injectionRatio = 0.5;
 		std::vector<float> o_roomProbabilities;
 };
@@ -17,11 +17,34 @@
 #include <vector>
 #include <eigen3/Eigen/Dense>
 #include "Particle.h"
+#include "ParticleSet.h"
+#include "Random.h"
+#include "SetStatistics.h"
 
 class Resampling
 {
 	public:	
 
+		enum class Algorithm 
+		{   
+			SYSTEMATIC = 0, 
+		    STRATIFIED = 1, 
+		    RESIDUAL = 2
+		};
+
+		//! Resamples the set if its effective sample size drops below the threshold. The new set is written into an internal buffer 
+		// that is then swapped with particles, so no memory is allocated once the buffers have grown to the set size.
+		// The cumulative weights are computed with a blocked parallel scan, and the output is split into blocks that find their 
+		// first source particle by binary search. The result does not depend on the number of threads
+		void Resample(ParticleSet& particles);
+
+		//! Same as Resample, but takes the effective sample size and weight sum from statistics computed over the set, 
+		// e.g. by SetStatistics::ComputeParticleSetStatistics, instead of sweeping over the weights again
+		/*!
+		   \return true if the set was resampled, its weights are then uniform. Otherwise the weights are left untouched
+		*/
+		bool Resample(ParticleSet& particles, const SetStatistics& stats);
+
 		void Resample(std::vector<Particle>& particles);
 
 		void SetTH(float th)
@@ -29,10 +52,71 @@ class Resampling
 			o_th = th;
 		}
 
+		void SetAlgorithm(Algorithm algorithm)
+		{
+			o_algorithm = algorithm;
+		}
+
+		void SetSeed(uint64_t seed)
+		{
+			o_rng = RandomGenerator(seed, RandomDomain::RESAMPLING);
+		}
+
+		//! Enables KLD-sampling. Each resampling step then draws as many particles as needed to bound the KL divergence between the 
+		// sample-based and the true posterior by epsilon, with probability given by z. Without it the set keeps its size
+		/*!
+		  \param minParticles is the lower bound on the set size
+		  \param maxParticles is the upper bound on the set size
+		  \param epsilon is the bound on the KL divergence
+		  \param z is the upper standard normal quantile of the confidence, e.g. 2.33 for 0.99
+		  \param binSize is the size of the (x, y, theta) histogram bins, in meters and radians
+		*/
+		void SetKLD(int minParticles, int maxParticles, float epsilon, float z, const Eigen::Vector3f& binSize);
+
+		bool KLD() const
+		{
+			return o_kld;
+		}
+
+
+		static const int blockSize = 4096;
+
 
 	private:
 
+		void resample(ParticleSet& particles);
+
+		//! Writes the inclusive prefix sum of values into o_cumsum and returns the total
+		double prefixSum(const double* values, int n);
+
+		//! Draws n_new particles into o_buffer[offset, offset + n_new) from the cumulative weights in o_cumsum
+		void systematic(const ParticleSet& particles, int offset, int n_new, double u);
+		void stratified(const ParticleSet& particles, int n_new);
+		void residual(const ParticleSet& particles, int n_new, double u);
+
+		//! The number of particles KLD-sampling needs for a posterior that occupies k bins
+		int kldBound(int k) const;
+
+		//! Runs the systematic comb with maxParticles teeth over o_cumsum and counts the histogram bins it hits
+		int kldSize(const ParticleSet& particles, double u);
+
 		float o_th = 0.5;
+		Algorithm o_algorithm = Algorithm::SYSTEMATIC;
+
+		ParticleSet o_buffer;
+		std::vector<double> o_cumsum;
+		std::vector<double> o_blockSums;
+		std::vector<double> o_residuals;
+		std::vector<int> o_counts;
+
+		bool o_kld = false;
+		int o_minParticles = 0;
+		int o_maxParticles = 0;
+		float o_epsilon = 0.05;
+		float o_z = 2.33;
+		Eigen::Vector3f o_binSize = Eigen::Vector3f(0.5, 0.5, 10.0 * M_PI / 180.0);
+		std::vector<uint64_t> o_bins;
+		RandomGenerator o_rng = RandomGenerator(0, RandomDomain::RESAMPLING);
 
 };
 
@@ -15,12 +15,16 @@
 
 #include <memory>
 #include <string>
+#include <vector>
+#include <cstdint>
 #include <Particle.h>
 #include "GMap.h"
 #include "FloorMap.h"
 #include "SemanticData.h"
 
 
+//! An endpoint model for semantic detections. Each detection is scored by the distance from its end point to the closest object of its class
+// in the same room, unless a wall lies between the particle and the end point.
 class SemanticLikelihood
 {
 	public:
@@ -30,26 +34,40 @@ class SemanticLikelihood
 		//! A constructor
 	    /*!
 	      \param FloorMap is a ptr to a FloorMap object, which holds the floor map
+	      \param semMapDir is the folder with the class maps, <class>.png for every class of FloorMap::Classes()
 	      \param sigma is a float that determine how forgiving the model is (small sigma will give a very peaked likelihood)
-	      \param maxRange is a float specifying up to what distance from the sensor a reading is valid
+	      \param maxRange is a float specifying up to what distance in pixels from an object an end point is informative, the distance fields are truncated there
+	      \param occlusionBins is the number of directions of the occlusion table
+	      \param detectionRange is the farthest distance in pixels a detection is trusted at, farther detections count as occluded. It bounds the
+	      rays of the occlusion table, which is built at every start
 	    */
 
-		SemanticLikelihood(std::shared_ptr<FloorMap> floorMap, const std::string& semMapDir, float sigma = 8, float maxRange = 15);
+		SemanticLikelihood(std::shared_ptr<FloorMap> floorMap, const std::string& semMapDir, float sigma = 8, float maxRange = 15, int occlusionBins = 64, int detectionRange = 200);
 
 
 			//! Computes weights for all particles based on how well the observation matches the map
 		/*!
 		  \param particles is a vector of Particle elements
-		  \param SensorData is an abstract container for sensor data. This function expects LidarData type
+		  \param SensorData is an abstract container for sensor data. This function expects SemanticData type. All detections are scored,
+		  the weight is the product of their likelihoods
 		*/
 
 		void ComputeWeights(std::vector<Particle>& particles, std::shared_ptr<SemanticData> data);
 
+		//! The truncated distance in pixels from map pixel (u, v) to the closest object of class label in the same room, quantized. maxRange outside the map
+		float Distance(int label, int u, int v) const;
+
+		//! True if a wall lies between map pixels pUV and sUV, up to the angular resolution of the occlusion table, or sUV is beyond the detection range
+		bool IsOccluded(const Eigen::Vector2f& pUV, const Eigen::Vector2f& sUV) const;
+
 	private:
 
 		float getLikelihood(float distance);
-		bool isOccluded(Eigen::Vector3f pose, Eigen::Vector2f sUV);
 		void createEDT(float maxRange, const std::string& semMapDir);
+		void createOcclusion();
+
+		//! The index of pixel (u, v) in a plane of o_distances, -1 outside the cropped region
+		int cellID(int u, int v) const;
 
 
 		Eigen::Vector2f scan2Map(Eigen::Vector3f pose, Eigen::Vector3f scan);
@@ -60,7 +78,18 @@ class SemanticLikelihood
 		float o_maxRange = 15;
 		float o_sigma = 8;
 		float o_coeff = 1;
-		std::vector<cv::Mat> o_distMaps;
+		// the region the tables cover, the known part of the map
+		cv::Rect o_crop;
+		int o_numClasses = 0;
+		// one truncated distance field per class, quantized to 255 steps of o_maxRange, one plane per class over o_crop
+		std::vector<uint8_t> o_distances;
+		// log likelihood of each quantized distance
+		std::vector<float> o_logLikelihood;
+		// for each free cell (o_freeID) and direction, the distance in pixels to the first cell that isn't free, at most o_detectionRange
+		int o_occlusionBins = 64;
+		int o_detectionRange = 200;
+		std::vector<int> o_freeID;
+		std::vector<uint16_t> o_freeRange;
 
 
 };
@@ -69,4 +98,4 @@ class SemanticLikelihood
 
 
 
-#endif
\ No newline at end of file
+#endif
@@ -18,10 +18,15 @@
 #include <vector>
 #include <eigen3/Eigen/Dense>
 #include <Particle.h>
+#include "ParticleSet.h"
 #include <map>
+#include <cstdint>
+#include <mutex>
+#include <memory>
 
 #include "SemanticData.h"
 #include "GMap.h"
+#include "MapBundle.h"
 
 
 class SemanticVisibility
@@ -35,6 +40,13 @@ class SemanticVisibility
 
 		SemanticVisibility(std::shared_ptr<GMap> Gmap, int beams, const std::string& semMapDir, const std::vector<std::string>& classes, const std::vector<float>& confidences);
 
+		//! A constructor that takes the visibility table from a compiled bundle instead of tracing it, see NMCLFactory::Compile. The table stays in the mapped file.
+		// Throws std::runtime_error if the bundle was compiled for another map, number of beams or classes
+		SemanticVisibility(std::shared_ptr<GMap> Gmap, std::shared_ptr<const MapBundle> bundle, int beams, const std::vector<std::string>& classes, const std::vector<float>& confidences);
+
+		//! Adds the visibility table and the rasters UpdateClass needs to a bundle
+		void Save(MapBundleWriter& writer, const std::vector<std::string>& classes) const;
+
 		//! Computes weights for all particles based on how well the observation matches the map
 		/*!
 		  \param particles is a vector of Particle elements
@@ -43,8 +55,21 @@ class SemanticVisibility
 		// the data is already in base_link coordiantes
 		void ComputeWeights(std::vector<Particle>& particles, std::shared_ptr<SemanticData> data);
 
+		void ComputeWeights(ParticleSet& particles, std::shared_ptr<SemanticData> data);
+
 		void UpdateConsistency(const Particle& particle, std::shared_ptr<SemanticData> data);
 
+		//! Updates the visibility of one class after objects of it were added, removed or moved, e.g. by FloorMap::MoveObject.
+		// Only the directions whose rays can reach the footprint are traced again. The new map is built on the side and swapped in,
+		// so ComputeWeights can keep running on the previous one meanwhile
+		/*!
+		  \param label is the class that changed
+		  \param classMap is the new map of the class (CV_8UC1, non-zero where the class is), see FloorMap::SemMap
+		  \param footprint is the bounding box in pixels of all the pixels of classMap that changed
+		  \return the number of cells whose visibility was traced again
+		*/
+		int UpdateClass(int label, const cv::Mat& classMap, const cv::Rect& footprint);
+
 
 		const std::vector<Eigen::Vector2f>& ClassConsistency() const
 		{
@@ -54,12 +79,65 @@ class SemanticVisibility
 
 	private:
 
-		int cellID(int x, int y);
-		bool isTraced(const cv::Mat& currMap, Eigen::Vector2f pose, Eigen::Vector2f bearing);
+		//! The index of pixel (x, y) in o_visibilityMap, -1 outside the cropped region
+		int cellID(int x, int y) const;
 
-		std::vector<std::map<int, std::vector<Eigen::Vector2f>>> o_visibilityMap;
+		// the visibility map in CSR form: per cell a bitmask of the visible classes, and for each of them, in class order,
+		// a bitmask over the traced directions. offsets[c] is where the masks of cell c start in visibility.
+		// The arrays point either into the owned vectors or into a mapped bundle
+		struct VisibilityMap
+		{
+			const uint32_t* classMask = nullptr;
+			const uint32_t* offsets = nullptr;
+			const uint64_t* visibility = nullptr;
+			std::vector<uint32_t> classMaskData;
+			std::vector<uint32_t> offsetsData;
+			std::vector<uint64_t> visibilityData;
+			std::shared_ptr<const MapBundle> bundle;
+		};
+
+		//! The beams from which class label is visible at cell cID, o_words words of bits, nullptr if it isn't visible at all. Points into vis
+		const uint64_t* visibleBeams(const VisibilityMap& vis, int cID, int label) const;
+
+		//! The directions of the traced rays, and the part of the map they cover
+		void setup(int beams);
+
+		//! Fills the offsets and the masks of vis from the per-row masks, vis.classMaskData has to be set
+		void pack(VisibilityMap& vis, const std::vector<std::vector<uint64_t>>& rowMasks) const;
+
+		//! Same as GMap::IsValid2D for a pixel, from the flattened validity raster
+		bool isValid(int x, int y) const;
+
+		//! The classes whose maps the ray from (x, y) along bearing reads before it leaves the free space
+		uint32_t traceClasses(float x, float y, const Eigen::Vector2f& bearing) const;
+
+		//! True if the ray from (x, y) along bearing passes through box (min x, min y, max x, max y)
+		bool reaches(float x, float y, const Eigen::Vector2f& bearing, const Eigen::Vector4f& box) const;
+
+		//! The largest dot product between bearing and the directions of the set bits of visible, visible must have at least one bit set
+		float maxScore(const uint64_t* visible, const Eigen::Vector2f& bearing) const;
+
+		//! The index of the unit circle direction closest to bearing
+		int bearingBin(const Eigen::Vector2f& bearing) const;
+
+		//! The first set bit of visible at or after k, and at or before k, going around the circle
+		int nextBeam(const uint64_t* visible, int k) const;
+		int prevBeam(const uint64_t* visible, int k) const;
+
+		// read with std::atomic_load and replaced with std::atomic_store by UpdateClass
+		std::shared_ptr<const VisibilityMap> o_visibilityMap;
+		// validity and class bits per pixel of o_region, what the rays read
+		cv::Rect o_region;
+		std::vector<uint8_t> o_valid;
+		std::vector<uint32_t> o_classBits;
+		Eigen::Vector2f o_br;
+		std::mutex o_updateMutex;
+		std::vector<Eigen::Vector2f> o_unitCircle;
+		int o_beams = 0;
+		int o_words = 1;
 		std::shared_ptr<GMap> o_gmap;
 		cv::Size o_mapSize;
+		cv::Rect o_crop;
 		std::vector<float> o_confidenceTH;
 		std::vector<Eigen::Vector2f> o_classConsistency;
 		std::vector<cv::Mat> o_classMaps;
@@ -16,7 +16,11 @@
 #include <eigen3/Eigen/Dense>
 #include <vector>
 #include "Particle.h"
+#include "ParticleSet.h"
 
+//! Weighted mean and covariance of a particle set, together with the weight sum and the effective sample size.
+// ComputeParticleSetStatistics gathers all raw moments in one parallel sweep over the set, the mean and covariance are derived
+// from them on the first query and cached. The weights don't need to be normalized
 class SetStatistics
 {
 	public:
@@ -25,24 +29,67 @@ class SetStatistics
 		{
 			mean = m;
 			cov = c;
+			ready = true;
 		}
 
-		Eigen::Vector3d Mean()
+		Eigen::Vector3d Mean() const
 		{
+			finalize();
 			return mean;
 		}
 
-		Eigen::Matrix3d Cov()
+		Eigen::Matrix3d Cov() const
 		{
+			finalize();
 			return cov;
 		}
 
+		double SumWeights() const
+		{
+			return moments.w;
+		}
+
+		//! Effective sample size (sum w)^2 / sum w^2, 0 for statistics that were not computed from a set
+		double ESS() const
+		{
+			if (moments.ww <= 0) return 0;
+			return moments.w * moments.w / moments.ww;
+		}
+
+		//! Adds a single weighted pose to the moments, e.g. to accumulate statistics of a subset
+		void Add(const Eigen::Vector3f& pose, double weight);
+
+		//! Adds the moments of other, the result describes the union of both sets
+		void Add(const SetStatistics& other);
+
 		static SetStatistics ComputeParticleSetStatistics(const std::vector<Particle>& particles);
 
+		static SetStatistics ComputeParticleSetStatistics(const ParticleSet& particles);
+
+		static const int blockSize = 4096;
+
 	private:
 
-		Eigen::Vector3d mean;
-		Eigen::Matrix3d cov;
+		//! Weighted sums over the set, e.g. x holds sum w * x
+		struct Moments
+		{
+			double w = 0;
+			double ww = 0;
+			double x = 0;
+			double y = 0;
+			double c = 0;
+			double s = 0;
+			double xx = 0;
+			double xy = 0;
+			double yy = 0;
+		};
+
+		void finalize() const;
+
+		Moments moments;
+		mutable bool ready = false;
+		mutable Eigen::Vector3d mean;
+		mutable Eigen::Matrix3d cov;
 	
 };
 
@@ -11,11 +11,16 @@
 
 #include "BeamEnd.h"
 #include "Utils.h"
+#include "FastMath.h"
 
 #include <math.h>
 #include <stdlib.h>
 #include <iostream>
 #include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <queue>
+#include <nlohmann/json.hpp>
 
 BeamEnd::BeamEnd(std::shared_ptr<GMap> Gmap_, float sigma_, float maxRange_, Weighting weighting )
 {
@@ -23,318 +28,803 @@ BeamEnd::BeamEnd(std::shared_ptr<GMap> Gmap_, float sigma_, float maxRange_, Wei
 	maxRange = maxRange_;
 	sigma = sigma_;   //value of 8 for map resolution 0.05, 40 for 0.01
 	o_weighting = weighting;
-	cv::threshold(Gmap->Map(), edt, 127, 255, 0);
+	// the EDT only covers the known part of the map plus its truncation distance, beyond that it would be maxRange everywhere
+	o_crop = Gmap->Crop(RasterMargin());
+	cv::threshold(Gmap->Map()(o_crop), edt, 127, 255, 0);
 	edt = 255 - edt;
 	cv::distanceTransform(edt, edt, cv::DIST_L2, cv::DIST_MASK_3);
 	cv::threshold(edt, edt, maxRange, maxRange, 2); //Threshold Truncated
+
+	setup();
+}
+
+BeamEnd::BeamEnd(std::shared_ptr<GMap> Gmap_, std::shared_ptr<const MapBundle> bundle, float sigma_, float maxRange_, Weighting weighting)
+{
+	Gmap = Gmap_;
+	maxRange = maxRange_;
+	sigma = sigma_;
+	o_weighting = weighting;
+	o_crop = Gmap->Crop(RasterMargin());
+
+	// the EDT only depends on the map and its truncation, sigma and the scheme only enter the table
+	nlohmann::json info = nlohmann::json::parse(bundle->Text("beamEnd/info"));
+	std::vector<int> crop = info["crop"];
+	if ((float(info["maxRange"]) != maxRange) || (cv::Rect(crop[0], crop[1], crop[2], crop[3]) != o_crop))
+	{
+		throw std::runtime_error("BeamEnd| the bundle " + bundle->Path() + " was compiled for another map or maxRange");
+	}
+	// points into the mapped file, so all processes share it
+	o_bundle = bundle;
+	edt = bundle->Image("beamEnd/edt", o_crop.height, o_crop.width, CV_32FC1);
+
+	setup();
+}
+
+void BeamEnd::Save(MapBundleWriter& writer) const
+{
+	nlohmann::json info;
+	info["maxRange"] = maxRange;
+	info["crop"] = {o_crop.x, o_crop.y, o_crop.width, o_crop.height};
+
+	writer.Add("beamEnd/info", info.dump());
+	writer.Add("beamEnd/edt", edt);
+}
+
+void BeamEnd::setup()
+{
 	o_coeff = 1.0 / sqrt(2 * M_PI * sigma);
+
+	// constants of the schemes that only depend on sigma and maxRange
+	o_logCoeff = log(o_coeff);
+	o_rangeTerm = pow(maxRange / sigma, 2.0);
+	o_logPenalty = o_logCoeff - 0.5 * o_rangeTerm;
+	o_penalty = getLikelihood(maxRange);
+
+	o_raster = std::make_shared<TiledMap>(TiledMap(Gmap, RasterMargin()));
+	buildTable();
 }
 
-void BeamEnd::ComputeWeights(std::vector<Particle>& particles, std::shared_ptr<LidarData> data)
+void BeamEnd::buildTable()
 {
-	const std::vector<Eigen::Vector3f>& scan = data->Scan();
-	const std::vector<double>& scanMask = data->Mask();
+	// the schemes built on the Gaussian likelihood sum (d / sigma)^2, the others sum d
+	o_quadratic = (o_weighting == Weighting::NAIVE) || (o_weighting == Weighting::GEOMETRIC) || (o_weighting == Weighting::GPOE);
 
-	double acc_w = 0;
+	float maxTerm = o_quadratic ? pow(maxRange / sigma, 2.0) : maxRange;
+	o_step = maxTerm / (outside - 1);
 
-	#pragma omp parallel for 
-	for(long unsigned int i = 0; i < particles.size(); ++i)
+	// the distance thresholds of the schemes, in table units
+	if (o_quadratic) o_sigmaCode = ceil(1.0 / o_step);
+	else o_sigmaCode = ceil(sigma / o_step);
+	o_rangeCode = outside - 1;
+
+	int rows = edt.rows;
+	int cols = edt.cols;
+	std::vector<uint16_t> table(rows * cols);
+
+	#pragma omp parallel for
+	for(int v = 0; v < rows; ++v)
 	{
-		//auto t1 = std::chrono::high_resolution_clock::now();	
-		double w = 0;
-		switch(o_weighting) 
+		const float* row = edt.ptr<float>(v);
+		for(int u = 0; u < cols; ++u)
 		{
-		    case Weighting::NAIVE : 
-		    	w = naive(particles[i].pose, scan, scanMask);
-		    	break;
-		    case Weighting::INTEGRATION : 
-		    	w = integration(particles[i].pose, scan, scanMask);
-		    	break;
-		    case Weighting::LAPLACE : 
-		    	w = laplace(particles[i].pose, scan, scanMask);
-		    	break;
-		    case Weighting::GEOMETRIC : 
-		    	w = geometric(particles[i].pose, scan, scanMask);
-		    	break;
-		    case Weighting::GPOE : 
-		    	w = gPoE(particles[i].pose, scan, scanMask);
-		    	break;
-		    case Weighting::GIORGIO : 
-		    	w = giorgio(particles[i].pose, scan, scanMask);
-		    	break;
+			table[v * cols + u] = code(row[u]);
 		}
-		particles[i].weight = w;
-		acc_w += w;
+	}
 
-		//auto t2 = std::chrono::high_resolution_clock::now();
-   		//auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1);
-   		//std::cout << "BeamEnd::Timing of compute : " << ns.count() << std::endl;
+	// giorgio accepts the whole raster, the others stop at the bottom right corner of the occupied area
+	Eigen::Vector2f br = Gmap->BottomRight();
+	int maxU = br(0);
+	int maxV = br(1);
+	if (o_weighting == Weighting::GIORGIO)
+	{
+		maxU = Gmap->Map().cols - 1;
+		maxV = Gmap->Map().rows - 1;
 	}
+	o_raster->SetLikelihood(table.data(), o_crop, maxU, maxV);
+}
+
+uint16_t BeamEnd::code(float distance) const
+{
+	float d = std::min(std::abs(distance), maxRange);
+	float term = o_quadratic ? (d / sigma) * (d / sigma) : d;
 
-	//std::cout << acc_w/particles.size() << std::endl;
+	return std::min(int(term / o_step + 0.5f), outside - 1);
 }
 
-double BeamEnd::giorgio(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask)
-{ 
+void BeamEnd::initDynamic()
+{
+	// an EDT from a bundle lives in a read-only mapping
+	if (o_bundle)
+	{
+		edt = edt.clone();
+		o_bundle = nullptr;
+	}
 
-	int rows = edt.rows;
-	int cols = edt.cols;
-	float radius = 3;
+	// cv::distanceTransform with DIST_MASK_3 adds up these 16 bit fixed point steps and scales the sum to float, which is exact as long as
+	// maxRange is below 256 pixels, so the sums can be recovered. Distances that reach maxRange were truncated and are only known to be beyond it
+	o_hvStep = cvRound(0.955f * (1 << fixedShift));
+	o_diagStep = cvRound(1.3693f * (1 << fixedShift));
+	o_fixedDist = std::vector<int32_t>(edt.rows * edt.cols);
+	#pragma omp parallel for
+	for(int v = 0; v < edt.rows; ++v)
+	{
+		const float* row = edt.ptr<float>(v);
+		for(int u = 0; u < edt.cols; ++u)
+		{
+			o_fixedDist[v * edt.cols + u] = (row[u] < maxRange) ? int32_t(lround(row[u] * (1 << fixedShift))) : farAway;
+		}
+	}
+}
 
-	Eigen::Vector2f pose2d = Gmap->World2Map(Eigen::Vector2f(particle(0), particle(1)));
-	if((pose2d(0) < 0) || (pose2d(0) > cols - 1)) return 0;
-	if((pose2d(1) < 0) || (pose2d(1) > rows - 1)) return 0;
-	float d = std::abs(edt.at<float>(pose2d(1), pose2d(0)));
-	if (d < radius) return 0;
+void BeamEnd::InsertObstacles(const std::vector<Eigen::Vector2i>& cells)
+{
+	if (o_fixedDist.empty()) initDynamic();
 
+	std::vector<int> changed;
+	std::vector<std::pair<int32_t, int>> lower;
+	for(const Eigen::Vector2i& cell : cells)
+	{
+		int u = cell(0) - o_crop.x;
+		int v = cell(1) - o_crop.y;
+		if ((u < 0) || (v < 0) || (u >= edt.cols) || (v >= edt.rows)) continue;
+
+		int id = v * edt.cols + u;
+		if (o_fixedDist[id] == 0) continue;
+		o_fixedDist[id] = 0;
+		changed.push_back(id);
+		lower.push_back(std::make_pair(0, id));
+	}
 
-	std::vector<Eigen::Vector2f> mapPoints = scan2Map(particle, scan);
+	propagate(lower, changed);
+	applyChanges(changed);
+}
 
-	double cummulative_distance = 0.0;
-	int valid = 0;
-	double min_weight = 0.001;
+void BeamEnd::RemoveObstacles(const std::vector<Eigen::Vector2i>& cells)
+{
+	if (o_fixedDist.empty()) initDynamic();
 
-	Eigen::Vector2f br = Gmap->BottomRight();
+	const int du[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+	const int dv[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+	int cols = edt.cols;
+	int rows = edt.rows;
 
-	for (long unsigned int i = 0; i < mapPoints.size(); ++i)
+	// raise: every cell whose distance may have come through a removed obstacle is reset. A cell depends on a reset neighbour
+	// if its distance is exactly one step more than the neighbour's old distance
+	std::vector<int> changed;
+	std::vector<std::pair<int32_t, int>> raise;
+	for(const Eigen::Vector2i& cell : cells)
 	{
-		Eigen::Vector2f mp = mapPoints[i];
-
-		if((mp(0) < 0) || (mp(0) > cols - 1)) continue;
-		if((mp(1) < 0) || (mp(1) > rows - 1)) continue;
+		int u = cell(0) - o_crop.x;
+		int v = cell(1) - o_crop.y;
+		if ((u < 0) || (v < 0) || (u >= cols) || (v >= rows)) continue;
+
+		int id = v * cols + u;
+		if (o_fixedDist[id] != 0) continue;
+		o_fixedDist[id] = farAway;
+		changed.push_back(id);
+		raise.push_back(std::make_pair(0, id));
+	}
 
-		float dist = std::abs(edt.at<float>(mp(1), mp(0)));
-		if(dist!=dist){
-			throw std::runtime_error("BeamEnd::giorgio| nan detected");
+	for(size_t i = 0; i < raise.size(); ++i)
+	{
+		int32_t old = raise[i].first;
+		int id = raise[i].second;
+		int u = id % cols;
+		int v = id / cols;
+		for(int k = 0; k < 8; ++k)
+		{
+			int nu = u + du[k];
+			int nv = v + dv[k];
+			if ((nu < 0) || (nv < 0) || (nu >= cols) || (nv >= rows)) continue;
+
+			int nid = nv * cols + nu;
+			int32_t d = o_fixedDist[nid];
+			int32_t step = (du[k] && dv[k]) ? o_diagStep : o_hvStep;
+			if ((d == 0) || (d == farAway) || (d != old + step)) continue;
+
+			o_fixedDist[nid] = farAway;
+			changed.push_back(nid);
+			raise.push_back(std::make_pair(d, nid));
 		}
+	}
 
-		if (dist >= maxRange)
+	// lower: the reset cells are filled again from the cells around them that kept their distance
+	std::vector<std::pair<int32_t, int>> lower;
+	for(const auto& r : raise)
+	{
+		int u = r.second % cols;
+		int v = r.second / cols;
+		for(int k = 0; k < 8; ++k)
 		{
-			 continue;
+			int nu = u + du[k];
+			int nv = v + dv[k];
+			if ((nu < 0) || (nv < 0) || (nu >= cols) || (nv >= rows)) continue;
+
+			int nid = nv * cols + nu;
+			if (o_fixedDist[nid] != farAway) lower.push_back(std::make_pair(o_fixedDist[nid], nid));
 		}
-		cummulative_distance += dist;
-		++valid;
 	}
 
-	if (valid < 30)
+	propagate(lower, changed);
+	applyChanges(changed);
+}
+
+void BeamEnd::propagate(std::vector<std::pair<int32_t, int>>& seeds, std::vector<int>& changed)
+{
+	const int du[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+	const int dv[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+	int cols = edt.cols;
+	int rows = edt.rows;
+
+	// a brushfire from the seeds, it stops where the distance reaches maxRange, so it stays within maxRange of the edit
+	std::priority_queue<std::pair<int32_t, int>, std::vector<std::pair<int32_t, int>>, std::greater<std::pair<int32_t, int>>> queue(seeds.begin(), seeds.end());
+	while (!queue.empty())
 	{
-		return min_weight;
+		int32_t d = queue.top().first;
+		int id = queue.top().second;
+		queue.pop();
+		if (d != o_fixedDist[id]) continue;
+
+		int u = id % cols;
+		int v = id / cols;
+		for(int k = 0; k < 8; ++k)
+		{
+			int nu = u + du[k];
+			int nv = v + dv[k];
+			if ((nu < 0) || (nv < 0) || (nu >= cols) || (nv >= rows)) continue;
+
+			int nid = nv * cols + nu;
+			int32_t nd = d + ((du[k] && dv[k]) ? o_diagStep : o_hvStep);
+			if ((nd >= o_fixedDist[nid]) || (float(nd) * (1.0f / (1 << fixedShift)) >= maxRange)) continue;
+
+			o_fixedDist[nid] = nd;
+			changed.push_back(nid);
+			queue.push(std::make_pair(nd, nid));
+		}
 	}
+}
 
-	double log_likelihood =  0.05 * sigma * (cummulative_distance / (double)valid);
-	double w = exp(-log_likelihood) + min_weight;
+void BeamEnd::applyChanges(const std::vector<int>& changed)
+{
+	Eigen::Vector2f br = Gmap->BottomRight();
+	int maxU = br(0);
+	int maxV = br(1);
+	if (o_weighting == Weighting::GIORGIO)
+	{
+		maxU = Gmap->Map().cols - 1;
+		maxV = Gmap->Map().rows - 1;
+	}
 
-	return w;
+	for(int id : changed)
+	{
+		int u = id % edt.cols;
+		int v = id / edt.cols;
+		int32_t d = o_fixedDist[id];
+		float dist = (d == farAway) ? maxRange : float(d) * (1.0f / (1 << fixedShift));
+		edt.at<float>(v, u) = dist;
+
+		int mu = u + o_crop.x;
+		int mv = v + o_crop.y;
+		if ((mu <= maxU) && (mv <= maxV)) o_raster->SetLikelihood(mu, mv, code(dist));
+	}
 }
 
-double BeamEnd::naive(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask)
+int BeamEnd::RasterMargin() const
 {
-	std::vector<Eigen::Vector2f> mapPoints = scan2Map(particle, scan);
-	//plotScan(particle, mapPoints);
+	return ceil(maxRange) + 1;
+}
 
-	Eigen::Vector2f br = Gmap->BottomRight();
+void BeamEnd::SetRaster(std::shared_ptr<TiledMap> raster)
+{
+	o_raster = raster;
+	buildTable();
+}
 
-	double weight = 1.0;
-	int nonValid = 0;
+void BeamEnd::ComputeWeights(ParticleSet& particles, std::shared_ptr<LidarData> data)
+{
+	const std::vector<Eigen::Vector3f>& scan = data->Scan();
+	const std::vector<double>& scanMask = data->Mask();
+	int numBeams = scan.size();
 
-	for(long unsigned int i = 0; i < mapPoints.size(); ++i)
+	// giorgio ignores the mask, all others only look at the beams that pass it
+	o_beamX.clear();
+	o_beamY.clear();
+	for(int b = 0; b < numBeams; ++b)
 	{
-		Eigen::Vector2f mp = mapPoints[i];
+		if ((o_weighting == Weighting::GIORGIO) || (scanMask[b] > 0.0))
+		{
+			o_beamX.push_back(scan[b](0));
+			o_beamY.push_back(scan[b](1));
+		}
+	}
+	int numActive = o_beamX.size();
 
-		if(scanMask[i] > 0.0)
+	// the coarse pass looks at every stride-th beam, which are moved to the front so that both passes read a prefix of the arrays
+	int numCoarse = 0;
+	if ((o_coarseBeams > 0) && (o_coarseBeams < numActive))
+	{
+		int stride = numActive / o_coarseBeams;
+		AlignedVector<float> bx, by;
+		for(int b = 0; b < numActive; b += stride)
 		{
-			if ((mp(0) < 0) || (mp(1) < 0) || (mp(0) > br(0)) || (mp(1) > br(1)))
-			{
-					++nonValid;
-			}
-			else
-			{
-				float dist = edt.at<float>(mp(1) ,mp(0));
-				double w = getLikelihood(dist);
-				weight *= w;
-			}
+			bx.push_back(o_beamX[b]);
+			by.push_back(o_beamY[b]);
 		}
+		numCoarse = bx.size();
+		for(int b = 0; b < numActive; ++b)
+		{
+			if (b % stride == 0) continue;
+			bx.push_back(o_beamX[b]);
+			by.push_back(o_beamY[b]);
+		}
+		o_beamX.swap(bx);
+		o_beamY.swap(by);
 	}
-	//std::cout << nonValid << std::endl;
 
-	float penalty = pow(getLikelihood(maxRange), nonValid);
-	weight *= penalty;
+	if (o_rotationBins)
+	{
+		rotateBins(particles.Theta(), particles.Size(), numActive);
+	}
 
-	return weight;
+	// with memoization only one particle per (cell, heading bin) is scored
+	const int* ids = nullptr;
+	int numScored = particles.Size();
+	if (o_memoBins)
+	{
+		memoize(particles);
+		ids = o_memoIds.data();
+		numScored = o_memoIds.size();
+	}
+
+	// the scheme is picked once per scan, each kernel is compiled with its own reductions and constants
+	switch(o_weighting) 
+	{
+	    case Weighting::NAIVE : 
+	    	weighParticles<Weighting::NAIVE>(particles, ids, numScored, numActive, numCoarse, numBeams);
+	    	break;
+	    case Weighting::INTEGRATION : 
+	    	weighParticles<Weighting::INTEGRATION>(particles, ids, numScored, numActive, numCoarse, numBeams);
+	    	break;
+	    case Weighting::LAPLACE : 
+	    	weighParticles<Weighting::LAPLACE>(particles, ids, numScored, numActive, numCoarse, numBeams);
+	    	break;
+	    case Weighting::GEOMETRIC : 
+	    	weighParticles<Weighting::GEOMETRIC>(particles, ids, numScored, numActive, numCoarse, numBeams);
+	    	break;
+	    case Weighting::GPOE : 
+	    	weighParticles<Weighting::GPOE>(particles, ids, numScored, numActive, numCoarse, numBeams);
+	    	break;
+	    case Weighting::GIORGIO : 
+	    	weighParticles<Weighting::GIORGIO>(particles, ids, numScored, numActive, numCoarse, numBeams);
+	    	break;
+	}
+
+	if (o_memoBins)
+	{
+		double* weights = particles.Weight();
+		const int* rep = o_memoRep.data();
+		int n = particles.Size();
+
+		// representatives are their own rep, so they are only read and the copies only written
+		#pragma omp parallel for
+		for(int i = 0; i < n; ++i)
+		{
+			if (rep[i] != i) weights[i] = weights[rep[i]];
+		}
+	}
 }
 
+void BeamEnd::memoize(const ParticleSet& particles)
+{
+	const float* px = particles.X();
+	const float* py = particles.Y();
+	const float* pt = particles.Theta();
+	int n = particles.Size();
+
+	const Eigen::Vector3f& origin = Gmap->Origin();
+	float res = Gmap->Resolution();
 
-double BeamEnd::geometric(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask)
-{	
-	std::vector<Eigen::Vector2f> mapPoints = scan2Map(particle, scan);
-	//plotScan(particle, mapPoints);
+	o_memoRep.resize(n);
+	o_memoIds.clear();
+	o_memo.clear();
+	o_memo.reserve(n);
 
-	Eigen::Vector2f br = Gmap->BottomRight();
-	float geoW = 1.0 / scan.size();
+	// the first particle of each (u, v, heading bin) in index order is its representative, so the result doesn't depend on the thread count
+	for(int i = 0; i < n; ++i)
+	{
+		int64_t u = round(std::min(std::max((px[i] - origin(0)) / res, -1e6f), 1e6f));
+		int64_t v = round(std::min(std::max((py[i] - origin(1)) / res, -1e6f), 1e6f));
+		int64_t b = floor((FastWrap2Pi(pt[i]) + M_PI) * o_memoBins / (2 * M_PI));
+		int64_t key = ((u & 0x1FFFFF) << 42) | ((v & 0x1FFFFF) << 21) | (b & 0x1FFFFF);
+
+		auto it = o_memo.emplace(key, i);
+		if (it.second) o_memoIds.push_back(i);
+		o_memoRep[i] = it.first->second;
+	}
 
-	double weight = 1.0;
-	int nonValid = 0;
-	int valid = 0;
+	o_memoLookups += n;
+	o_memoHits += n - o_memoIds.size();
+}
+
+template<BeamEnd::Weighting W>
+void BeamEnd::weighParticles(ParticleSet& particles, const int* ids, int m, int numActive, int numCoarse, int numBeams)
+{
+	const float* px = particles.X();
+	const float* py = particles.Y();
+	const float* pt = particles.Theta();
+	double* weights = particles.Weight();
+
+	const Eigen::Vector3f& origin = Gmap->Origin();
+	float res = Gmap->Resolution();
+	int maxy = Gmap->Map().rows;
+
+	// sums over the first count beams of particle i
+	auto evaluate = [&](int i, int count, uint16_t* codes)
+	{
+		if (o_rotationBins)
+		{
+			int b = headingBin(pt[i]);
+			int u0 = round(std::min(std::max((px[i] - origin(0)) / res, -1e7f), 1e7f));
+			int v0 = maxy - round(std::min(std::max((py[i] - origin(1)) / res, -1e7f), 1e7f));
+			projectBinned(u0, v0, o_binU.data() + b * numActive, o_binV.data() + b * numActive, count, codes);
+		}
+		else
+		{
+			projectBeams(px[i], py[i], pt[i], count, codes);
+		}
+		return sumBeams<W>(codes, count);
+	};
 
-	double tot_dist = 0;
+	double best = 0;
+	int pruned = 0;
+	float pruneRatio = exp(-o_pruneMargin);
 
-	for(long unsigned int i = 0; i < mapPoints.size(); ++i)
+	#pragma omp parallel
 	{
-		Eigen::Vector2f mp = mapPoints[i];
+		// one scratch buffer per thread, nothing is allocated per particle
+		AlignedVector<uint16_t> codes(numActive);
 
-		if(scanMask[i] > 0.0)
+		if (numCoarse)
 		{
-			if ((mp(0) < 0) || (mp(1) < 0) || (mp(0) > br(0)) || (mp(1) > br(1)))
+			// the coarse sums are scaled up to the full scan, so coarse and full weights are on the same scale
+			double scale = double(numActive) / numCoarse;
+
+			#pragma omp for reduction(max:best)
+			for(int k = 0; k < m; ++k)
 			{
-					++nonValid;
+				int i = ids ? ids[k] : k;
+				BeamSums sums = scaleSums(evaluate(i, numCoarse, codes.data()), scale);
+				weights[i] = weigh<W>(sums, numBeams, px[i], py[i]);
+				best = std::max(best, weights[i]);
 			}
-			else
+		}
+
+		// particles far below the best coarse weight keep their coarse estimate
+		#pragma omp for reduction(+:pruned)
+		for(int k = 0; k < m; ++k)
+		{
+			int i = ids ? ids[k] : k;
+			//auto t1 = std::chrono::high_resolution_clock::now();	
+			if (numCoarse && (weights[i] < best * pruneRatio))
 			{
-				float dist = edt.at<float>(mp(1) ,mp(0));
-				//double w = getLikelihood(dist);
-				//weight *= pow(w, geoW);
-				tot_dist += pow(dist / sigma, 2.0);
-				++valid;
-				
+				++pruned;
+				continue;
 			}
+
+			BeamSums sums = evaluate(i, numActive, codes.data());
+			weights[i] = weigh<W>(sums, numBeams, px[i], py[i]);
+
+			//auto t2 = std::chrono::high_resolution_clock::now();
+	   		//auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(t2 - t1);
+	   		//std::cout << "BeamEnd::Timing of compute : " << ns.count() << std::endl;
 		}
 	}
 
-	geoW = 1.0 /(valid + nonValid);
+	o_numPruned = pruned;
+}
 
-	tot_dist +=  nonValid * pow(maxRange / sigma, 2.0);
-	weight = o_coeff * exp(-0.5 * tot_dist * geoW);
+template<BeamEnd::Weighting W>
+double BeamEnd::weigh(const BeamSums& sums, int numBeams, float x, float y)
+{
+	// W is a constant, so only one of the branches survives in each kernel
+	if (W == Weighting::NAIVE) return naive(sums);
+	if (W == Weighting::INTEGRATION) return integration(sums, numBeams);
+	if (W == Weighting::LAPLACE) return laplace(sums);
+	if (W == Weighting::GEOMETRIC) return geometric(sums);
+	if (W == Weighting::GPOE) return gPoE(sums, numBeams);
+
+	return giorgioInside(x, y) ? giorgio(sums) : 0;
+}
 
-	//float penalty = pow(getLikelihood(maxRange), nonValid * geoW);
-	//weight *= penalty;
+void BeamEnd::ComputeWeights(std::vector<Particle>& particles, std::shared_ptr<LidarData> data)
+{
+	ParticleSet set(particles);
+	ComputeWeights(set, data);
+	set.CopyWeights(particles);
+}
 
-	return weight;
+void BeamEnd::projectBeams(float x, float y, float theta, int n, uint16_t* codes) const
+{
+	float c = cos(theta);
+	float s = sin(theta);
+
+	const float* bx = o_beamX.data();
+	const float* by = o_beamY.data();
+	const TiledMap& raster = *o_raster;
+	const MapCell* cells = raster.Cells();
+
+	const Eigen::Vector3f& origin = Gmap->Origin();
+	float ox = origin(0);
+	float oy = origin(1);
+	float res = Gmap->Resolution();
+	int maxy = Gmap->Map().rows;
+
+	#pragma omp simd
+	for(int i = 0; i < n; ++i)
+	{
+		float wx = c * bx[i] - s * by[i] + x;
+		float wy = s * bx[i] + c * by[i] + y;
+
+		// GMap::World2Map, with round() done through the truncating conversion. Clamped so that far away beams do not overflow the int
+		float fu = std::min(std::max((wx - ox) / res, -1e7f), 1e7f);
+		float fv = std::min(std::max((wy - oy) / res, -1e7f), 1e7f);
+		int u = int(fu + copysignf(0.5f, fu));
+		int v = maxy - int(fv + copysignf(0.5f, fv));
+
+		// beam ends off the map are clamped into the guard band, which holds outside
+		codes[i] = cells[raster.Index(u, v)].likelihood;
+	}
 }
 
+void BeamEnd::SetCoarseToFine(int coarseBeams, float margin)
+{
+	o_coarseBeams = std::max(coarseBeams, 0);
+	o_pruneMargin = margin;
+}
 
-double BeamEnd::gPoE(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask)
+BeamEnd::BeamSums BeamEnd::scaleSums(const BeamSums& sums, double scale) const
 {
-	std::vector<Eigen::Vector2f> mapPoints = scan2Map(particle, scan);
-	//plotScan(particle, mapPoints);
+	BeamSums scaled;
+	scaled.valid = round(sums.valid * scale);
+	scaled.outside = round(sums.outside * scale);
+	scaled.near = round(sums.near * scale);
+	scaled.inRange = round(sums.inRange * scale);
+	scaled.sum = sums.sum * scale;
+	scaled.sumNear = sums.sumNear * scale;
+	scaled.sumInRange = sums.sumInRange * scale;
+
+	return scaled;
+}
 
-	Eigen::Vector2f br = Gmap->BottomRight();
-	float geoW = 1.0 / scan.size();
+void BeamEnd::SetMemoization(int headingBins)
+{
+	o_memoBins = std::max(headingBins, 0);
+	o_memoHits = 0;
+	o_memoLookups = 0;
+}
 
-	double weight = 1.0;
-	int nonValid = 0;
-	int valid = 0;
+void BeamEnd::SetRotationBins(int bins)
+{
+	o_rotationBins = std::max(bins, 0);
+}
+
+float BeamEnd::MaxProjectionError(float beamRange) const
+{
+	if (o_rotationBins == 0) return 0;
+
+	// the heading is off by at most half a bin, and rounding the particle cell and the offset separately costs up to one cell more than rounding once
+	return 1.0 + beamRange * M_PI / o_rotationBins / Gmap->Resolution();
+}
 
-	for(long unsigned int i = 0; i < mapPoints.size(); ++i)
+int BeamEnd::headingBin(float theta) const
+{
+	int b = floor((FastWrap2Pi(theta) + M_PI) * o_rotationBins / (2 * M_PI));
+
+	return std::min(std::max(b, 0), o_rotationBins - 1);
+}
+
+void BeamEnd::rotateBins(const float* pt, int n, int numActive)
+{
+	o_binU.resize(o_rotationBins * numActive);
+	o_binV.resize(o_rotationBins * numActive);
+	o_binUsed.assign(o_rotationBins, 0);
+
+	for(int i = 0; i < n; ++i)
+	{
+		o_binUsed[headingBin(pt[i])] = 1;
+	}
+
+	const float* bx = o_beamX.data();
+	const float* by = o_beamY.data();
+	float invRes = 1.0 / Gmap->Resolution();
+	float width = 2 * M_PI / o_rotationBins;
+
+	#pragma omp parallel for
+	for(int b = 0; b < o_rotationBins; ++b)
 	{
-		Eigen::Vector2f mp = mapPoints[i];
+		if (!o_binUsed[b]) continue;
 
-		if(scanMask[i] > 0.0)
+		// rotate by the bin center
+		float theta = -M_PI + (b + 0.5) * width;
+		float c = cos(theta);
+		float s = sin(theta);
+		int* du = o_binU.data() + b * numActive;
+		int* dv = o_binV.data() + b * numActive;
+
+		#pragma omp simd
+		for(int i = 0; i < numActive; ++i)
 		{
-			if ((mp(0) < 0) || (mp(1) < 0) || (mp(0) > br(0)) || (mp(1) > br(1)))
-			{
-					++nonValid;
-			}
-			else
-			{
-				float dist = edt.at<float>(mp(1) ,mp(0));
-				double w = getLikelihood(dist);
-				if (dist < sigma)
-				{
-					weight *= pow(w, geoW);
-					++valid;
-				}
-				else ++nonValid;
-			}
+			float fu = (c * bx[i] - s * by[i]) * invRes;
+			float fv = (s * bx[i] + c * by[i]) * invRes;
+			du[i] = int(fu + copysignf(0.5f, fu));
+			// v grows downwards in the raster
+			dv[i] = -int(fv + copysignf(0.5f, fv));
 		}
 	}
+}
 
-	float penalty = pow(getLikelihood(maxRange), nonValid * geoW);
+void BeamEnd::projectBinned(int u0, int v0, const int* du, const int* dv, int n, uint16_t* codes) const
+{
+	const TiledMap& raster = *o_raster;
+	const MapCell* cells = raster.Cells();
 
-	if(valid)
+	#pragma omp simd
+	for(int i = 0; i < n; ++i)
 	{
-		weight *= penalty;
-		weight *= valid;
+		int u = u0 + du[i];
+		int v = v0 + dv[i];
+
+		// beam ends off the map are clamped into the guard band, which holds outside
+		codes[i] = cells[raster.Index(u, v)].likelihood;
 	}
-	else
+}
+
+template<BeamEnd::Weighting W>
+BeamEnd::BeamSums BeamEnd::sumBeams(const uint16_t* codes, int n) const
+{
+	// the counts a scheme doesn't use are dropped at compile time
+	const bool needNear = (W == Weighting::GPOE) || (W == Weighting::LAPLACE);
+	const bool needRange = (W == Weighting::GIORGIO);
+
+	int sum = 0, sumNear = 0, sumInRange = 0;
+	int numOutside = 0, numNear = 0, numInRange = 0;
+	const int sigmaCode = o_sigmaCode;
+	const int rangeCode = o_rangeCode;
+
+	#pragma omp simd reduction(+:sum, sumNear, sumInRange, numOutside, numNear, numInRange)
+	for(int i = 0; i < n; ++i)
 	{
-		weight = penalty;
+		int q = codes[i];
+		int in = (q != outside);
+		sum += in * q;
+		numOutside += 1 - in;
+
+		if (needNear)
+		{
+			int near = in & (q < sigmaCode);
+			sumNear += near * q;
+			numNear += near;
+		}
+		if (needRange)
+		{
+			int inRange = in & (q < rangeCode);
+			sumInRange += inRange * q;
+			numInRange += inRange;
+		}
 	}
 
-	return weight;
-}
+	BeamSums sums;
+	sums.valid = n - numOutside;
+	sums.outside = numOutside;
+	sums.near = numNear;
+	sums.inRange = numInRange;
+	sums.sum = sum * double(o_step);
+	sums.sumNear = sumNear * double(o_step);
+	sums.sumInRange = sumInRange * double(o_step);
 
+	return sums;
+}
 
-double BeamEnd::integration(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask)
+bool BeamEnd::giorgioInside(float x, float y) const
 {
-	std::vector<Eigen::Vector2f> mapPoints = scan2Map(particle, scan);
-	//plotScan(particle, mapPoints);
+	float radius = 3;
 
-	Eigen::Vector2f br = Gmap->BottomRight();
+	Eigen::Vector2f pose2d = Gmap->World2Map(Eigen::Vector2f(x, y));
+	if((pose2d(0) < 0) || (pose2d(0) > Gmap->Map().cols - 1)) return false;
+	if((pose2d(1) < 0) || (pose2d(1) > Gmap->Map().rows - 1)) return false;
 
-	double sumDist = 0;
-	long unsigned numPoints =  mapPoints.size();
+	// off the cropped EDT the distance is the truncation distance
+	int u = pose2d(0) - o_crop.x;
+	int v = pose2d(1) - o_crop.y;
+	float d = maxRange;
+	if ((u >= 0) && (v >= 0) && (u < edt.cols) && (v < edt.rows)) d = std::abs(edt.at<float>(v, u));
+	if (d < radius) return false;
 
-	for(long unsigned int i = 0; i < numPoints; ++i)
-	{
-		Eigen::Vector2f mp = mapPoints[i];
+	return true;
+}
 
-		if(scanMask[i] > 0.0)
-		{
-			if ((mp(0) < 0) || (mp(1) < 0) || (mp(0) > br(0)) || (mp(1) > br(1)))
-			{
-					sumDist += maxRange;
-			}
-			else
-			{
-				float dist = edt.at<float>(mp(1) ,mp(0));
-				sumDist += dist;
-			}
-		}
+double BeamEnd::giorgio(const BeamSums& sums)
+{ 
+	double min_weight = 0.001;
+
+	// beams at the truncation distance don't count
+	if (sums.inRange < 30)
+	{
+		return min_weight;
 	}
 
-	double weight = getLikelihood(sumDist / numPoints);
+	double log_likelihood =  0.05 * sigma * (sums.sumInRange / (double)sums.inRange);
+	double w = exp(-log_likelihood) + min_weight;
+
+	return w;
+}
+
+double BeamEnd::naive(const BeamSums& sums)
+{
+	// the product of the beam likelihoods in log space, sums.sum holds sum (d / sigma)^2
+	double weight = exp(sums.valid * o_logCoeff - 0.5 * sums.sum + sums.outside * o_logPenalty);
 
 	return weight;
 }
 
 
-double BeamEnd::laplace(Eigen::Vector3f particle, const std::vector<Eigen::Vector3f>& scan, std::vector<double> scanMask)
+double BeamEnd::geometric(const BeamSums& sums)
+{	
+	int nonValid = sums.outside;
+	int valid = sums.valid;
+	double tot_dist = sums.sum;
+
+	float geoW = 1.0 /(valid + nonValid);
+
+	tot_dist +=  nonValid * o_rangeTerm;
+	double weight = o_coeff * exp(-0.5 * tot_dist * geoW);
+
+	//float penalty = pow(getLikelihood(maxRange), nonValid * geoW);
+	//weight *= penalty;
+
+	return weight;
+}
+
+
+double BeamEnd::gPoE(const BeamSums& sums, int numBeams)
 {
-	std::vector<Eigen::Vector2f> mapPoints = scan2Map(particle, scan);
+	float geoW = 1.0 / numBeams;
 
-	Eigen::Vector2f br = Gmap->BottomRight();
-	std::vector<float> distances;
+	// beams closer than sigma contribute their likelihood, all others the penalty
+	int valid = sums.near;
+	int nonValid = sums.outside + sums.valid - sums.near;
+	double weight = exp(geoW * (valid * o_logCoeff - 0.5 * sums.sumNear));
 
-	
-	int valid = 0;
-	double weight = 1.0;
-	double sumDist = 0;
-	long unsigned numPoints =  mapPoints.size();
+	float penalty = pow(o_penalty, nonValid * geoW);
 
-	for(long unsigned int i = 0; i < numPoints; ++i)
+	if(valid)
 	{
-		Eigen::Vector2f mp = mapPoints[i];
-
-		if(scanMask[i] > 0.0)
-		{
-			if ((mp(0) < 0) || (mp(1) < 0) || (mp(0) > br(0)) || (mp(1) > br(1)))
-			{
-		
-					sumDist += maxRange;
-			}
-			else
-			{
-				float dist = edt.at<float>(mp(1) ,mp(0));
-				sumDist += dist;
-				// change sigma to better name when I have nothing to do with my life
-				if (dist < sigma)
-				{
-					++valid;
-				}
-			}
-		}
+		weight *= penalty;
+		weight *= valid;
 	}
+	else
+	{
+		weight = penalty;
+	}
+
+	return weight;
+}
+
 
+double BeamEnd::integration(const BeamSums& sums, int numBeams)
+{
+	double sumDist = sums.sum + sums.outside * maxRange;
+	double weight = getLikelihood(sumDist / numBeams);
+
+	return weight;
+}
+
+
+double BeamEnd::laplace(const BeamSums& sums)
+{
+	int valid = sums.near;
+	double weight = 1.0;
+	double sumDist = sums.sum + sums.outside * maxRange;
 
 	double avgDist = sumDist / valid;
 
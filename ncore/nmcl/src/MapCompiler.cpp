@@ -0,0 +1,41 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                                      #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                                     #
+#                                                                              #
+#  File: MapCompiler.cpp                                                       #
+# ##############################################################################
+**/
+
+// MapCompiler.cpp : bakes the maps and the precomputed tables of an nmcl config into one bundle, see NMCLFactory::Compile
+//
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+#include "NMCLFactory.h"
+
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        std::cout << "usage: MapCompiler <nmcl.config> <output bundle>" << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        NMCLFactory::Compile(argv[1], argv[2]);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -13,14 +13,27 @@
 #include <math.h>
 #include <stdlib.h>
 #include "Utils.h"
+#include "FastMath.h"
 #include <iostream>
+#include <algorithm>
 
 
+MixedFSR::MixedFSR(uint64_t seed)
+{
+	SetSeed(seed);
+}
+
+void MixedFSR::SetSeed(uint64_t seed)
+{
+	o_rng = RandomGenerator(seed, RandomDomain::MOTION);
+	// the single-pose interface keeps drawing from one stream that is never handed to a block
+	o_stream = o_rng.Stream(0xFFFFFFFF);
+}
 
 Eigen::Vector3f MixedFSR::SampleMotion(const Eigen::Vector3f& p1, const std::vector<Eigen::Vector3f>& command, const std::vector<float>& weights, const Eigen::Vector3f& noise)
 {
 	Eigen::Vector3f u(0, 0, 0);
-	float choose = drand48();
+	float choose = o_stream.Uniform();
 	float w = 0.0;
 
 	for(long unsigned int i = 0; i < command.size(); ++i)
@@ -37,9 +50,9 @@ Eigen::Vector3f MixedFSR::SampleMotion(const Eigen::Vector3f& p1, const std::vec
 	float s = u(1);
 	float r = u(2);
 
-	float f_h = f - SampleGuassian(noise(0) * fabs(f));
-	float s_h = s - SampleGuassian(noise(1) * fabs(s));
-	float r_h = r - SampleGuassian(noise(2) * fabs(r));
+	float f_h = f - o_stream.Gaussian(noise(0) * fabs(f));
+	float s_h = s - o_stream.Gaussian(noise(1) * fabs(s));
+	float r_h = r - o_stream.Gaussian(noise(2) * fabs(r));
 
 
 	Eigen::Vector3f new_p = Forward(p1, Eigen::Vector3f(f_h, s_h, r_h));
@@ -48,6 +61,73 @@ Eigen::Vector3f MixedFSR::SampleMotion(const Eigen::Vector3f& p1, const std::vec
 
 }
 
+void MixedFSR::SampleMotion(ParticleSet& particles, const std::vector<Eigen::Vector3f>& command, const std::vector<float>& weights, const Eigen::Vector3f& noise)
+{
+	float* px = particles.X();
+	float* py = particles.Y();
+	float* pt = particles.Theta();
+	int n = particles.Size();
+	int numBlocks = (n + blockSize - 1) / blockSize;
+
+	// per command cumulative weight and noise sigmas, the last entry is the zero command used when the weights don't sum to 1
+	int numCommands = command.size();
+	std::vector<float> accW(numCommands);
+	std::vector<Eigen::Vector3f> sigma(numCommands + 1, Eigen::Vector3f(0, 0, 0));
+	std::vector<Eigen::Vector3f> u(command);
+	u.push_back(Eigen::Vector3f(0, 0, 0));
+	float w = 0.0;
+	for(int c = 0; c < numCommands; ++c)
+	{
+		w += weights[c];
+		accW[c] = w;
+		sigma[c] = noise.cwiseProduct(command[c].cwiseAbs());
+	}
+
+	o_rng.Advance();
+
+	#pragma omp parallel for schedule(static)
+	for(int b = 0; b < numBlocks; ++b)
+	{
+		RandomStream stream = o_rng.Stream(b);
+		int start = b * blockSize;
+		int len = std::min(n, start + blockSize) - start;
+
+		float choose[blockSize];
+		float z[3 * blockSize];
+		float f_h[blockSize];
+		float s_h[blockSize];
+		float r_h[blockSize];
+
+		stream.Uniform(choose, len);
+		stream.Gaussian(z, 3 * len, 1.0);
+
+		for(int k = 0; k < len; ++k)
+		{
+			int c = 0;
+			while((c < numCommands) && (choose[k] > accW[c])) ++c;
+
+			f_h[k] = u[c](0) - sigma[c](0) * z[3 * k];
+			s_h[k] = u[c](1) - sigma[c](1) * z[3 * k + 1];
+			r_h[k] = u[c](2) - sigma[c](2) * z[3 * k + 2];
+		}
+
+		float* x = px + start;
+		float* y = py + start;
+		float* t = pt + start;
+
+		#pragma omp simd
+		for(int k = 0; k < len; ++k)
+		{
+			float sn, cs;
+			FastSinCos(t[k], sn, cs);
+
+			x[k] += f_h[k] * cs - s_h[k] * sn;
+			y[k] += f_h[k] * sn + s_h[k] * cs;
+			t[k] = FastWrap2Pi(r_h[k] + t[k]);
+		}
+	}
+}
+
 
 Eigen::Vector3f MixedFSR::Backward(Eigen::Vector3f p1, Eigen::Vector3f p2)
 {
@@ -23,9 +23,23 @@
 #include <nlohmann/json.hpp>
 #include <boost/filesystem.hpp>
 #include "SemanticVisibility.h"
+#include "MapBundle.h"
 
 using json = nlohmann::json;
 
+namespace
+{
+	// files that are missing get 0, so a bundle compiled before they were added is out of date
+	uint64_t fileChecksum(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file) return 0;
+		std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+		return MapBundle::Checksum(bytes.data(), bytes.size());
+	}
+}
+
 std::shared_ptr<ReNMCL> NMCLFactory::Create(const std::string& configPath)
 {
 	std::ifstream file(configPath);
@@ -38,6 +52,7 @@ std::shared_ptr<ReNMCL> NMCLFactory::Create(const std::string& configPath)
 	bool tracking = config["tracking"]["mode"];
 	std::string predictStrategy = config["predictStrategy"];
 	bool semantic = config["semantic"]["mode"];
+	uint64_t seed = config.value("seed", 0);
 
 
 	std::shared_ptr<BeamEnd> sm;
@@ -57,17 +72,42 @@ std::shared_ptr<ReNMCL> NMCLFactory::Create(const std::string& configPath)
     std::ifstream floorfile(jsonPath);
     json floorconfig;
     floorfile >> floorconfig;
-    FloorMap floormap = FloorMap(floorconfig, folderPath);
 
+	// a compiled bundle replaces the images and the precomputation, as long as it was compiled from the current maps and parameters
+	std::shared_ptr<const MapBundle> bundle = openBundle(configPath);
 
-  	fp = std::make_shared<FloorMap>(floormap);
+	if (bundle)
+	{
+		fp = std::make_shared<FloorMap>(FloorMap(floorconfig, bundle, folderPath));
+	}
+	else
+	{
+	    FloorMap floormap = FloorMap(floorconfig, folderPath);
+	  	fp = std::make_shared<FloorMap>(floormap);
+	}
 
 	if(sensorModel == "BeamEnd")
 	{
 		float likelihoodSigma = config["sensorModel"]["likelihoodSigma"];
 		float maxRange = config["sensorModel"]["maxRange"];
 		int wScheme = config["sensorModel"]["weightingScheme"];
-		sm = std::make_shared<BeamEnd>(BeamEnd(fp->Map(), likelihoodSigma, maxRange, BeamEnd::Weighting(wScheme)));
+		if (bundle && bundle->Has("beamEnd/edt"))
+		{
+			try
+			{
+				sm = std::make_shared<BeamEnd>(BeamEnd(fp->Map(), bundle, likelihoodSigma, maxRange, BeamEnd::Weighting(wScheme)));
+			}
+			catch (const std::runtime_error& e)
+			{
+				std::cout << e.what() << std::endl;
+			}
+		}
+		if (!sm) sm = std::make_shared<BeamEnd>(BeamEnd(fp->Map(), likelihoodSigma, maxRange, BeamEnd::Weighting(wScheme)));
+		// the likelihood layer shares its cache lines with the occupancy and the room ids of the floor
+		sm->SetRaster(fp->Raster(sm->RasterMargin()));
+		sm->SetRotationBins(config["sensorModel"].value("rotationBins", 0));
+		sm->SetMemoization(config["sensorModel"].value("memoBins", 0));
+		sm->SetCoarseToFine(config["sensorModel"].value("coarseBeams", 0), config["sensorModel"].value("pruneMargin", 10.0));
 	}
 
 	if(semantic)
@@ -75,19 +115,49 @@ std::shared_ptr<ReNMCL> NMCLFactory::Create(const std::string& configPath)
 		int beams = config["semantic"]["beams"];
 		std::vector<std::string> classes = config["semantic"]["classes"];
 		std::vector<float> confidences = config["semantic"]["confidence"];
-		semanticModel = std::make_shared<SemanticVisibility>(SemanticVisibility(fp->Map(), beams, folderPath + std::string("SemMaps/"), classes, confidences));
+		if (bundle && bundle->Has("visibility/words"))
+		{
+			try
+			{
+				semanticModel = std::make_shared<SemanticVisibility>(fp->Map(), bundle, beams, classes, confidences);
+			}
+			catch (const std::runtime_error& e)
+			{
+				std::cout << e.what() << std::endl;
+			}
+		}
+		if (!semanticModel) semanticModel = std::make_shared<SemanticVisibility>(fp->Map(), beams, folderPath + std::string("SemMaps/"), classes, confidences);
 	}
 
 
 	if(motionModel == "MixedFSR")
 	{
-		mm = std::make_shared<MixedFSR>(MixedFSR());
+		mm = std::make_shared<MixedFSR>(MixedFSR(seed));
 	}
 	
 
 	float th = config["resampling"]["lowVarianceTH"];
 	rs = std::make_shared<Resampling>(Resampling());
 	rs->SetTH(th);
+	rs->SetSeed(seed);
+	std::string resamplingType = config["resampling"].value("type", "Systematic");
+	if (resamplingType == "Stratified")
+	{
+		rs->SetAlgorithm(Resampling::Algorithm::STRATIFIED);
+	}
+	else if (resamplingType == "Residual")
+	{
+		rs->SetAlgorithm(Resampling::Algorithm::RESIDUAL);
+	}
+	if(config["resampling"].contains("kld") && config["resampling"]["kld"]["mode"])
+	{
+		int minParticles = config["resampling"]["kld"]["minParticles"];
+		int maxParticles = config["resampling"]["kld"]["maxParticles"];
+		float epsilon = config["resampling"]["kld"]["epsilon"];
+		float z = config["resampling"]["kld"]["z"];
+		std::vector<float> binSize = config["resampling"]["kld"]["binSize"];
+		rs->SetKLD(minParticles, maxParticles, epsilon, z, Eigen::Vector3f(binSize[0], binSize[1], binSize[2]));
+	}
 	
 	if(tracking)
 	{
@@ -99,11 +169,11 @@ std::shared_ptr<ReNMCL> NMCLFactory::Create(const std::string& configPath)
 		cov << covVec(0), 0, 0, 0, covVec(1), 0, 0, 0, covVec(2); 
 		std::vector<Eigen::Matrix3d> covariances = {cov};
 		std::vector<Eigen::Vector3f> initGuesses = {guess};
-		renmcl = std::make_shared<ReNMCL>(ReNMCL(fp, mm, sm, rs, semanticModel, numParticles, initGuesses, covariances, injRatio));
+		renmcl = std::make_shared<ReNMCL>(ReNMCL(fp, mm, sm, rs, semanticModel, numParticles, initGuesses, covariances, injRatio, seed));
 	}
 	else
 	{
-		renmcl = std::make_shared<ReNMCL>(ReNMCL(fp, mm, sm, rs, semanticModel, numParticles, injRatio));
+		renmcl = std::make_shared<ReNMCL>(ReNMCL(fp, mm, sm, rs, semanticModel, numParticles, injRatio, seed));
 	}
 	if (predictStrategy == "Uniform")
 	{
@@ -124,6 +194,166 @@ std::shared_ptr<ReNMCL> NMCLFactory::Create(const std::string& configPath)
 }
 
 
+void NMCLFactory::Compile(const std::string& configPath, const std::string& bundlePath)
+{
+	std::ifstream file(configPath);
+	json config;
+	file >> config;
+	std::string folderPath = boost::filesystem::path(configPath).parent_path().string() + "/";
+
+	std::string jsonPath = folderPath + std::string(config["floorMapPath"]);
+	std::ifstream floorfile(jsonPath);
+	json floorconfig;
+	floorfile >> floorconfig;
+
+	MapBundleWriter writer;
+	std::shared_ptr<FloorMap> fp = std::make_shared<FloorMap>(FloorMap(floorconfig, folderPath));
+	// after the floor is built, which rewrites SemMaps/ from the objects of its config
+	writer.Add("sources", sources(configPath).dump());
+	fp->Save(writer);
+
+	if(config["sensorModel"]["type"] == "BeamEnd")
+	{
+		float likelihoodSigma = config["sensorModel"]["likelihoodSigma"];
+		float maxRange = config["sensorModel"]["maxRange"];
+		int wScheme = config["sensorModel"]["weightingScheme"];
+		BeamEnd(fp->Map(), likelihoodSigma, maxRange, BeamEnd::Weighting(wScheme)).Save(writer);
+	}
+
+	if(config["semantic"]["mode"])
+	{
+		int beams = config["semantic"]["beams"];
+		std::vector<std::string> classes = config["semantic"]["classes"];
+		std::vector<float> confidences = config["semantic"]["confidence"];
+		SemanticVisibility(fp->Map(), beams, folderPath + std::string("SemMaps/"), classes, confidences).Save(writer, classes);
+	}
+
+	std::string textMapDir = folderPath + std::string("TextMaps/");
+	if(boost::filesystem::is_directory(textMapDir))
+	{
+		PlaceRecognition(fp->GetRoomNames(), textMapDir, fp->Map()).Save(writer);
+	}
+
+	writer.Write(bundlePath);
+	std::cout << "NMCLFactory::Compiled " << bundlePath << std::endl;
+}
+
+
+bool NMCLFactory::IsCompiledFrom(const MapBundle& bundle, const std::string& configPath)
+{
+	if (!bundle.Has("sources")) return false;
+
+	return json::parse(bundle.Text("sources")) == sources(configPath);
+}
+
+
+json NMCLFactory::sources(const std::string& configPath)
+{
+	std::ifstream file(configPath);
+	json config;
+	file >> config;
+	std::string folderPath = boost::filesystem::path(configPath).parent_path().string() + "/";
+
+	std::string jsonPath = folderPath + std::string(config["floorMapPath"]);
+	std::ifstream floorfile(jsonPath);
+	json floorconfig;
+	floorfile >> floorconfig;
+
+	json sources;
+	sources["floor"] = floorconfig;
+	std::string imgPath = floorconfig["map"]["image"];
+	std::string segPath = floorconfig["roomSeg"];
+	sources["files"][imgPath] = fileChecksum(folderPath + imgPath);
+	sources["files"][segPath] = fileChecksum(folderPath + segPath);
+
+	std::string textMapDir = folderPath + std::string("TextMaps/");
+	if(boost::filesystem::is_directory(textMapDir))
+	{
+		for(const boost::filesystem::directory_entry& entry : boost::filesystem::directory_iterator(textMapDir))
+		{
+			std::string textMap = "TextMaps/" + entry.path().filename().string();
+			sources["files"][textMap] = fileChecksum(folderPath + textMap);
+		}
+	}
+
+	if(config["sensorModel"]["type"] == "BeamEnd")
+	{
+		sources["sensorModel"]["likelihoodSigma"] = config["sensorModel"]["likelihoodSigma"];
+		sources["sensorModel"]["maxRange"] = config["sensorModel"]["maxRange"];
+		sources["sensorModel"]["weightingScheme"] = config["sensorModel"]["weightingScheme"];
+	}
+
+	if(config["semantic"]["mode"])
+	{
+		sources["semantic"]["beams"] = config["semantic"]["beams"];
+		sources["semantic"]["classes"] = config["semantic"]["classes"];
+		sources["semantic"]["confidence"] = config["semantic"]["confidence"];
+	}
+
+	return sources;
+}
+
+
+std::shared_ptr<const MapBundle> NMCLFactory::openBundle(const std::string& configPath)
+{
+	std::ifstream file(configPath);
+	json config;
+	file >> config;
+	std::string folderPath = boost::filesystem::path(configPath).parent_path().string() + "/";
+
+	std::string bundlePath = config.value("bundle", "");
+	if (bundlePath.empty() || !boost::filesystem::exists(folderPath + bundlePath)) return nullptr;
+
+	std::shared_ptr<const MapBundle> bundle = std::make_shared<const MapBundle>(folderPath + bundlePath);
+	if (!IsCompiledFrom(*bundle, configPath))
+	{
+		std::cout << "NMCLFactory::" << bundlePath << " is out of date, ignoring it" << std::endl;
+		return nullptr;
+	}
+
+	return bundle;
+}
+
+
+std::shared_ptr<PlaceRecognition> NMCLFactory::CreatePlaceRecognition(const std::string& configPath, std::shared_ptr<FloorMap> floorMap, const std::string& textMapDir)
+{
+	std::shared_ptr<const MapBundle> bundle = openBundle(configPath);
+	if (bundle && bundle->Has("text/info"))
+	{
+		try
+		{
+			return std::make_shared<PlaceRecognition>(bundle);
+		}
+		catch (const std::runtime_error& e)
+		{
+			std::cout << e.what() << std::endl;
+		}
+	}
+
+	return std::make_shared<PlaceRecognition>(PlaceRecognition(floorMap->GetRoomNames(), textMapDir, floorMap->Map()));
+}
+
+
+std::shared_ptr<BeamSelection> NMCLFactory::CreateBeamSelection(const std::string& configPath)
+{
+	std::ifstream file(configPath);
+	json config;
+	file >> config;
+
+	if(!config.contains("beamSelection") || !config["beamSelection"]["mode"])
+	{
+		return nullptr;
+	}
+
+	int numBeams = config["beamSelection"]["numBeams"];
+	int normalBins = config["beamSelection"].value("normalBins", 8);
+	float cellSize = config["beamSelection"].value("cellSize", 0.25);
+	float neighbourDist = config["beamSelection"].value("neighbourDist", 0.3);
+
+	return std::make_shared<BeamSelection>(BeamSelection(numBeams, normalBins, cellSize, neighbourDist));
+}
+
+
 void NMCLFactory::Dump(const std::string& configPath)
 {
 	json config;
@@ -131,14 +361,32 @@ void NMCLFactory::Dump(const std::string& configPath)
 	config["sensorModel"]["likelihoodSigma"] = 8;
 	config["sensorModel"]["maxRange"] = 15;
 	config["sensorModel"]["weightingScheme"] = 2;
+	config["sensorModel"]["rotationBins"] = 0;
+	config["sensorModel"]["memoBins"] = 0;
+	config["sensorModel"]["coarseBeams"] = 0;
+	config["sensorModel"]["pruneMargin"] = 10;
 	config["motionModel"] = "MixedFSR";
 	config["resampling"]["lowVarianceTH"] = 0.5;
+	config["resampling"]["type"] = "Systematic";
+	config["resampling"]["kld"]["mode"] = false;
+	config["resampling"]["kld"]["minParticles"] = 500;
+	config["resampling"]["kld"]["maxParticles"] = 10000;
+	config["resampling"]["kld"]["epsilon"] = 0.05;
+	config["resampling"]["kld"]["z"] = 2.33;
+	config["resampling"]["kld"]["binSize"] = {0.5, 0.5, 0.1745};
+	config["beamSelection"]["mode"] = false;
+	config["beamSelection"]["numBeams"] = 200;
+	config["beamSelection"]["normalBins"] = 8;
+	config["beamSelection"]["cellSize"] = 0.25;
+	config["beamSelection"]["neighbourDist"] = 0.3;
 	config["tracking"]["mode"] =  false;
 	config["semantic"]["mode"] =  false;
 	config["predictStrategy"] = "Uniform";
 	config["floorMapPath"] = "floor.config";
+	config["bundle"] = "";
 	config["numParticles"] = 10000;
 	config["injRatio"] = 0.5;
+	config["seed"] = 0;
 
 	std::ofstream file(configPath);
 	file << std::setw(4) << config << std::endl;
@@ -0,0 +1,120 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                                      #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                                     #
+#                                                                              #
+#  File: ParticleClusters.cpp          		                           	   	   #
+# ##############################################################################
+**/
+
+#include "ParticleClusters.h"
+#include <algorithm>
+#include <cmath>
+
+ParticleClusters::ParticleClusters(const Eigen::Vector3f& cellSize)
+{
+	o_cellSize = cellSize;
+	o_numHeadings = std::max(1, int(std::ceil(2 * M_PI / cellSize(2))));
+}
+
+uint64_t ParticleClusters::key(int ix, int iy, int it) const
+{
+	uint64_t bx = uint64_t(int64_t(ix) + (1 << 20)) & 0x1FFFFF;
+	uint64_t by = uint64_t(int64_t(iy) + (1 << 20)) & 0x1FFFFF;
+	uint64_t bt = uint64_t(it) & 0x1FFFFF;
+
+	return (bx << 42) | (by << 21) | bt;
+}
+
+void ParticleClusters::Compute(const ParticleSet& particles)
+{
+	o_index.clear();
+	o_cells.clear();
+	o_modes.clear();
+
+	int n = particles.Size();
+	const float* px = particles.X();
+	const float* py = particles.Y();
+	const float* pt = particles.Theta();
+	const double* pw = particles.Weight();
+
+	// hash the particles into cells
+	double totalWeight = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		double t = pt[i] + M_PI;
+		t -= 2 * M_PI * std::floor(t / (2 * M_PI));
+
+		int ix = int(std::floor(px[i] / o_cellSize(0)));
+		int iy = int(std::floor(py[i] / o_cellSize(1)));
+		int it = std::min(int(t / o_cellSize(2)), o_numHeadings - 1);
+
+		auto res = o_index.emplace(key(ix, iy, it), int(o_cells.size()));
+		if (res.second)
+		{
+			o_cells.push_back(Cell{ix, iy, it, 0, SetStatistics()});
+		}
+
+		Cell& cell = o_cells[res.first->second];
+		cell.stats.Add(particles.Pose(i), pw[i]);
+		++cell.count;
+		totalWeight += pw[i];
+	}
+
+	// connected components over the occupied cells, each cell is visited once and looks up its 26 neighbours
+	int numCells = o_cells.size();
+	o_labels.assign(numCells, -1);
+
+	for(int c = 0; c < numCells; ++c)
+	{
+		if (o_labels[c] >= 0) continue;
+
+		int label = o_modes.size();
+		o_modes.push_back(PoseMode());
+		PoseMode& mode = o_modes.back();
+
+		o_labels[c] = label;
+		o_stack.assign(1, c);
+
+		while(o_stack.size())
+		{
+			const Cell& cell = o_cells[o_stack.back()];
+			o_stack.pop_back();
+
+			mode.stats.Add(cell.stats);
+			mode.numParticles += cell.count;
+
+			for(int dx = -1; dx <= 1; ++dx)
+			{
+				for(int dy = -1; dy <= 1; ++dy)
+				{
+					for(int dt = -1; dt <= 1; ++dt)
+					{
+						int it = (cell.it + dt + o_numHeadings) % o_numHeadings;
+						auto nb = o_index.find(key(cell.ix + dx, cell.iy + dy, it));
+						if ((nb == o_index.end()) || (o_labels[nb->second] >= 0)) continue;
+
+						o_labels[nb->second] = label;
+						o_stack.push_back(nb->second);
+					}
+				}
+			}
+		}
+	}
+
+	for(PoseMode& mode : o_modes)
+	{
+		mode.weight = (totalWeight > 0) ? mode.stats.SumWeights() / totalWeight : 0;
+	}
+
+	std::stable_sort(o_modes.begin(), o_modes.end(), [](const PoseMode& a, const PoseMode& b) {return a.weight > b.weight; });
+}
+
+std::vector<PoseMode> ParticleClusters::Modes(int k) const
+{
+	k = std::max(0, std::min(k, int(o_modes.size())));
+
+	return std::vector<PoseMode>(o_modes.begin(), o_modes.begin() + k);
+}
@@ -12,10 +12,13 @@
  #include "ParticleFilter.h"
 #include "Utils.h"
 #include <algorithm>
+#include <numeric>
 #include <map>
+#include <stdexcept>
 
-ParticleFilter::ParticleFilter(std::shared_ptr<FloorMap> floorMap)
+ParticleFilter::ParticleFilter(std::shared_ptr<FloorMap> floorMap, uint64_t seed)
 {
+	o_stream = RandomGenerator(seed, RandomDomain::SAMPLING).Stream(0);
 
 	o_floorMap = floorMap;
 	o_gmap = o_floorMap->Map();
@@ -25,99 +28,11 @@ void ParticleFilter::InitByRoomType(std::vector<Particle>& particles, int n_part
 {
 	particles = std::vector<Particle>(n_particles);
 
-	Eigen::Vector2f tl = o_gmap->Map2World(o_gmap->TopLeft());
-	Eigen::Vector2f br = o_gmap->Map2World(o_gmap->BottomRight());
-
-	/*std::vector<float>::const_iterator result = std::max_element(roomProbabilities.begin(), roomProbabilities.end());
-	int t = std::distance(roomProbabilities.begin(), result) ;
-
-	int i = 0;
-	while(i < n_particles)
-	{
-			float x = drand48() * (br(0) - tl(0)) + tl(0);
-			float y = drand48() * (br(1) - tl(1)) + tl(1);
-			if(!o_gmap->IsValid(Eigen::Vector3f(x, y, 0))) continue;
-			int roomID = o_floorMap->GetRoomID(Eigen::Vector3f(x, y, 0));
-			int type = o_floorMap->GetRoom(roomID).Purpose();
-			if (type != t) continue;
-
-			float theta = drand48() * 2 * M_PI - M_PI;
-			Particle p(Eigen::Vector3f(x, y, theta), 1.0 / n_particles);
-			particles[i] = p;
-			++i;
-	}*/
-
-	std::vector<float> accProb = std::vector<float>(roomProbabilities.size());
-	accProb[0] = roomProbabilities[0];
-	for(int t = 1; t < 4; ++t)
+	for(int i = 0; i < n_particles; ++i)
 	{
-		accProb[t] = roomProbabilities[t] + accProb[t - 1]; 
+		particles[i] = Particle(sampleRoomType(roomProbabilities), 1.0 / n_particles);
 	}
 
-	int i = 0;
-	while(i < n_particles)
-	{
-			int t = 3;
-			
-			float prob = drand48();
-			if (prob < accProb[0]) t = 0;
-			else if (prob < accProb[1]) t = 1;
-			else if (prob < accProb[2]) t = 2;
-
-			float x = drand48() * (br(0) - tl(0)) + tl(0);
-			float y = drand48() * (br(1) - tl(1)) + tl(1);
-			if(!o_gmap->IsValid(Eigen::Vector3f(x, y, 0))) continue;
-			int roomID = o_floorMap->GetRoomID(Eigen::Vector3f(x, y, 0));
-			int type = o_floorMap->GetRoom(roomID).Purpose();
-			if (type != t) continue;
-
-			float theta = drand48() * 2 * M_PI - M_PI;
-			Particle p(Eigen::Vector3f(x, y, theta), 1.0 / n_particles);
-			particles[i] = p;
-			++i;
-	}
-
-
-
-
-
-/*
-	std::vector<int> n_particlesPerRoom = std::vector<int>(roomProbabilities.size());
-	int par_cnt = 0;
-	for(int t = 0; t < 3; ++t)
-	{
-		int perRoom = int(n_particles * roomProbabilities[t]);
-		n_particlesPerRoom[t] = perRoom; 
-		par_cnt += perRoom;
-	}
-
-	n_particlesPerRoom[3] = n_particles - par_cnt;
-
-	for(int t = 0; t < 4; ++t) std::cout << n_particlesPerRoom[t] << " ";
-	std::cout << std::endl;
-
-	int tot = 0;
-	for(int t = 0; t < 4; ++t) 
-	{	
-		int i = 0;
-		while(i < n_particlesPerRoom[t])
-		{
-				float x = drand48() * (br(0) - tl(0)) + tl(0);
-				float y = drand48() * (br(1) - tl(1)) + tl(1);
-				if(!o_gmap->IsValid(Eigen::Vector3f(x, y, 0))) continue;
-				int roomID = o_floorMap->GetRoomID(Eigen::Vector3f(x, y, 0));
-				int type = o_floorMap->GetRoom(roomID).Purpose();
-				if (type != t) continue;
-
-				//std::cout << type << ", " << tot << std::endl;
-				float theta = drand48() * 2 * M_PI - M_PI;
-				Particle p(Eigen::Vector3f(x, y, theta), 1.0 / n_particles);
-				particles[tot] = p;
-				++i;
-				++tot;
-		}
-	}*/
-
 	o_particles = particles;
 }
 
@@ -126,20 +41,9 @@ void ParticleFilter::InitUniform(std::vector<Particle>& particles, int n_particl
 {
 	particles = std::vector<Particle>(n_particles);
 
-	Eigen::Vector2f tl = o_gmap->Map2World(o_gmap->TopLeft());
-	Eigen::Vector2f br = o_gmap->Map2World(o_gmap->BottomRight());
-
-	int i = 0;
-	while(i < n_particles)
+	for(int i = 0; i < n_particles; ++i)
 	{
-			float x = drand48() * (br(0) - tl(0)) + tl(0);
-			float y = drand48() * (br(1) - tl(1)) + tl(1);
-			if(!o_gmap->IsValid(Eigen::Vector3f(x, y, 0))) continue;
-
-			float theta = drand48() * 2 * M_PI - M_PI;
-			Particle p(Eigen::Vector3f(x, y, theta), 1.0 / n_particles);
-			particles[i] = p;
-			++i;
+		particles[i] = Particle(sampleUniform(), 1.0 / n_particles);
 	}
 
 	o_particles = particles;
@@ -153,32 +57,12 @@ void ParticleFilter::InitGaussian(std::vector<Particle>& particles, int n_partic
 
 	for(long unsigned int i = 0; i < initGuess.size(); ++i)
 	{
-		Eigen::Vector3f initG = initGuess[i];
-		Eigen::Matrix3d cov = covariances[i];
-
-		float dx = fabs(SampleGuassian(cov(0, 0)));
-		float dy = fabs(SampleGuassian(cov(1, 1)));
-		float dt = fabs(SampleGuassian(cov(2, 2)));
-
-		if (cov(2, 2) < 0.0) dt = M_PI;
-		//if (cov(2, 2) > 1.0) dt = M_PI;
-
-		Eigen::Vector3f delta(dx, dy, dt);
+		std::vector<Eigen::Vector3f> poses;
+		sampleGaussian(initGuess[i], covariances[i], n_particles, poses);
 
-		Eigen::Vector3f tl = initG + delta;
-		Eigen::Vector3f br = initG - delta;
-
-		int n = 0;
-		while(n < n_particles)
+		for(int n = 0; n < n_particles; ++n)
 		{
-				float x = drand48() * (br(0) - tl(0)) + tl(0);
-				float y = drand48() * (br(1) - tl(1)) + tl(1);
-				if(!o_gmap->IsValid(Eigen::Vector3f(x, y, 0))) continue;
-
-				float theta = drand48() * (br(2) - tl(2)) + tl(2);
-				Particle p(Eigen::Vector3f(x, y, theta), 1.0 / n_particles);
-				particles[n + n_particles * i] = p;
-				++n;
+			particles[n + n_particles * i] = Particle(poses[n], 1.0 / n_particles);
 		}
 	}
 
@@ -193,28 +77,12 @@ void ParticleFilter::AddBoundingBox(std::vector<Particle>& particles, int n_part
 
 	for(long unsigned int i = 0; i < tls.size(); ++i)
 	{
-		Eigen::Vector2f tl = o_gmap->Map2World(tls[i]);
-		Eigen::Vector2f br = o_gmap->Map2World(brs[i]);
-		float dx = 0.2 * drand48();
-		float dy = 0.2 * drand48();
-
-		tl += Eigen::Vector2f(-dx, dy);
-		br += Eigen::Vector2f(dx, -dy);
+		std::vector<Eigen::Vector3f> poses;
+		sampleTextBox(tls[i], brs[i], yaws[i], n_particles, poses);
 
-		float yaw = yaws[i];
-
-		int n = 0;
-		while(n < n_particles)
+		for(int n = 0; n < n_particles; ++n)
 		{
-				float x = drand48() * (br(0) - tl(0)) + tl(0);
-				float y = drand48() * (br(1) - tl(1)) + tl(1);
-				if(!o_gmap->IsValid(Eigen::Vector3f(x, y, 0))) continue;
-
-				float theta = 0.5 * (drand48() * 2 * M_PI - M_PI);
-				theta += yaw;
-				Particle p(Eigen::Vector3f(x, y, theta), 1.0 / n_particles);
-				new_particles[n + n_particles * i] = p;
-				++n;
+			new_particles[n + n_particles * i] = Particle(poses[n], 1.0 / n_particles);
 		}
 	}
 	
@@ -227,30 +95,18 @@ void ParticleFilter::AddBoundingBox(std::vector<Particle>& particles, int n_part
 
 Eigen::Vector3f ParticleFilter::CreateSingleUniform()
 {
-	Eigen::Vector2f tl = o_gmap->Map2World(o_gmap->TopLeft());
-	Eigen::Vector2f br = o_gmap->Map2World(o_gmap->BottomRight());
-
-	int i = 0;
-	while(i < 1)
-	{
-			float x = drand48() * (br(0) - tl(0)) + tl(0);
-			float y = drand48() * (br(1) - tl(1)) + tl(1);
-			if(!o_gmap->IsValid(Eigen::Vector3f(x, y, 0))) continue;
-
-			float theta = drand48() * 2 * M_PI - M_PI;
-			Eigen::Vector3f p (x, y, theta);
-			return p;
-	}
+	return sampleUniform();
 }
 
 
 
 void ParticleFilter::RemoveWeakest(std::vector<Particle>& particles, int n_particles)
 {
+	// only the split between kept and removed particles matters, so a partial selection replaces the full sort
 	auto lambda = [](const Particle & a, const Particle & b) {return a.weight > b.weight; };
-	std::sort(particles.begin(), particles.end(), lambda);
-
 	int numKeep = particles.size() - n_particles;
+	std::nth_element(particles.begin(), particles.begin() + numKeep, particles.end(), lambda);
+
 	particles.erase(particles.begin() + numKeep, particles.end());
 
 	o_particles = particles;
@@ -259,21 +115,11 @@ void ParticleFilter::RemoveWeakest(std::vector<Particle>& particles, int n_parti
 void ParticleFilter::AddUniform(std::vector<Particle>& particles, int n_particles)
 {
 	std::vector<Particle> new_particles(n_particles);
-	Eigen::Vector2f tl = o_gmap->Map2World(o_gmap->TopLeft());
-	Eigen::Vector2f br = o_gmap->Map2World(o_gmap->BottomRight());
 	int parW = 1.0 / float(n_particles + particles.size());
 
-	int i = 0;
-	while(i < n_particles)
+	for(int i = 0; i < n_particles; ++i)
 	{
-			float x = drand48() * (br(0) - tl(0)) + tl(0);
-			float y = drand48() * (br(1) - tl(1)) + tl(1);
-			if(!o_gmap->IsValid(Eigen::Vector3f(x, y, 0))) continue;
-
-			float theta = drand48() * 2 * M_PI - M_PI;
-			Particle p(Eigen::Vector3f(x, y, theta), parW);
-			new_particles[i] = p;
-			++i;
+		new_particles[i] = Particle(sampleUniform(), parW);
 	}
 
 	particles.reserve(particles.size() + distance(new_particles.begin(),new_particles.end()));
@@ -286,37 +132,15 @@ void ParticleFilter::AddUniform(std::vector<Particle>& particles, int n_particle
 void ParticleFilter::AddGussian(std::vector<Particle>& particles, int n_particles, const std::vector<Eigen::Vector3f>& initGuess, const std::vector<Eigen::Matrix3d>& covariances)
 {
 	std::vector<Particle> new_particles(n_particles * initGuess.size());
-	int parW = 1.0 / float(n_particles + particles.size());
-
 
 	for(long unsigned int i = 0; i < initGuess.size(); ++i)
 	{
-		Eigen::Vector3f initG = initGuess[i];
-		Eigen::Matrix3d cov = covariances[i];
-
-		float dx = fabs(SampleGuassian(cov(0, 0)));
-		float dy = fabs(SampleGuassian(cov(1, 1)));
-		float dt = fabs(SampleGuassian(cov(2, 2)));
+		std::vector<Eigen::Vector3f> poses;
+		sampleGaussian(initGuess[i], covariances[i], n_particles, poses);
 
-		if (cov(2, 2) < 0.0) dt = M_PI;
-		//if (cov(2, 2) > 1.0) dt = M_PI;
-
-		Eigen::Vector3f delta(dx, dy, dt);
-
-		Eigen::Vector3f tl = initG + delta;
-		Eigen::Vector3f br = initG - delta;
-
-		int n = 0;
-		while(n < n_particles)
+		for(int n = 0; n < n_particles; ++n)
 		{
-				float x = drand48() * (br(0) - tl(0)) + tl(0);
-				float y = drand48() * (br(1) - tl(1)) + tl(1);
-				if(!o_gmap->IsValid(Eigen::Vector3f(x, y, 0))) continue;
-
-				float theta = drand48() * (br(2) - tl(2)) + tl(2);
-				Particle p(Eigen::Vector3f(x, y, theta), 1.0 / n_particles);
-				new_particles[n + n_particles * i] = p;
-				++n;
+			new_particles[n + n_particles * i] = Particle(poses[n], 1.0 / n_particles);
 		}
 	}
 
@@ -327,6 +151,180 @@ void ParticleFilter::AddGussian(std::vector<Particle>& particles, int n_particle
 
 }
 
+
+void ParticleFilter::ReplaceUniform(ParticleSet& particles, const std::vector<int>& ids, double weight)
+{
+	for(int id : ids)
+	{
+		particles.Set(id, Particle(sampleUniform(), weight));
+	}
+}
+
+void ParticleFilter::ReplaceByRoomType(ParticleSet& particles, const std::vector<int>& ids, const std::vector<float>& roomProbabilities, double weight)
+{
+	for(int id : ids)
+	{
+		particles.Set(id, Particle(sampleRoomType(roomProbabilities), weight));
+	}
+}
+
+void ParticleFilter::ReplaceGaussian(ParticleSet& particles, const std::vector<int>& ids, const Eigen::Vector3f& initGuess, const Eigen::Matrix3d& covariance, double weight)
+{
+	if (ids.empty()) return;
+
+	std::vector<Eigen::Vector3f> poses;
+	sampleGaussian(initGuess, covariance, ids.size(), poses);
+
+	for(long unsigned int i = 0; i < ids.size(); ++i)
+	{
+		particles.Set(ids[i], Particle(poses[i], weight));
+	}
+}
+
+void ParticleFilter::ReplaceBoundingBox(ParticleSet& particles, const std::vector<int>& ids, const Eigen::Vector2f& tl, const Eigen::Vector2f& br, float yaw, double weight)
+{
+	if (ids.empty()) return;
+
+	std::vector<Eigen::Vector3f> poses;
+	sampleTextBox(tl, br, yaw, ids.size(), poses);
+
+	for(long unsigned int i = 0; i < ids.size(); ++i)
+	{
+		particles.Set(ids[i], Particle(poses[i], weight));
+	}
+}
+
+void ParticleFilter::ReplaceTextRegion(ParticleSet& particles, const std::vector<int>& ids, const TextRegion& region, float yawOffset, double weight)
+{
+	// the cells are free, the jitter stays off their borders like FreeSpaceIndex, so every draw rounds to its cell and none is rejected
+	float jitter = (1.0 - 2.0 * FreeSpaceIndex::borderMargin) * region.resolution;
+
+	for(int id : ids)
+	{
+		int cell = region.alias.Sample(o_stream);
+		Eigen::Vector2f xy = region.positions[cell] + Eigen::Vector2f((o_stream.Uniform() - 0.5) * jitter, (o_stream.Uniform() - 0.5) * jitter);
+
+		float theta = region.yaws[cell] + yawOffset + (o_stream.Uniform() - 0.5) * M_PI;
+		particles.Set(id, Particle(Eigen::Vector3f(xy(0), xy(1), theta), weight));
+	}
+}
+
+std::vector<int> ParticleFilter::Weakest(const ParticleSet& particles, int n) const
+{
+	int size = particles.Size();
+	n = std::max(0, std::min(n, size));
+
+	std::vector<int> ids(size);
+	std::iota(ids.begin(), ids.end(), 0);
+
+	const double* weights = particles.Weight();
+	auto lambda = [weights](int a, int b) {return (weights[a] < weights[b]) || ((weights[a] == weights[b]) && (a < b)); };
+	std::nth_element(ids.begin(), ids.begin() + n, ids.end(), lambda);
+
+	ids.resize(n);
+	std::sort(ids.begin(), ids.end());
+
+	return ids;
+}
+
+
+Eigen::Vector3f ParticleFilter::sampleUniform()
+{
+	Eigen::Vector2f xy;
+	if (!o_floorMap->FreeSpace()->SampleUniform(o_stream, xy))
+	{
+		throw std::runtime_error("ParticleFilter| the map has no free space to sample from");
+	}
+
+	float theta = o_stream.Uniform() * 2 * M_PI - M_PI;
+
+	return Eigen::Vector3f(xy(0), xy(1), theta);
+}
+
+Eigen::Vector3f ParticleFilter::sampleRoomType(const std::vector<float>& roomProbabilities)
+{
+	// rejection sampling drew a purpose, then a position in the whole map, and kept it if the position had that purpose. So a purpose
+	// was accepted in proportion to its probability times its free area, and the pick is weighted the same way
+	const FreeSpaceIndex& freeSpace = *o_floorMap->FreeSpace();
+	std::vector<double> mass(roomProbabilities.size());
+	double total = 0;
+	for(long unsigned int i = 0; i < roomProbabilities.size(); ++i)
+	{
+		mass[i] = roomProbabilities[i] * freeSpace.PurposeArea(i);
+		total += mass[i];
+	}
+	// no free space of any likely purpose, fall back to the whole map
+	if (total <= 0) return sampleUniform();
+
+	double acc = 0;
+	double prob = o_stream.Uniform() * total;
+	int t = 0;
+	for(long unsigned int i = 0; i < mass.size(); ++i)
+	{
+		if (mass[i] <= 0) continue;
+		t = i;
+		acc += mass[i];
+		if (prob < acc) break;
+	}
+
+	Eigen::Vector2f xy;
+	freeSpace.SamplePurpose(t, o_stream, xy);
+
+	float theta = o_stream.Uniform() * 2 * M_PI - M_PI;
+
+	return Eigen::Vector3f(xy(0), xy(1), theta);
+}
+
+void ParticleFilter::sampleGaussian(const Eigen::Vector3f& initGuess, const Eigen::Matrix3d& cov, int n, std::vector<Eigen::Vector3f>& poses)
+{
+	float dx = fabs(o_stream.Gaussian(cov(0, 0)));
+	float dy = fabs(o_stream.Gaussian(cov(1, 1)));
+	float dt = fabs(o_stream.Gaussian(cov(2, 2)));
+
+	if (cov(2, 2) < 0.0) dt = M_PI;
+	//if (cov(2, 2) > 1.0) dt = M_PI;
+
+	Eigen::Vector3f delta(dx, dy, dt);
+
+	sampleBox(initGuess + delta, initGuess - delta, n, poses);
+}
+
+void ParticleFilter::sampleBox(const Eigen::Vector3f& tl, const Eigen::Vector3f& br, int n, std::vector<Eigen::Vector3f>& poses)
+{
+	poses = std::vector<Eigen::Vector3f>(n);
+
+	std::vector<Eigen::Vector2f> xy;
+	// a box without free space, fall back to the whole map
+	if (!o_floorMap->FreeSpace()->SampleBox(tl.head(2), br.head(2), n, o_stream, xy))
+	{
+		for(int i = 0; i < n; ++i) poses[i] = sampleUniform();
+		return;
+	}
+
+	for(int i = 0; i < n; ++i)
+	{
+		float theta = o_stream.Uniform() * (br(2) - tl(2)) + tl(2);
+		poses[i] = Eigen::Vector3f(xy[i](0), xy[i](1), theta);
+	}
+}
+void ParticleFilter::sampleTextBox(const Eigen::Vector2f& tl, const Eigen::Vector2f& br, float yaw, int n, std::vector<Eigen::Vector3f>& poses)
+{
+	Eigen::Vector2f wtl = o_gmap->Map2World(tl);
+	Eigen::Vector2f wbr = o_gmap->Map2World(br);
+	float dx = 0.2 * o_stream.Uniform();
+	float dy = 0.2 * o_stream.Uniform();
+
+	wtl += Eigen::Vector2f(-dx, dy);
+	wbr += Eigen::Vector2f(dx, -dy);
+
+	sampleBox(Eigen::Vector3f(wtl(0), wtl(1), -0.5 * M_PI), Eigen::Vector3f(wbr(0), wbr(1), 0.5 * M_PI), n, poses);
+
+	for(int i = 0; i < n; ++i)
+	{
+		poses[i](2) += yaw;
+	}
+}
+
 SetStatistics ParticleFilter::ComputeStatistics(const std::vector<Particle>& particles)
 {
 	o_stats = SetStatistics::ComputeParticleSetStatistics(particles);
@@ -352,3 +350,34 @@ void ParticleFilter::NormalizeWeights(std::vector<Particle>& particles)
 		particles[i].weight = particles[i].weight / w;
 	}
 }
+
+void ParticleFilter::NormalizeWeights(ParticleSet& particles)
+{
+	int n = particles.Size();
+	double* weights = particles.Weight();
+
+	double w = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		w += weights[i];
+	}
+
+	double invW = 1.0 / w;
+	for(int i = 0; i < n; ++i)
+	{
+		weights[i] *= invW;
+	}
+}
+
+void ParticleFilter::NormalizeWeights(ParticleSet& particles, double sumWeights)
+{
+	int n = particles.Size();
+	double* weights = particles.Weight();
+	double invW = 1.0 / sumWeights;
+
+	#pragma omp parallel for simd schedule(static)
+	for(int i = 0; i < n; ++i)
+	{
+		weights[i] *= invW;
+	}
+}
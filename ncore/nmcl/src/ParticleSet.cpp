@@ -0,0 +1,105 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                                      #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                                     #
+#                                                                              #
+#  File: ParticleSet.cpp                			                           #
+# ##############################################################################
+**/
+
+
+#include "ParticleSet.h"
+#include <algorithm>
+
+ParticleSet::ParticleSet(int n)
+{
+	Resize(n);
+}
+
+ParticleSet::ParticleSet(const std::vector<Particle>& particles)
+{
+	int n = particles.size();
+	Resize(n);
+
+	for(int i = 0; i < n; ++i)
+	{
+		Set(i, particles[i]);
+	}
+}
+
+void ParticleSet::Resize(int n)
+{
+	o_x.resize(n);
+	o_y.resize(n);
+	o_theta.resize(n);
+	o_weight.resize(n);
+}
+
+void ParticleSet::Reserve(int n)
+{
+	o_x.reserve(n);
+	o_y.reserve(n);
+	o_theta.reserve(n);
+	o_weight.reserve(n);
+}
+
+void ParticleSet::Clear()
+{
+	o_x.clear();
+	o_y.clear();
+	o_theta.clear();
+	o_weight.clear();
+}
+
+void ParticleSet::PushBack(const Particle& p)
+{
+	o_x.push_back(p.pose(0));
+	o_y.push_back(p.pose(1));
+	o_theta.push_back(p.pose(2));
+	o_weight.push_back(p.weight);
+}
+
+void ParticleSet::Append(const ParticleSet& other)
+{
+	o_x.insert(o_x.end(), other.o_x.begin(), other.o_x.end());
+	o_y.insert(o_y.end(), other.o_y.begin(), other.o_y.end());
+	o_theta.insert(o_theta.end(), other.o_theta.begin(), other.o_theta.end());
+	o_weight.insert(o_weight.end(), other.o_weight.begin(), other.o_weight.end());
+}
+
+void ParticleSet::Swap(ParticleSet& other)
+{
+	o_x.swap(other.o_x);
+	o_y.swap(other.o_y);
+	o_theta.swap(other.o_theta);
+	o_weight.swap(other.o_weight);
+}
+
+void ParticleSet::FillWeights(double w)
+{
+	std::fill(o_weight.begin(), o_weight.end(), w);
+}
+
+void ParticleSet::CopyWeights(std::vector<Particle>& particles) const
+{
+	int n = std::min(int(particles.size()), Size());
+	for(int i = 0; i < n; ++i)
+	{
+		particles[i].weight = o_weight[i];
+	}
+}
+
+std::vector<Particle> ParticleSet::ToVector() const
+{
+	int n = Size();
+	std::vector<Particle> particles(n);
+
+	for(int i = 0; i < n; ++i)
+	{
+		particles[i] = Get(i);
+	}
+
+	return particles;
+}
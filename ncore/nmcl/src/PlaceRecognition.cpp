@@ -15,21 +15,16 @@
 #include <iterator>
 #include <iostream>
 #include <boost/filesystem.hpp>
+#include <nlohmann/json.hpp>
 
-PlaceRecognition::PlaceRecognition(const std::vector<std::string>& dict, const std::string& textMapDir)
+PlaceRecognition::PlaceRecognition(const std::vector<std::string>& dict, const std::string& textMapDir, std::shared_ptr<GMap> map)
 {
-	o_dict = dict;
-
+	setDict(dict);
 	int numWords = dict.size();
-	o_extDict = std::vector<std::vector<std::string>>(numWords);
-	const char delim = ' ';
-	for (int w = 0; w < numWords; ++w)
-	{
-		o_extDict[w] = divideWord(o_dict[w], delim);
-	}	
 
 	o_textBBs.push_back(cv::Rect(0, 0, 0, 0));
 	o_textOrientations.push_back(0.0);
+	o_textRegions.push_back(nullptr);
 
 	for(int i = 1; i < numWords; ++i)
 	{
@@ -55,6 +50,7 @@ PlaceRecognition::PlaceRecognition(const std::vector<std::string>& dict, const s
 			cv::Rect bb = boundingRect(locations);
 			o_textBBs.push_back(bb);
 			o_textOrientations.push_back(avgAngle);
+			o_textRegions.push_back(buildRegion(heatmap, yawmap, locations, map));
 		}
 		else
 		{
@@ -64,11 +60,102 @@ PlaceRecognition::PlaceRecognition(const std::vector<std::string>& dict, const s
 #endif
 			o_textBBs.push_back(cv::Rect(0, 0, 0, 0));
 			o_textOrientations.push_back(0.0);
+			o_textRegions.push_back(nullptr);
 		}
 	}
 }
 
 
+PlaceRecognition::PlaceRecognition(std::shared_ptr<const MapBundle> bundle)
+{
+	if (!bundle->Has("text/info")) throw std::runtime_error("PlaceRecognition| " + bundle->Path() + " has no text maps");
+
+	nlohmann::json info = nlohmann::json::parse(bundle->Text("text/info"));
+	setDict(info["dict"]);
+
+	for (long unsigned int i = 0; i < o_dict.size(); ++i)
+	{
+		const nlohmann::json& entry = info["entries"][i];
+		std::vector<int> bb = entry["bb"];
+		o_textBBs.push_back(cv::Rect(bb[0], bb[1], bb[2], bb[3]));
+		o_textOrientations.push_back(entry["orientation"].get<float>());
+
+		if (!entry.contains("cells"))
+		{
+			o_textRegions.push_back(nullptr);
+			continue;
+		}
+
+		// copied out of the bundle, the regions are shared with the TextData of every relocalization
+		std::string name = "text/" + std::to_string(i) + "/";
+		size_t cells = entry["cells"];
+		std::shared_ptr<TextRegion> region = std::make_shared<TextRegion>();
+		region->resolution = entry["resolution"];
+		const Eigen::Vector2f* positions = bundle->Array<Eigen::Vector2f>(name + "positions", cells);
+		const float* yaws = bundle->Array<float>(name + "yaws", cells);
+		const double* weights = bundle->Array<double>(name + "weights", cells);
+		region->positions.assign(positions, positions + cells);
+		region->yaws.assign(yaws, yaws + cells);
+		region->weights.assign(weights, weights + cells);
+		region->alias = AliasTable(region->weights);
+		o_textRegions.push_back(region);
+	}
+}
+
+
+void PlaceRecognition::Save(MapBundleWriter& writer) const
+{
+	nlohmann::json info;
+	info["dict"] = o_dict;
+	for (long unsigned int i = 0; i < o_dict.size(); ++i)
+	{
+		const cv::Rect& bb = o_textBBs[i];
+		nlohmann::json entry;
+		entry["bb"] = {bb.x, bb.y, bb.width, bb.height};
+		entry["orientation"] = o_textOrientations[i];
+
+		const std::shared_ptr<const TextRegion>& region = o_textRegions[i];
+		if (region)
+		{
+			std::string name = "text/" + std::to_string(i) + "/";
+			entry["cells"] = region->positions.size();
+			entry["resolution"] = region->resolution;
+			writer.Add(name + "positions", region->positions);
+			writer.Add(name + "yaws", region->yaws);
+			writer.Add(name + "weights", region->weights);
+		}
+		info["entries"].push_back(entry);
+	}
+
+	writer.Add("text/info", info.dump());
+}
+
+
+std::shared_ptr<const TextRegion> PlaceRecognition::buildRegion(const cv::Mat& heatmap, const cv::Mat& yawmap, const std::vector<cv::Point2i>& locations, std::shared_ptr<GMap> map) const
+{
+	if (!map) return nullptr;
+
+	std::shared_ptr<TextRegion> region = std::make_shared<TextRegion>();
+	region->resolution = map->Resolution();
+
+	for(const cv::Point2i& loc : locations)
+	{
+		Eigen::Vector2f uv(loc.x, loc.y);
+		if (!map->IsValid2D(uv)) continue;
+
+		float yaw = yawmap.at<uchar>(loc);
+		yaw = 2 * M_PI* (yaw / 255) - M_PI;
+
+		region->positions.push_back(map->Map2World(uv));
+		region->yaws.push_back(yaw);
+		region->weights.push_back(heatmap.at<uchar>(loc));
+	}
+	region->alias = AliasTable(region->weights);
+
+	return region;
+}
+
+
 TextData PlaceRecognition::TextBoundingBoxes(const std::vector<int> matches, std::vector<std::string>& confirmedMatches)
 {
 	int numMatches = matches.size();
@@ -77,6 +164,7 @@ TextData PlaceRecognition::TextBoundingBoxes(const std::vector<int> matches, std
 	std::vector<Eigen::Vector2f> tl;
 	std::vector<Eigen::Vector2f> br;
 	std::vector<float> orientation;
+	std::vector<std::shared_ptr<const TextRegion>> regions;
 
 	for(int i = 0; i < matches.size(); ++i)
 	{
@@ -87,12 +175,13 @@ TextData PlaceRecognition::TextBoundingBoxes(const std::vector<int> matches, std
 			tl.push_back(Eigen::Vector2f(r.x, r.y));
 			br.push_back(Eigen::Vector2f(r.x + r.width, r.y + r.height));
 			orientation.push_back(o_textOrientations[id]);
+			regions.push_back(o_textRegions[id]);
 			//std::cout << "Found " << o_dict[id] << " " << std::endl;
 			confirmedMatches.push_back(o_dict[id]);
 		}
 	}
 
-	TextData textData(tl, br, orientation);
+	TextData textData(tl, br, orientation, regions);
 
 	return textData;
 
@@ -167,6 +256,20 @@ std::vector<int> PlaceRecognition::Match(const std::vector<std::string>& places)
 }
 
 
+void PlaceRecognition::setDict(const std::vector<std::string>& dict)
+{
+	o_dict = dict;
+
+	int numWords = dict.size();
+	o_extDict = std::vector<std::vector<std::string>>(numWords);
+	const char delim = ' ';
+	for (int w = 0; w < numWords; ++w)
+	{
+		o_extDict[w] = divideWord(o_dict[w], delim);
+	}
+}
+
+
 std::vector<std::string> PlaceRecognition::divideWord(const std::string& word, const char delim)
 {
 	std::vector<std::string> tokens;
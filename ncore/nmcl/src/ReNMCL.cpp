@@ -17,7 +17,7 @@
 
 
 ReNMCL::ReNMCL(std::shared_ptr<FloorMap> fm, std::shared_ptr<MixedFSR> mm, std::shared_ptr<BeamEnd> sm, 
-			std::shared_ptr<Resampling> rs, std::shared_ptr<SemanticVisibility> sem, int n, float injectionRatio)
+			std::shared_ptr<Resampling> rs, std::shared_ptr<SemanticVisibility> sem, int n, float injectionRatio, uint64_t seed)
 {
 	o_motionModel = mm;
 	o_beamEndModel = sm;
@@ -27,8 +27,10 @@ ReNMCL::ReNMCL(std::shared_ptr<FloorMap> fm, std::shared_ptr<MixedFSR> mm, std::
 	o_floorMap = fm;
 	o_gmap = o_floorMap->Map();
 
-	o_particleFilter = std::make_shared<ParticleFilter>(ParticleFilter(o_floorMap));
-	o_particleFilter->InitUniform(o_particles, o_numParticles);
+	o_particleFilter = std::make_shared<ParticleFilter>(ParticleFilter(o_floorMap, seed));
+	std::vector<Particle> particles;
+	o_particleFilter->InitUniform(particles, o_numParticles);
+	o_particles = ParticleSet(particles);
 	o_stats = SetStatistics::ComputeParticleSetStatistics(o_particles);
 //	std::string mapFolder = "/home/nickybones/Code/OmniNMCL/ncore/data/floor/SMap/SemMaps/";
 
@@ -40,7 +42,7 @@ ReNMCL::ReNMCL(std::shared_ptr<FloorMap> fm, std::shared_ptr<MixedFSR> mm, std::
 ReNMCL::ReNMCL(std::shared_ptr<FloorMap> fm, std::shared_ptr<MixedFSR> mm, std::shared_ptr<BeamEnd> sm, 
 			std::shared_ptr<Resampling> rs, std::shared_ptr<SemanticVisibility> sem, int n, 
 			std::vector<Eigen::Vector3f> initGuess, std::vector<Eigen::Matrix3d> covariances,
-			float injectionRatio)
+			float injectionRatio, uint64_t seed)
 {
 	o_motionModel = mm;
 	o_beamEndModel = sm;
@@ -50,15 +52,19 @@ ReNMCL::ReNMCL(std::shared_ptr<FloorMap> fm, std::shared_ptr<MixedFSR> mm, std::
 	o_floorMap = fm;
 	o_gmap = o_floorMap->Map();
 	
-	o_particleFilter = std::make_shared<ParticleFilter>(ParticleFilter(o_floorMap));
-	o_particleFilter->InitGaussian(o_particles, o_numParticles, initGuess, covariances);
-	o_stats = o_particleFilter->ComputeStatistics(o_particles);
+	o_particleFilter = std::make_shared<ParticleFilter>(ParticleFilter(o_floorMap, seed));
+	std::vector<Particle> particles;
+	o_particleFilter->InitGaussian(particles, o_numParticles, initGuess, covariances);
+	o_particles = ParticleSet(particles);
+	o_stats = SetStatistics::ComputeParticleSetStatistics(o_particles);
 	o_semanticModel2 = sem;
 }
 
 void ReNMCL::RoomInit(const std::vector<float>& roomProbabilities)
 {
-	o_particleFilter->InitByRoomType(o_particles, o_numParticles, roomProbabilities);
+	std::vector<Particle> particles;
+	o_particleFilter->InitByRoomType(particles, o_numParticles, roomProbabilities);
+	o_particles = ParticleSet(particles);
 }
 
 void ReNMCL::CorrectSemantic(std::shared_ptr<SemanticData> data)
@@ -66,9 +72,7 @@ void ReNMCL::CorrectSemantic(std::shared_ptr<SemanticData> data)
 	//o_semanticModel->ComputeWeights(o_particles, data);
 	o_semanticModel2->ComputeWeights(o_particles, data);
 
-	o_particleFilter->NormalizeWeights(o_particles);
-	o_resampler->Resample(o_particles);
-	o_stats = SetStatistics::ComputeParticleSetStatistics(o_particles);
+	update();
 }
 
 
@@ -100,109 +104,127 @@ void ReNMCL::Predict(const std::vector<Eigen::Vector3f>& u, const std::vector<fl
 
 void ReNMCL::predictUniform(const std::vector<Eigen::Vector3f>& u, const std::vector<float>& odomWeights, const Eigen::Vector3f& noise)
 {
-	for(int i = 0; i < o_numParticles; ++i)
-	{
-		Eigen::Vector3f pose = o_motionModel->SampleMotion(o_particles[i].pose, u, odomWeights, noise);
-		o_particles[i].pose = pose;
-	
-		//particle pruning - if particle is outside the map, we replace it
-		while (!o_gmap->IsValid(o_particles[i].pose))
-		{
-			std::vector<Particle> new_particle;
-			o_particleFilter->InitUniform(new_particle, 1);
-			new_particle[0].weight = 1.0 / o_numParticles;
-			o_particles[i] = new_particle[0];
-		}
-	}
+	o_motionModel->SampleMotion(o_particles, u, odomWeights, noise);
+
+	//particle pruning - if particle is outside the map, we replace it
+	std::vector<int> invalid = invalidParticles();
+	o_particleFilter->ReplaceUniform(o_particles, invalid, 1.0 / o_particles.Size());
 }
 
 void ReNMCL::predictRoom(const std::vector<Eigen::Vector3f>& u, const std::vector<float>& odomWeights, const Eigen::Vector3f& noise)
 {
-	for(int i = 0; i < o_numParticles; ++i)
-	{
-		Eigen::Vector3f pose = o_motionModel->SampleMotion(o_particles[i].pose, u, odomWeights, noise);
-		o_particles[i].pose = pose;
-	
-		//particle pruning - if particle is outside the map, we replace it
-		while (!o_gmap->IsValid(o_particles[i].pose))
-		{
-			std::vector<Particle> new_particle;
-			o_particleFilter->InitByRoomType(new_particle, 1, o_roomProbabilities);
-			new_particle[0].weight = 1.0 / o_numParticles;
-			o_particles[i] = new_particle[0];
-		}
-	}
+	o_motionModel->SampleMotion(o_particles, u, odomWeights, noise);
+
+	//particle pruning - if particle is outside the map, we replace it
+	std::vector<int> invalid = invalidParticles();
+	o_particleFilter->ReplaceByRoomType(o_particles, invalid, o_roomProbabilities, 1.0 / o_particles.Size());
 }
 
 void ReNMCL::predictGaussian(const std::vector<Eigen::Vector3f>& u, const std::vector<float>& odomWeights, const Eigen::Vector3f& noise)
 {
 	Eigen::Matrix3d cov;
 	cov << 1.0, 0, 0, 0, 1.0, 0, 0, 0, 1.0;
-	std::vector<Eigen::Matrix3d> covariances{cov};
 	Eigen::Vector3d mean = o_stats.Mean();
-	std::vector<Eigen::Vector3f> initGuesses{Eigen::Vector3f(mean(0), mean(1), mean(2))};
+	Eigen::Vector3f initGuess(mean(0), mean(1), mean(2));
 
-	for(int i = 0; i < o_numParticles; ++i)
-	{
-		Eigen::Vector3f pose = o_motionModel->SampleMotion(o_particles[i].pose, u, odomWeights, noise);
-		o_particles[i].pose = pose;
-		//particle pruning - if particle is outside the map, we replace it
-		while (!o_gmap->IsValid(o_particles[i].pose))
-		{
-			std::vector<Particle> new_particle;
-			o_particleFilter->InitGaussian(new_particle, 1, initGuesses, covariances);
-			new_particle[0].weight = 1.0 / o_numParticles;
-			o_particles[i] = new_particle[0];
-		}
-	}	
+	o_motionModel->SampleMotion(o_particles, u, odomWeights, noise);
+
+	//particle pruning - if particle is outside the map, we replace it
+	std::vector<int> invalid = invalidParticles();
+	o_particleFilter->ReplaceGaussian(o_particles, invalid, initGuess, cov, 1.0 / o_particles.Size());	
 }
 
 void ReNMCL::predictGiorgio(const std::vector<Eigen::Vector3f>& u, const std::vector<float>& odomWeights, const Eigen::Vector3f& noise)
 {
-	for(int i = 0; i < o_numParticles; ++i)
+	o_motionModel->SampleMotion(o_particles, u, odomWeights, noise);
+}
+
+std::vector<int> ReNMCL::invalidParticles() const
+{
+	int n = o_particles.Size();
+	std::vector<char> mask(n);
+	// the occupancy shares its cache lines with the likelihood and room layers, see FloorMap::Raster
+	const TiledMap& raster = *o_floorMap->Raster();
+
+	#pragma omp parallel for 
+	for(int i = 0; i < n; ++i)
 	{
-		Eigen::Vector3f pose = o_motionModel->SampleMotion(o_particles[i].pose, u, odomWeights, noise);
-		o_particles[i].pose = pose;
+		Eigen::Vector3f pose = o_particles.Pose(i);
+		mask[i] = !raster.IsValid(pose(0), pose(1));
 	}
+
+	std::vector<int> invalid;
+	for(int i = 0; i < n; ++i)
+	{
+		if (mask[i]) invalid.push_back(i);
+	}
+
+	return invalid;
 }
 
 void ReNMCL::Correct(std::shared_ptr<LidarData> data)
 {
 	o_beamEndModel->ComputeWeights(o_particles, data);
 
-	o_particleFilter->NormalizeWeights(o_particles);
-	o_resampler->Resample(o_particles);
+	update();
+}
+
+void ReNMCL::update()
+{
+	// one sweep gives the weight sum, the ESS and the pose statistics of the weighted set
 	o_stats = SetStatistics::ComputeParticleSetStatistics(o_particles);
 
+	if (!o_resampler->Resample(o_particles, o_stats))
+	{
+		o_particleFilter->NormalizeWeights(o_particles, o_stats.SumWeights());
+	}
 }
 
 
 void ReNMCL::Recover()
 {
-	o_particleFilter->InitUniform(o_particles, o_numParticles);
+	std::vector<Particle> particles;
+	o_particleFilter->InitUniform(particles, o_numParticles);
+	o_particles = ParticleSet(particles);
 }
 
 
 void ReNMCL::Relocalize(const std::vector<Eigen::Vector2f>& br, const std::vector<Eigen::Vector2f>& tl, const std::vector<float>& orientations, float camAngle)
 {
+	TextData textData(tl, br, orientations);
+	Relocalize(textData, camAngle);
+}
+
+void ReNMCL::Relocalize(const TextData& textData, float camAngle)
+{
+	std::vector<Eigen::Vector2f> tl = textData.TopLeft();
+	std::vector<Eigen::Vector2f> br = textData.BottomRight();
+	std::vector<float> orientations = textData.Orientation();
+	const std::vector<std::shared_ptr<const TextRegion>>& regions = textData.Regions();
 	int numMatches = tl.size();
 
 	if(numMatches)
 	{	
-		int numInject = int(o_numParticles * o_injectionRatio);
+		int numInject = int(o_particles.Size() * o_injectionRatio);
 		int perInject = int(numInject) / numMatches;
 		int numRemove = perInject * numMatches;
-		int numKeep = o_numParticles - perInject * numMatches;
 
-		o_particleFilter->RemoveWeakest(o_particles, numRemove);
+		// the weakest particles are overwritten in place by the injected ones
+		std::vector<int> weakest = o_particleFilter->Weakest(o_particles, numRemove);
 
-		std::vector<float> yaw;
 		for(int i = 0; i < numMatches; ++i)
 		{
-			yaw.push_back(orientations[i] - camAngle);
+			std::vector<int> ids(weakest.begin() + i * perInject, weakest.begin() + (i + 1) * perInject);
+
+			if ((i < int(regions.size())) && regions[i] && !regions[i]->Empty())
+			{
+				o_particleFilter->ReplaceTextRegion(o_particles, ids, *regions[i], -camAngle, 1.0 / perInject);
+			}
+			else
+			{
+				o_particleFilter->ReplaceBoundingBox(o_particles, ids, tl[i], br[i], orientations[i] - camAngle, 1.0 / perInject);
+			}
 		}
-
-		o_particleFilter->AddBoundingBox(o_particles ,perInject, tl, br, yaw);
 	}
 }
 
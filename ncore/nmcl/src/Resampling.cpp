@@ -14,38 +14,300 @@
 
 #include <numeric>
 #include <functional> 
+#include <algorithm>
+#include <cmath>
 
-void Resampling::Resample(std::vector<Particle>& particles)
+void Resampling::Resample(ParticleSet& particles)
 {
-	int n_particles = particles.size();
-	std::vector<double> transWeights(n_particles);
-	std::vector<Particle> new_particles(n_particles);
+	int n_particles = particles.Size();
+	if (n_particles == 0) return;
+
+	const double* weights = particles.Weight();
+	int numBlocks = (n_particles + blockSize - 1) / blockSize;
+	o_blockSums.resize(2 * numBlocks);
 
+	// fixed blocks keep the sums identical for any number of threads
+	#pragma omp parallel for schedule(static)
+	for(int b = 0; b < numBlocks; ++b)
+	{
+		int end = std::min(n_particles, (b + 1) * blockSize);
+		double sum = 0;
+		double sq = 0;
+		for(int i = b * blockSize; i < end; ++i)
+		{
+			sum += weights[i];
+			sq += weights[i] * weights[i];
+		}
+		o_blockSums[2 * b] = sum;
+		o_blockSums[2 * b + 1] = sq;
+	}
 
-	std::transform(particles.begin(), particles.end(), transWeights.begin(), [](Particle &p){ return p.weight * p.weight; });
-	double sumWeights = std::accumulate(transWeights.begin(), transWeights.end(), 0.0);
+	double sumWeights = 0;
+	double sumSquares = 0;
+	for(int b = 0; b < numBlocks; ++b)
+	{
+		sumWeights += o_blockSums[2 * b];
+		sumSquares += o_blockSums[2 * b + 1];
+	}
 	
-	double effN = 1.0 / sumWeights;
+	double effN = sumWeights * sumWeights / sumSquares;
 
 	if (effN < o_th * n_particles)
 	{
-		double unitW = 1.0 / n_particles;
-		//std::cout << "resample" << std::endl;
-		double r = drand48() * 1.0 / n_particles;
-		double acc = particles[0].weight;
-		int i = 0;
+		resample(particles);
+	}
+}
+
+bool Resampling::Resample(ParticleSet& particles, const SetStatistics& stats)
+{
+	int n_particles = particles.Size();
+	if ((n_particles == 0) || (stats.SumWeights() <= 0)) return false;
+
+	if (stats.ESS() < o_th * n_particles)
+	{
+		resample(particles);
+		return true;
+	}
+
+	return false;
+}
+
+void Resampling::resample(ParticleSet& particles)
+{
+	int n_particles = particles.Size();
+	const double* weights = particles.Weight();
+
+	//std::cout << "resample" << std::endl;
+	o_rng.Advance();
+	RandomStream stream = o_rng.Stream(0);
+	double u = stream.Uniform();
+
+	double total = prefixSum(weights, n_particles);
+	if (total <= 0) return;
+
+	int n_new = n_particles;
+	if (o_kld) n_new = kldSize(particles, u);
+
+	o_buffer.Resize(n_new);
+
+	switch(o_algorithm) 
+	{
+	    case Algorithm::SYSTEMATIC : 
+	    	systematic(particles, 0, n_new, u);
+	    	break;
+	    case Algorithm::STRATIFIED : 
+	    	stratified(particles, n_new);
+	    	break;
+	    case Algorithm::RESIDUAL : 
+	    	residual(particles, n_new, u);
+	    	break;
+	}
+
+	o_buffer.FillWeights(1.0 / n_new);
+	particles.Swap(o_buffer);
+}
+
+double Resampling::prefixSum(const double* values, int n)
+{
+	int numBlocks = (n + blockSize - 1) / blockSize;
+	o_cumsum.resize(n);
+	o_blockSums.resize(numBlocks);
+
+	#pragma omp parallel for schedule(static)
+	for(int b = 0; b < numBlocks; ++b)
+	{
+		int end = std::min(n, (b + 1) * blockSize);
+		double acc = 0;
+		for(int i = b * blockSize; i < end; ++i)
+		{
+			acc += values[i];
+			o_cumsum[i] = acc;
+		}
+		o_blockSums[b] = acc;
+	}
+
+	double offset = 0;
+	for(int b = 0; b < numBlocks; ++b)
+	{
+		double sum = o_blockSums[b];
+		o_blockSums[b] = offset;
+		offset += sum;
+	}
+
+	#pragma omp parallel for schedule(static)
+	for(int b = 1; b < numBlocks; ++b)
+	{
+		int end = std::min(n, (b + 1) * blockSize);
+		double blockOffset = o_blockSums[b];
+		for(int i = b * blockSize; i < end; ++i)
+		{
+			o_cumsum[i] += blockOffset;
+		}
+	}
+
+	return o_cumsum[n - 1];
+}
+
+void Resampling::systematic(const ParticleSet& particles, int offset, int n_new, double u)
+{
+	int n_particles = particles.Size();
+	int numBlocks = (n_new + blockSize - 1) / blockSize;
+	double step = o_cumsum[n_particles - 1] / n_new;
+	const double* cumsum = o_cumsum.data();
+
+	#pragma omp parallel for schedule(static)
+	for(int b = 0; b < numBlocks; ++b)
+	{
+		int end = std::min(n_new, (b + 1) * blockSize);
+		int j = b * blockSize;
+		double U = (u + j) * step;
+		int i = std::lower_bound(cumsum, cumsum + n_particles, U) - cumsum;
 
-		for(int j = 0; j < n_particles; ++j)
+		for(; j < end; ++j)
 		{
-			double U = r + j * 1.0 / n_particles;
-			while((U > acc) && (i < n_particles))
-			{
-				++i;
-				acc += particles[i].weight;
-			}
-			particles[i].weight = unitW;
-			new_particles[j] = particles[i];
+			U = (u + j) * step;
+			while((U > cumsum[i]) && (i < n_particles - 1)) ++i;
+			i = std::min(i, n_particles - 1);
+			o_buffer.Copy(offset + j, particles, i);
 		}
-		particles = new_particles;
 	}
-}
\ No newline at end of file
+}
+
+void Resampling::stratified(const ParticleSet& particles, int n_new)
+{
+	int n_particles = particles.Size();
+	int numBlocks = (n_new + blockSize - 1) / blockSize;
+	double step = o_cumsum[n_particles - 1] / n_new;
+	const double* cumsum = o_cumsum.data();
+
+	#pragma omp parallel for schedule(static)
+	for(int b = 0; b < numBlocks; ++b)
+	{
+		// stream 0 is used for the comb offset, so the blocks draw from 1 on
+		RandomStream stream = o_rng.Stream(b + 1);
+		int end = std::min(n_new, (b + 1) * blockSize);
+		int j = b * blockSize;
+		double U = j * step;
+		int i = std::lower_bound(cumsum, cumsum + n_particles, U) - cumsum;
+
+		for(; j < end; ++j)
+		{
+			U = (stream.Uniform() + j) * step;
+			while((U > cumsum[i]) && (i < n_particles - 1)) ++i;
+			i = std::min(i, n_particles - 1);
+			o_buffer.Copy(j, particles, i);
+		}
+	}
+}
+
+void Resampling::residual(const ParticleSet& particles, int n_new, double u)
+{
+	int n_particles = particles.Size();
+	const double* weights = particles.Weight();
+	double scale = n_new / o_cumsum[n_particles - 1];
+
+	o_counts.resize(n_particles);
+	o_residuals.resize(n_particles);
+
+	#pragma omp parallel for schedule(static)
+	for(int i = 0; i < n_particles; ++i)
+	{
+		double expected = weights[i] * scale;
+		double copies = std::floor(expected);
+		o_counts[i] = int(copies);
+		o_residuals[i] = expected - copies;
+	}
+
+	// offsets of the deterministic copies, the counts are small so a sequential scan is cheap next to the copies
+	int numCopies = 0;
+	for(int i = 0; i < n_particles; ++i)
+	{
+		int c = o_counts[i];
+		o_counts[i] = numCopies;
+		numCopies += c;
+	}
+	numCopies = std::min(numCopies, n_new);
+
+	#pragma omp parallel for schedule(static)
+	for(int i = 0; i < n_particles; ++i)
+	{
+		int end = (i + 1 < n_particles) ? o_counts[i + 1] : numCopies;
+		end = std::min(end, numCopies);
+		for(int j = o_counts[i]; j < end; ++j)
+		{
+			o_buffer.Copy(j, particles, i);
+		}
+	}
+
+	int n_rest = n_new - numCopies;
+	if (n_rest <= 0) return;
+
+	if (prefixSum(o_residuals.data(), n_particles) <= 0)
+	{
+		prefixSum(weights, n_particles);
+	}
+	systematic(particles, numCopies, n_rest, u);
+}
+
+void Resampling::Resample(std::vector<Particle>& particles)
+{
+	ParticleSet set(particles);
+	Resample(set);
+	particles = set.ToVector();
+}
+
+void Resampling::SetKLD(int minParticles, int maxParticles, float epsilon, float z, const Eigen::Vector3f& binSize)
+{
+	o_kld = true;
+	o_minParticles = std::max(1, minParticles);
+	o_maxParticles = std::max(o_minParticles, maxParticles);
+	o_epsilon = epsilon;
+	o_z = z;
+	o_binSize = binSize;
+	o_bins.reserve(o_maxParticles);
+}
+
+int Resampling::kldBound(int k) const
+{
+	if (k <= 1) return o_minParticles;
+
+	// Wilson-Hilferty approximation of the chi-square quantile, as in Fox, "KLD-Sampling", 2001
+	double a = 2.0 / (9.0 * (k - 1));
+	double b = 1.0 - a + std::sqrt(a) * o_z;
+	double n = std::ceil((k - 1) / (2.0 * o_epsilon) * b * b * b);
+
+	return int(std::min(std::max(n, double(o_minParticles)), double(o_maxParticles)));
+}
+
+int Resampling::kldSize(const ParticleSet& particles, double u)
+{
+	int n_particles = particles.Size();
+	const float* x = particles.X();
+	const float* y = particles.Y();
+	const float* theta = particles.Theta();
+
+	// the bins a resample of maxParticles would occupy, particles hit by several teeth are counted once
+	o_bins.clear();
+	double step = o_cumsum[n_particles - 1] / o_maxParticles;
+	int i = 0;
+	int last = -1;
+
+	for(int j = 0; j < o_maxParticles; ++j)
+	{
+		double U = (u + j) * step;
+		while((U > o_cumsum[i]) && (i < n_particles - 1)) ++i;
+		if (i == last) continue;
+		last = i;
+
+		double t = theta[i] - 2 * M_PI * std::floor((theta[i] + M_PI) / (2 * M_PI));
+		uint64_t bx = uint64_t(int64_t(std::floor(x[i] / o_binSize(0))) + (1 << 20)) & 0x1FFFFF;
+		uint64_t by = uint64_t(int64_t(std::floor(y[i] / o_binSize(1))) + (1 << 20)) & 0x1FFFFF;
+		uint64_t bt = uint64_t(int64_t(std::floor(t / o_binSize(2))) + (1 << 20)) & 0x1FFFFF;
+		o_bins.push_back((bx << 42) | (by << 21) | bt);
+	}
+
+	std::sort(o_bins.begin(), o_bins.end());
+	int k = std::unique(o_bins.begin(), o_bins.end()) - o_bins.begin();
+
+	return kldBound(k);
+}
@@ -15,147 +15,243 @@
 #include <math.h>
 #include <stdlib.h>
 #include <iostream>
+#include <set>
+#include <algorithm>
 #include "SemanticData.h"
 
 
-SemanticLikelihood::SemanticLikelihood(std::shared_ptr<FloorMap> floorMap, const std::string& semMapDir, float sigma, float maxRange)
+SemanticLikelihood::SemanticLikelihood(std::shared_ptr<FloorMap> floorMap, const std::string& semMapDir, float sigma, float maxRange, int occlusionBins, int detectionRange)
 {
 	o_floorMap = floorMap;
 	o_gmap = o_floorMap->Map();
 
 	o_maxRange = maxRange;
+	o_sigma = sigma;
 	o_coeff = 1.0 / sqrt(2 * M_PI * sigma);
+	o_occlusionBins = std::max(occlusionBins, 1);
+	o_detectionRange = std::min(std::max(detectionRange, 1), 0xFFFF);
+
+	o_logLikelihood = std::vector<float>(256);
+	for(int q = 0; q < 256; ++q)
+	{
+		o_logLikelihood[q] = log(getLikelihood(q * o_maxRange / 255.0));
+	}
 
 	createEDT(maxRange, semMapDir);
+	createOcclusion();
 }
 
 
 void SemanticLikelihood::createEDT(float maxRange, const std::string& semMapDir)
 {
-	o_distMaps = std::vector<cv::Mat>(1);
+	// only the known part of the map can hold objects or particles
+	o_crop = o_gmap->Crop();
+	const std::vector<std::string>& classes = o_floorMap->Classes();
+	o_numClasses = classes.size();
+	int numCells = o_crop.area();
+	o_distances = std::vector<uint8_t>(o_numClasses * numCells, 255);
+
+	// room id per pixel of the crop
+	std::shared_ptr<TiledMap> raster = o_floorMap->Raster();
+	cv::Mat rooms(o_crop.size(), CV_8UC1);
+	for(int v = 0; v < o_crop.height; ++v)
+	{
+		for(int u = 0; u < o_crop.width; ++u)
+		{
+			rooms.at<uchar>(v, u) = raster->Cell(u + o_crop.x, v + o_crop.y).room;
+		}
+	}
 
-	for (int c = 0; c < o_distMaps.size(); ++c )
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int c = 0; c < o_numClasses; ++c)
 	{
 		//load class block image
-		cv::Mat objLoc = cv::imread(semMapDir + "Sink.png", 0);
-		cv::Mat edt(objLoc.size(), CV_32F, cv::Scalar(255)); 
+		cv::Mat objLoc = cv::imread(semMapDir + classes[c] + ".png", 0);
+		if (objLoc.empty())
+		{
+			std::cout << "SemanticLikelihood| no map for class " << classes[c] << std::endl;
+			continue;
+		}
+		objLoc = objLoc(o_crop);
 
-		int roomNum = o_floorMap->GetRoomsNum();
-		for(int r = 0; r < roomNum; ++r)
+		// the rooms that contain the class, the distance field of each only counts the objects inside it
+		std::set<int> roomIDs;
+		for(int v = 0; v < o_crop.height; ++v)
 		{
-			Room room = o_floorMap->GetRoom(r);
-			std::vector<Object> objects = room.Objects();
-			std::vector<Object>::iterator iter = std::find_if(objects.begin(), objects.end(), [c](const auto& o){ return o.SemLabel() == c; } );
-			if (iter != objects.end())
+			for(int u = 0; u < o_crop.width; ++u)
 			{
-				std::cout << "Room" + std::to_string(r) + ".png" << std::endl;
-				cv::Mat room = cv::imread(semMapDir + "Room" + std::to_string(r) + ".png", 0);
-				cv::Mat roomObjLoc;
-				objLoc.copyTo(roomObjLoc, room);
-				cv::Mat roomedt;
-				cv::threshold(roomObjLoc, roomedt, 127, 255, 0);
-				cv::distanceTransform(255 - roomedt, roomedt, cv::DIST_L2, cv::DIST_MASK_3);
-				roomedt.copyTo(edt, room);
+				if (objLoc.at<uchar>(v, u) > 127) roomIDs.insert(rooms.at<uchar>(v, u));
 			}
-		} 
-		cv::imwrite(semMapDir + "sem_edt.png", edt);
-		cv::threshold(edt, edt, maxRange, maxRange, 2); //Threshold Truncated
-		o_distMaps[c] = edt;
+		}
+
+		uint8_t* plane = o_distances.data() + c * numCells;
+		for(int r : roomIDs)
+		{
+			cv::Mat room = (rooms == r);
+			cv::Mat roomObjLoc = cv::Mat::zeros(o_crop.size(), CV_8UC1);
+			objLoc.copyTo(roomObjLoc, room);
+			cv::Mat roomedt;
+			cv::threshold(roomObjLoc, roomedt, 127, 255, 0);
+			cv::distanceTransform(255 - roomedt, roomedt, cv::DIST_L2, cv::DIST_MASK_3);
+
+			for(int v = 0; v < o_crop.height; ++v)
+			{
+				for(int u = 0; u < o_crop.width; ++u)
+				{
+					if (!room.at<uchar>(v, u)) continue;
+					float dist = std::min(roomedt.at<float>(v, u), maxRange);
+					plane[v * o_crop.width + u] = uint8_t(round(dist / maxRange * 255.0));
+				}
+			}
+		}
 	}
 }
 
 
-void SemanticLikelihood::ComputeWeights(std::vector<Particle>& particles, std::shared_ptr<SemanticData> data)
+void SemanticLikelihood::createOcclusion()
 {
-	const std::vector<Eigen::Vector2f>& poses = data->Pos();
-	const std::vector<int>& labels = data->Label();
+	int numCells = o_crop.area();
+	o_freeID = std::vector<int>(numCells, -1);
+	int numFree = 0;
+	for(int v = 0; v < o_crop.height; ++v)
+	{
+		for(int u = 0; u < o_crop.width; ++u)
+		{
+			if (o_gmap->IsValid2D(Eigen::Vector2f(u + o_crop.x, v + o_crop.y))) o_freeID[v * o_crop.width + u] = numFree++;
+		}
+	}
 
-	Eigen::Vector2f br = o_gmap->BottomRight();
+	std::vector<Eigen::Vector2f> dirs(o_occlusionBins);
+	for(int b = 0; b < o_occlusionBins; ++b)
+	{
+		float angle = 2.0 * b * M_PI / float(o_occlusionBins);
+		dirs[b] = Eigen::Vector2f(cos(angle), sin(angle));
+	}
 
+	// march from every free cell in every direction until the first cell that isn't free, like the old sampled test did per particle.
+	// The rays stop at the detection range, so the cost is bounded by free cells x directions x range
+	o_freeRange = std::vector<uint16_t>(numFree * o_occlusionBins, 0);
+	const cv::Mat& grid = o_gmap->Map();
+	#pragma omp parallel for schedule(dynamic, 4)
+	for(int v = 0; v < o_crop.height; ++v)
+	{
+		for(int u = 0; u < o_crop.width; ++u)
+		{
+			int id = o_freeID[v * o_crop.width + u];
+			if (id < 0) continue;
 
-	Eigen::Vector2f semPos = poses[0];
-	int semClass = labels[0];
-	Eigen::Vector3f scan(semPos(0), -semPos(1), 1);
+			for(int b = 0; b < o_occlusionBins; ++b)
+			{
+				float x = u + o_crop.x;
+				float y = v + o_crop.y;
+				int range = 0;
+				while (range < o_detectionRange)
+				{
+					x += dirs[b](0);
+					y += dirs[b](1);
+					++range;
+					int iu = int(x) - o_crop.x;
+					int iv = int(y) - o_crop.y;
+					if ((x < 0) || (y < 0) || (iu < 0) || (iv < 0) || (iu >= o_crop.width) || (iv >= o_crop.height)) break;
+					if (grid.at<uchar>(int(y), int(x)) > 1) break;
+				}
+				o_freeRange[id * o_occlusionBins + b] = range;
+			}
+		}
+	}
+}
 
 
-	for(long unsigned int i = 0; i < particles.size(); ++i)
-	{
-		double w = 0;
+int SemanticLikelihood::cellID(int u, int v) const
+{
+	u -= o_crop.x;
+	v -= o_crop.y;
+	if ((u < 0) || (v < 0) || (u >= o_crop.width) || (v >= o_crop.height)) return -1;
 
-		Eigen::Vector2f mp =scan2Map(particles[i].pose, scan);
-		//std::cout << mp(0) << ", " << mp(1) << std::endl;
+	return v * o_crop.width + u;
+}
 
 
-		if ((mp(0) < 0) || (mp(1) < 0) || (mp(0) > br(0)) || (mp(1) > br(1)))
-		{
-				w = getLikelihood(o_maxRange);
-		}
-		else if (isOccluded(particles[i].pose, mp))
-		{
-			w = getLikelihood(o_maxRange);
-			//std::cout << "occluded" << std::endl;
-		}
-		else
-		{
-			float dist = o_distMaps[semClass].at<float>(mp(1) ,mp(0));
-			w = getLikelihood(dist);
-			//std::cout << mp(0) << ", " << mp(1) << std::endl;
-			//std::cout << dist << std::endl;
-		}
+float SemanticLikelihood::Distance(int label, int u, int v) const
+{
+	int cID = cellID(u, v);
+	if ((cID < 0) || (label < 0) || (label >= o_numClasses)) return o_maxRange;
 
-		particles[i].weight = w;
-		//std::cout << w << std::endl;
-	}
+	return o_distances[label * o_crop.area() + cID] * o_maxRange / 255.0;
 }
 
-bool SemanticLikelihood::isOccluded(Eigen::Vector3f pose, Eigen::Vector2f sUV)
+
+bool SemanticLikelihood::IsOccluded(const Eigen::Vector2f& pUV, const Eigen::Vector2f& sUV) const
 {
-	//bool occluded = false;
+	int cID = cellID(pUV(0), pUV(1));
+	// particles in walls or off the map see nothing
+	if ((cID < 0) || (o_freeID[cID] < 0)) return true;
 
-	Eigen::Vector2f pUV = o_gmap->World2Map(Eigen::Vector2f(pose(0), pose(1)));
 	Eigen::Vector2f dir = sUV - pUV;
-	int numSteps = 10;
-		
-	for(int i = 1; i < numSteps; ++i)
+	float dist = dir.norm();
+	if (dist < 1) return false;
+	if (dist > o_detectionRange) return true;
+
+	int b = int(lround(atan2(dir(1), dir(0)) * o_occlusionBins / (2.0 * M_PI)));
+	b = (b % o_occlusionBins + o_occlusionBins) % o_occlusionBins;
+
+	return dist > o_freeRange[o_freeID[cID] * o_occlusionBins + b];
+}
+
+
+void SemanticLikelihood::ComputeWeights(std::vector<Particle>& particles, std::shared_ptr<SemanticData> data)
+{
+	const std::vector<Eigen::Vector2f>& poses = data->Pos();
+	const std::vector<int>& labels = data->Label();
+
+	Eigen::Vector2f br = o_gmap->BottomRight();
+
+	// the detections of known classes, as homogeneous points in base_link
+	std::vector<Eigen::Vector3f> scans;
+	std::vector<int> classes;
+	for (long unsigned int d = 0; d < labels.size(); ++d)
 	{
-		Eigen::Vector2f pnt = pUV + (1.0/float(numSteps)) * i * dir;
-		int val = o_gmap->Map().at<uchar>(int(pnt(1)) ,int(pnt(0)));
-	  	if (val > 1) return true;	
+		if ((labels[d] < 0) || (labels[d] >= o_numClasses)) continue;
+		scans.push_back(Eigen::Vector3f(poses[d](0), -poses[d](1), 1));
+		classes.push_back(labels[d]);
 	}
-/*
-	int x1 = pUV(0);
-	int y1 = pUV(1);
-	int x2 = sUV(0);
-	int y2 = sUV(1);
-
-	int m_new = 2 * (y2 - y1);
-	int slope_error_new = m_new - (x2 - x1);
-	for (int x = x1, y = y1; x <= x2; x++)
+	int numDetections = scans.size();
+	int numCells = o_crop.area();
+	float missing = o_logLikelihood[255];
+
+	#pragma omp parallel for
+	for(long unsigned int i = 0; i < particles.size(); ++i)
 	{
-	  //cout << "(" << x << "," << y << ")\n";
-
-	  // Add slope to increment angle formed
-	  slope_error_new += m_new;
-
-	  // Slope error reached limit, time to
-	  // increment y and update slope error.
-	  if (slope_error_new >= 0)
-	  {
-	     y++;
-	     slope_error_new  -= 2 * (x2 - x1);
-	  }
-	  //line.append(Eigen::Vector2f(x, y));
-	  Eigen::Vector2f pnt(x, y);
-	  int val = o_gmap->Map().at<uchar>(pnt(1) ,pnt(0));
-	  if (val > 1) return true;
+		Eigen::Matrix3f trans = Vec2Trans(particles[i].pose);
+		Eigen::Vector2f pUV = o_gmap->World2Map(Eigen::Vector2f(particles[i].pose(0), particles[i].pose(1)));
+		float logW = 0;
+
+		for(int d = 0; d < numDetections; ++d)
+		{
+			Eigen::Vector3f ts = trans * scans[d];
+			Eigen::Vector2f mp = o_gmap->World2Map(Eigen::Vector2f(ts(0), ts(1)));
+			int cID = cellID(mp(0), mp(1));
+
+			if ((mp(0) < 0) || (mp(1) < 0) || (mp(0) > br(0)) || (mp(1) > br(1)) || (cID < 0))
+			{
+				logW += missing;
+			}
+			else if (IsOccluded(pUV, mp))
+			{
+				logW += missing;
+			}
+			else
+			{
+				logW += o_logLikelihood[o_distances[classes[d] * numCells + cID]];
+			}
+		}
+
+		particles[i].weight = exp(logW);
 	}
-*/
-	return false;
 }
 
 
 
-
 float SemanticLikelihood::getLikelihood(float distance)
 {
 	float l = o_coeff * exp(-0.5 * pow(distance / o_sigma, 2));
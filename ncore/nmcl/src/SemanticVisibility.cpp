@@ -13,25 +13,24 @@
 #include "SemanticVisibility.h"
 #include "Utils.h"
 #include "math.h"
+#include <stdexcept>
+#include <limits>
+#include <nlohmann/json.hpp>
 
 SemanticVisibility::SemanticVisibility(std::shared_ptr<GMap> Gmap, int beams, const std::string& semMapDir, const std::vector<std::string>& classNames, const std::vector<float>& confidences)
 {
 	o_gmap = Gmap;
-	o_mapSize = o_gmap->Map().size();
+	setup(beams);
+	int numCells = o_crop.width * o_crop.height;
 
-	o_visibilityMap = std::vector<std::map<int, std::vector<Eigen::Vector2f>>>(o_mapSize.width * o_mapSize.height);
+	std::vector<cv::Mat> classMaps;
+	std::vector<cv::Mat> debugMaps;
 
-	std::vector<Eigen::Vector2f> unitCircle(beams);
-	for(int i = 0; i < beams; ++i)
+	if (classNames.size() > 32)
 	{
-		float angle = 2.0 * i * M_PI / float(beams);
-		unitCircle[i] = Eigen::Vector2f(cos(angle), sin(angle));
-		//std::cout << unitCircle[i](0) << ", " << unitCircle[i](1) << std::endl;
+		throw std::runtime_error("SemanticVisibility| at most 32 classes are supported");
 	}
 
-	std::vector<cv::Mat> classMaps;
-	std::vector<cv::Mat> debugMaps;
-
 	o_confidenceTH = confidences;
 	for(int i = 0; i < classNames.size(); ++i)
 	{
@@ -48,44 +47,73 @@ SemanticVisibility::SemanticVisibility(std::shared_ptr<GMap> Gmap, int beams, co
 
 	o_classConsistency = std::vector<Eigen::Vector2f>(classNames.size(), Eigen::Vector2f(0, 0));
 
-	//for each free (!) image pixel 
-	#pragma omp parallel for 
-	for (long unsigned int row = 0; row < o_mapSize.height; ++row)
+	std::shared_ptr<VisibilityMap> vis = std::make_shared<VisibilityMap>();
+	vis->classMaskData = std::vector<uint32_t>(numCells, 0);
+	// the beam masks of each row, in cell and then class order. Concatenated into the CSR storage below
+	std::vector<std::vector<uint64_t>> rowMasks(o_crop.height);
+
+	// In o_region the validity and the classes of all maps are flattened into one byte and one bitmask per pixel, so a ray is marched once for all classes
+	o_valid = std::vector<uint8_t>(o_region.area(), 0);
+	o_classBits = std::vector<uint32_t>(o_region.area(), 0);
+	#pragma omp parallel for
+	for (int v = o_region.y; v < o_region.y + o_region.height; ++v)
+	{
+		int offset = (v - o_region.y) * o_region.width - o_region.x;
+		const uchar* grid = o_gmap->Map().ptr<uchar>(v);
+		for (int u = o_region.x; u < o_region.x + o_region.width; ++u)
+		{
+			o_valid[offset + u] = (u <= o_br(0)) && (v <= o_br(1)) && (grid[u] <= 1);
+		}
+		for (long unsigned int c = 0; c < classMaps.size(); ++c)
+		{
+			const uchar* cls = classMaps[c].ptr<uchar>(v);
+			for (int u = o_region.x; u < o_region.x + o_region.width; ++u)
+			{
+				if (cls[u]) o_classBits[offset + u] |= uint32_t(1) << c;
+			}
+		}
+	}
+
+	//for each free (!) image pixel. Rows differ a lot in their number of free cells, so they are handed out dynamically
+	#pragma omp parallel for schedule(dynamic, 4)
+	for (int row = o_crop.y; row < o_crop.y + o_crop.height; ++row)
 	{
-		for (long unsigned int col = 0; col < o_mapSize.width; ++col)
+		std::vector<uint64_t>& masks = rowMasks[row - o_crop.y];
+		std::vector<uint64_t> brs(classMaps.size() * o_words);
+		for (int col = o_crop.x; col < o_crop.x + o_crop.width; ++col)
 		{
-			Eigen::Vector2f pose(col, row);
-			
-			std::map<int, std::vector<Eigen::Vector2f>> cell = std::map<int, std::vector<Eigen::Vector2f>>();
+			if (!isValid(col, row)) continue;
 
-			if (o_gmap->IsValid2D(pose)) 
+			// ray trace in ~20 directions - check map occupied, check hitting object, check in the map
+			std::fill(brs.begin(), brs.end(), 0);
+			uint32_t classMask = 0;
+			for(int u = 0; u < beams; u++)
 			{
-				for (long unsigned int c = 0; c < classMaps.size(); ++c)
+				uint32_t traced = traceClasses(col, row, o_unitCircle[u]);
+				classMask |= traced;
+				while (traced)
 				{
-					std::vector<Eigen::Vector2f> brs;
-					// load map for class c
-					cv::Mat currMap = classMaps[c];
-
-					// ray trace in ~20 directions - check map occupied, check hitting object, check in the map
-					for(long unsigned int u = 0; u < unitCircle.size(); u++)
-					{
-						Eigen::Vector2f bearing = unitCircle[u];
-						bool traced = isTraced(currMap, pose, bearing);
-						if (traced)
-						{
-							brs.push_back(bearing);
+					int c = __builtin_ctz(traced);
+					traced &= traced - 1;
+					brs[c * o_words + u / 64] |= uint64_t(1) << (u % 64);
 #ifdef DEBUG
-							debugMaps[c].at<uchar>(row, col) = 255;
+					debugMaps[c].at<uchar>(row, col) = 255;
 #endif
-						}
-					}
-					// add to DB
-					if (brs.size()) cell[c] = brs;
 				}
 			}
-			o_visibilityMap[cellID(col, row)] = cell;
+
+			// add to DB, in class order
+			for (long unsigned int c = 0; c < classMaps.size(); ++c)
+			{
+				if (classMask & (uint32_t(1) << c)) masks.insert(masks.end(), brs.begin() + c * o_words, brs.begin() + (c + 1) * o_words);
+			}
+			vis->classMaskData[cellID(col, row)] = classMask;
 		}
 	}
+
+	pack(*vis, rowMasks);
+	o_visibilityMap = vis;
+
 #ifdef DEBUG
 	for(int i = 0; i < classNames.size(); ++i)
 	{
@@ -94,24 +122,309 @@ SemanticVisibility::SemanticVisibility(std::shared_ptr<GMap> Gmap, int beams, co
 #endif	
 }
 
-bool SemanticVisibility::isTraced(const cv::Mat& currMap, Eigen::Vector2f pose, Eigen::Vector2f bearing)
+SemanticVisibility::SemanticVisibility(std::shared_ptr<GMap> Gmap, std::shared_ptr<const MapBundle> bundle, int beams, const std::vector<std::string>& classNames, const std::vector<float>& confidences)
+{
+	o_gmap = Gmap;
+	setup(beams);
+
+	nlohmann::json info = nlohmann::json::parse(bundle->Text("visibility/info"));
+	std::vector<int> crop = info["crop"];
+	std::vector<std::string> classes = info["classes"];
+	if ((int(info["beams"]) != beams) || (classes != classNames) || (cv::Rect(crop[0], crop[1], crop[2], crop[3]) != o_crop))
+	{
+		throw std::runtime_error("SemanticVisibility| the bundle " + bundle->Path() + " was compiled for another map, beams or classes");
+	}
+
+	o_confidenceTH = confidences;
+	o_classMaps = std::vector<cv::Mat>(classNames.size());
+	o_classConsistency = std::vector<Eigen::Vector2f>(classNames.size(), Eigen::Vector2f(0, 0));
+
+	// UpdateClass edits the rasters, so they are copied. The table itself is only ever replaced, it stays in the mapped file
+	int numCells = o_crop.area();
+	const uint8_t* valid = bundle->Array<uint8_t>("visibility/valid", o_region.area());
+	const uint32_t* classBits = bundle->Array<uint32_t>("visibility/classBits", o_region.area());
+	o_valid.assign(valid, valid + o_region.area());
+	o_classBits.assign(classBits, classBits + o_region.area());
+
+	std::shared_ptr<VisibilityMap> vis = std::make_shared<VisibilityMap>();
+	vis->bundle = bundle;
+	vis->classMask = bundle->Array<uint32_t>("visibility/classMask", numCells);
+	vis->offsets = bundle->Array<uint32_t>("visibility/offsets", numCells + 1);
+	vis->visibility = bundle->Array<uint64_t>("visibility/words", vis->offsets[numCells]);
+	o_visibilityMap = vis;
+}
+
+void SemanticVisibility::Save(MapBundleWriter& writer, const std::vector<std::string>& classes) const
+{
+	std::shared_ptr<const VisibilityMap> vis = std::atomic_load(&o_visibilityMap);
+	int numCells = o_crop.area();
+
+	nlohmann::json info;
+	info["beams"] = o_beams;
+	info["classes"] = classes;
+	info["crop"] = {o_crop.x, o_crop.y, o_crop.width, o_crop.height};
+
+	writer.Add("visibility/info", info.dump());
+	writer.Add("visibility/valid", o_valid);
+	writer.Add("visibility/classBits", o_classBits);
+	writer.Add("visibility/classMask", vis->classMask, numCells * sizeof(uint32_t));
+	writer.Add("visibility/offsets", vis->offsets, (numCells + 1) * sizeof(uint32_t));
+	writer.Add("visibility/words", vis->visibility, vis->offsets[numCells] * sizeof(uint64_t));
+}
+
+void SemanticVisibility::setup(int beams)
+{
+	o_mapSize = o_gmap->Map().size();
+	// only free cells get an entry, and those are all inside the known part of the map
+	o_crop = o_gmap->Crop();
+	// A ray only moves through valid cells and reads one cell past the last of them, so everything it touches is inside Crop(2)
+	o_region = o_gmap->Crop(2);
+	o_br = o_gmap->BottomRight();
+
+	o_beams = beams;
+	o_words = (beams + 63) / 64;
+
+	o_unitCircle = std::vector<Eigen::Vector2f>(beams);
+	for(int i = 0; i < beams; ++i)
+	{
+		float angle = 2.0 * i * M_PI / float(beams);
+		o_unitCircle[i] = Eigen::Vector2f(cos(angle), sin(angle));
+		//std::cout << unitCircle[i](0) << ", " << unitCircle[i](1) << std::endl;
+	}
+}
+
+void SemanticVisibility::pack(VisibilityMap& vis, const std::vector<std::vector<uint64_t>>& rowMasks) const
+{
+	// CSR offsets, each class present in a cell takes o_words words
+	int numCells = vis.classMaskData.size();
+	vis.offsetsData = std::vector<uint32_t>(numCells + 1, 0);
+	for(int c = 0; c < numCells; ++c)
+	{
+		vis.offsetsData[c + 1] = vis.offsetsData[c] + __builtin_popcount(vis.classMaskData[c]) * o_words;
+	}
+	vis.visibilityData.clear();
+	vis.visibilityData.reserve(vis.offsetsData[numCells]);
+	for(const auto& masks : rowMasks)
+	{
+		vis.visibilityData.insert(vis.visibilityData.end(), masks.begin(), masks.end());
+	}
+
+	vis.classMask = vis.classMaskData.data();
+	vis.offsets = vis.offsetsData.data();
+	vis.visibility = vis.visibilityData.data();
+}
+
+bool SemanticVisibility::isValid(int x, int y) const
+{
+	x -= o_region.x;
+	y -= o_region.y;
+	if ((x < 0) || (y < 0) || (x >= o_region.width) || (y >= o_region.height)) return false;
+
+	return o_valid[y * o_region.width + x];
+}
+
+uint32_t SemanticVisibility::traceClasses(float x, float y, const Eigen::Vector2f& bearing) const
+{
+	uint32_t traced = 0;
+	while (true)
+	{
+		if ((x < 0) || (y < 0) || (x > o_br(0)) || (y > o_br(1))) break;
+		if (!isValid(int(x), int(y))) break;
+
+		x += bearing(0);
+		y += bearing(1);
+		int u = int(x) - o_region.x;
+		int v = int(y) - o_region.y;
+		if ((u >= 0) && (v >= 0) && (u < o_region.width) && (v < o_region.height)) traced |= o_classBits[v * o_region.width + u];
+	}
+
+	return traced;
+}
+
+bool SemanticVisibility::reaches(float x, float y, const Eigen::Vector2f& bearing, const Eigen::Vector4f& box) const
+{
+	// slab test of the ray (x, y) + t * bearing, t >= 0, against [box(0), box(2)] x [box(1), box(3)]
+	float t0 = 0;
+	float t1 = std::numeric_limits<float>::max();
+	float p[2] = {x, y};
+	for(int i = 0; i < 2; ++i)
+	{
+		float lo = box(i);
+		float hi = box(i + 2);
+		if (fabs(bearing(i)) < 1e-6)
+		{
+			if ((p[i] < lo) || (p[i] > hi)) return false;
+			continue;
+		}
+		float a = (lo - p[i]) / bearing(i);
+		float b = (hi - p[i]) / bearing(i);
+		t0 = std::max(t0, std::min(a, b));
+		t1 = std::min(t1, std::max(a, b));
+	}
+
+	return t0 <= t1;
+}
+
+int SemanticVisibility::UpdateClass(int label, const cv::Mat& classMap, const cv::Rect& footprint)
 {
-	Eigen::Vector2f currPose = pose;
-	float step = 1;
+	if ((label < 0) || (label >= int(o_classMaps.size())))
+	{
+		throw std::runtime_error("SemanticVisibility| unknown class " + std::to_string(label));
+	}
+	std::lock_guard<std::mutex> lock(o_updateMutex);
 
-	while(o_gmap->IsValid2D(currPose))
+	uint32_t flag = uint32_t(1) << label;
+	cv::Rect changed = footprint & o_region;
+	for (int v = changed.y; v < changed.y + changed.height; ++v)
 	{
-		currPose += step * bearing;
-		if(currMap.at<uchar>(currPose(1), currPose(0)))
+		const uchar* cls = classMap.ptr<uchar>(v);
+		uint32_t* bits = o_classBits.data() + (v - o_region.y) * o_region.width - o_region.x;
+		for (int u = changed.x; u < changed.x + changed.width; ++u)
 		{
-			return true;
+			if (cls[u]) bits[u] |= flag;
+			else bits[u] &= ~flag;
+		}
+	}
+	o_classMaps[label] = classMap;
+	if (changed.empty()) return 0;
+
+	// the region of influence: a ray can read a changed pixel only if its line passes within a pixel of the footprint,
+	// the extra pixel covers the truncation of the ray positions and their float drift
+	Eigen::Vector4f box(changed.x - 2, changed.y - 2, changed.x + changed.width + 1, changed.y + changed.height + 1);
+
+	std::shared_ptr<const VisibilityMap> prev = std::atomic_load(&o_visibilityMap);
+	std::shared_ptr<VisibilityMap> vis = std::make_shared<VisibilityMap>();
+	vis->classMaskData.assign(prev->classMask, prev->classMask + o_crop.area());
+	std::vector<std::vector<uint64_t>> rowMasks(o_crop.height);
+	int numClasses = o_classMaps.size();
+	int updated = 0;
+
+	#pragma omp parallel for schedule(dynamic, 4) reduction(+:updated)
+	for (int row = o_crop.y; row < o_crop.y + o_crop.height; ++row)
+	{
+		std::vector<uint64_t>& masks = rowMasks[row - o_crop.y];
+		std::vector<uint64_t> brs(o_words);
+		for (int col = o_crop.x; col < o_crop.x + o_crop.width; ++col)
+		{
+			if (!isValid(col, row)) continue;
+
+			int cID = cellID(col, row);
+			uint32_t classMask = prev->classMask[cID];
+			const uint64_t* old = visibleBeams(*prev, cID, label);
+			if (old) std::copy(old, old + o_words, brs.begin());
+			else std::fill(brs.begin(), brs.end(), 0);
+
+			// only the directions whose rays can reach the footprint are traced again
+			bool touched = false;
+			for(int u = 0; u < o_beams; u++)
+			{
+				if (!reaches(col, row, o_unitCircle[u], box)) continue;
+
+				touched = true;
+				uint64_t bit = uint64_t(1) << (u % 64);
+				if (traceClasses(col, row, o_unitCircle[u]) & flag) brs[u / 64] |= bit;
+				else brs[u / 64] &= ~bit;
+			}
+			if (touched) ++updated;
+
+			bool any = false;
+			for(int w = 0; w < o_words; ++w) any |= (brs[w] != 0);
+			classMask = any ? (classMask | flag) : (classMask & ~flag);
+
+			// add to DB, in class order
+			for (int c = 0; c < numClasses; ++c)
+			{
+				if (!(classMask & (uint32_t(1) << c))) continue;
+				if (c == label) masks.insert(masks.end(), brs.begin(), brs.end());
+				else
+				{
+					const uint64_t* beams = visibleBeams(*prev, cID, c);
+					masks.insert(masks.end(), beams, beams + o_words);
+				}
+			}
+			vis->classMaskData[cID] = classMask;
 		}
 	}
-	return false;
+
+	pack(*vis, rowMasks);
+	// the filter keeps reading the previous map until this swap
+	std::atomic_store(&o_visibilityMap, std::shared_ptr<const VisibilityMap>(vis));
+
+	return updated;
+}
+
+const uint64_t* SemanticVisibility::visibleBeams(const VisibilityMap& vis, int cID, int label) const
+{
+	if (cID < 0) return nullptr;
+
+	uint32_t mask = vis.classMask[cID];
+	if (!(mask & (uint32_t(1) << label))) return nullptr;
+
+	// the classes below label that are present come first
+	int rank = __builtin_popcount(mask & ((uint32_t(1) << label) - 1));
+
+	return vis.visibility + vis.offsets[cID] + rank * o_words;
+}
+
+int SemanticVisibility::bearingBin(const Eigen::Vector2f& bearing) const
+{
+	int k = int(lround(atan2(bearing(1), bearing(0)) * o_beams / (2.0 * M_PI)));
+
+	return (k % o_beams + o_beams) % o_beams;
+}
+
+int SemanticVisibility::nextBeam(const uint64_t* visible, int k) const
+{
+	int w = k / 64;
+	uint64_t bits = visible[w] & (~uint64_t(0) << (k % 64));
+	// one extra word, so the bits below k in the first word are reached after wrapping around
+	for(int i = 0; i <= o_words; ++i)
+	{
+		if (bits) return w * 64 + __builtin_ctzll(bits);
+		w = (w + 1) % o_words;
+		bits = visible[w];
+	}
+
+	return k;
 }
 
+int SemanticVisibility::prevBeam(const uint64_t* visible, int k) const
+{
+	int w = k / 64;
+	uint64_t bits = visible[w] & (~uint64_t(0) >> (63 - k % 64));
+	for(int i = 0; i <= o_words; ++i)
+	{
+		if (bits) return w * 64 + 63 - __builtin_clzll(bits);
+		w = (w + o_words - 1) % o_words;
+		bits = visible[w];
+	}
+
+	return k;
+}
+
+float SemanticVisibility::maxScore(const uint64_t* visible, const Eigen::Vector2f& bearing) const
+{
+	// degenerate bearing (detection on the particle), no direction matches
+	if (!(bearing.squaredNorm() > 0)) return -1.0;
+
+	// The dot product falls off with the angle, so the best direction is the closest traced one on either side of the nearest beam
+	int k = bearingBin(bearing);
+	float forward = o_unitCircle[nextBeam(visible, k)].dot(bearing);
+	float backward = o_unitCircle[prevBeam(visible, k)].dot(bearing);
+
+	// -1 is the floor, as in a search over all directions that starts from it
+	return std::max(-1.0f, std::max(forward, backward));
+}
 
 void SemanticVisibility::ComputeWeights(std::vector<Particle>& particles, std::shared_ptr<SemanticData> data)
+{
+	ParticleSet set(particles);
+	ComputeWeights(set, data);
+	set.CopyWeights(particles);
+}
+
+
+void SemanticVisibility::ComputeWeights(ParticleSet& particles, std::shared_ptr<SemanticData> data)
 {
 	const std::vector<Eigen::Vector2f>& poses = data->Pos();
 	const std::vector<int>& labels = data->Label();
@@ -119,10 +432,23 @@ void SemanticVisibility::ComputeWeights(std::vector<Particle>& particles, std::s
 
 	Eigen::Vector2f br = o_gmap->BottomRight();
 
+	// the detections that pass their class threshold, the others don't change the weights
+	std::vector<int> detections;
+	for (long unsigned int d = 0; d < labels.size(); ++d)
+	{
+		if (confidences[d] >= o_confidenceTH[labels[d]]) detections.push_back(d);
+	}
+	int numDetections = detections.size();
+	float normalizer = labels.size();
+
+	double* weights = particles.Weight();
+	// a snapshot, an UpdateClass running meanwhile swaps in a new map without touching this one
+	std::shared_ptr<const VisibilityMap> vis = std::atomic_load(&o_visibilityMap);
 
-	for(long unsigned int p = 0; p < particles.size(); ++p)
+	#pragma omp parallel for
+	for(int p = 0; p < particles.Size(); ++p)
 	{
-		Eigen::Vector3f pose = particles[p].pose;
+		Eigen::Vector3f pose = particles.Pose(p);
 		Eigen::Vector2f xy = Eigen::Vector2f(pose(0), pose(1));
 		Eigen::Vector2f mp = o_gmap->World2Map(xy);
 		Eigen::Matrix3f trans = Vec2Trans(pose);
@@ -137,58 +463,37 @@ void SemanticVisibility::ComputeWeights(std::vector<Particle>& particles, std::s
 		else
 		{
 			int cID = cellID(mp(0), mp(1));
-			std::map<int, std::vector<Eigen::Vector2f>> cell = o_visibilityMap[cID];
 
-			for (long unsigned int d = 0; d < labels.size(); ++d)
+			for (int i = 0; i < numDetections; ++i)
 			{
+				int d = detections[i];
 				int label = labels[d];
-				float conf = confidences[d];
-				if (conf < o_confidenceTH[label])
-				{
-					//w *= 0.1;
-					//dist += 0.9;
-					continue;
-				}
 
-				Eigen::Vector2f pr_pose = poses[d];
-				// convert from base_link to 3D world frame, flip y axis
-				//Eigen::Vector3f ts = trans * Eigen::Vector3f(pr_pose(0), -pr_pose(1), 1);
-				Eigen::Vector3f ts = trans * Eigen::Vector3f(pr_pose(0), pr_pose(1), 1);
-				// project onto the map in 2D
-				Eigen::Vector2f pr_uv = o_gmap->World2Map(Eigen::Vector2f(ts(0), ts(1)));
-				Eigen::Vector2f pr_bearing = (pr_uv - mp).normalized();
-
-				std::map<int, std::vector<Eigen::Vector2f>>::iterator it = cell.find(label);
-				if (it != cell.end())
+				const uint64_t* visible = visibleBeams(*vis, cID, label);
+				if (visible)
 				{
-					std::vector<Eigen::Vector2f> mp_bearings = cell[label];
-					std::vector<float> dot_scores;
-					
-					for(long unsigned int b = 0; b < mp_bearings.size(); ++b)
-					{
-						Eigen::Vector2f mp_bearing =  mp_bearings[b];
-						float score = mp_bearing.dot(pr_bearing);
-						dot_scores.push_back(score);
-					}
-
-					//does dor product return a number between -1 and 1? verify!!
-					float max_score = *max_element(dot_scores.begin(), dot_scores.end());
+					Eigen::Vector2f pr_pose = poses[d];
+					// convert from base_link to 3D world frame
+					Eigen::Vector3f ts = trans * Eigen::Vector3f(pr_pose(0), pr_pose(1), 1);
+					// project onto the map in 2D
+					Eigen::Vector2f pr_uv = o_gmap->World2Map(Eigen::Vector2f(ts(0), ts(1)));
+					Eigen::Vector2f pr_bearing = (pr_uv - mp).normalized();
+
+					float max_score = maxScore(visible, pr_bearing);
 					max_score = 0.5 * (max_score + 1.0);
-					//w *= max_score;
 					dist += (1 - max_score);  
 				}
 				else
 				{
 					// no object of this class found in the map
 					// down-weight particles
-					//w *= 0.001;
 					dist += 10 ;
 				}
 			}
-			w = exp(-(dist)/ labels.size());
+			w = exp(-(dist)/ normalizer);
 		}
 
-		particles[p].weight = w;
+		weights[p] = w;
 
 	}
 
@@ -207,6 +512,8 @@ void SemanticVisibility::UpdateConsistency(const Particle& particle, std::shared
 	Eigen::Vector2f mp = o_gmap->World2Map(xy);
 	Eigen::Matrix3f trans = Vec2Trans(pose);
 
+	std::shared_ptr<const VisibilityMap> vis = std::atomic_load(&o_visibilityMap);
+
 	if ((mp(0) < 0) || (mp(1) < 0) || (mp(0) > br(0)) || (mp(1) > br(1)))
 	{
 			return;
@@ -214,7 +521,6 @@ void SemanticVisibility::UpdateConsistency(const Particle& particle, std::shared
 	else
 	{
 		int cID = cellID(mp(0), mp(1));
-		std::map<int, std::vector<Eigen::Vector2f>> cell = o_visibilityMap[cID];
 
 		for (long unsigned int d = 0; d < labels.size(); ++d)
 		{
@@ -233,21 +539,11 @@ void SemanticVisibility::UpdateConsistency(const Particle& particle, std::shared
 			Eigen::Vector2f pr_uv = o_gmap->World2Map(Eigen::Vector2f(ts(0), ts(1)));
 			Eigen::Vector2f pr_bearing = (pr_uv - mp).normalized();
 
-			std::map<int, std::vector<Eigen::Vector2f>>::iterator it = cell.find(label);
-			if (it != cell.end())
+			const uint64_t* visible = visibleBeams(*vis, cID, label);
+			if (visible)
 			{
-				std::vector<Eigen::Vector2f> mp_bearings = cell[label];
-				std::vector<float> dot_scores;
-				
-				for(long unsigned int b = 0; b < mp_bearings.size(); ++b)
-				{
-					Eigen::Vector2f mp_bearing =  mp_bearings[b];
-					float score = mp_bearing.dot(pr_bearing);
-					dot_scores.push_back(score);
-				}
-
 				//does dor product return a number between -1 and 1? verify!!
-				float max_score = *max_element(dot_scores.begin(), dot_scores.end());
+				float max_score = maxScore(visible, pr_bearing);
 				max_score = 0.5 * (max_score + 1.0);
 				
 				if(max_score > 0.95)
@@ -265,8 +561,11 @@ void SemanticVisibility::UpdateConsistency(const Particle& particle, std::shared
 
 
 
-int SemanticVisibility::cellID(int x, int y)
+int SemanticVisibility::cellID(int x, int y) const
 {
+	x -= o_crop.x;
+	y -= o_crop.y;
+	if ((x < 0) || (y < 0) || (x >= o_crop.width) || (y >= o_crop.height)) return -1;
 
-	return y * o_mapSize.width + x;
+	return y * o_crop.width + x;
 }
\ No newline at end of file
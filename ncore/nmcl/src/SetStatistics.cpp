@@ -11,64 +11,138 @@
 
 #include "SetStatistics.h"
 #include <iostream>
+#include <algorithm>
 
 SetStatistics SetStatistics::ComputeParticleSetStatistics(const std::vector<Particle>& particles)
 {
+	return ComputeParticleSetStatistics(ParticleSet(particles));
+}
 
-	Eigen::Vector4d m = Eigen::Vector4d(0, 0, 0, 0);
-	Eigen::Matrix3d cov = Eigen::Matrix3d::Zero(3, 3);
-	int n = particles.size();
-	double tot_w = 0.0;
-
-	for(int i = 0; i < n; ++i)
+SetStatistics SetStatistics::ComputeParticleSetStatistics(const ParticleSet& particles)
+{
+	int n = particles.Size();
+	int numBlocks = (n + blockSize - 1) / blockSize;
+	std::vector<Moments> partial(numBlocks);
+
+	const float* px = particles.X();
+	const float* py = particles.Y();
+	const float* pt = particles.Theta();
+	const double* pw = particles.Weight();
+
+	// fixed blocks, so the sums are identical for any number of threads
+	#pragma omp parallel for schedule(static)
+	for(int b = 0; b < numBlocks; ++b)
 	{
-		Eigen::Vector3f p = particles[i].pose;
-		double w = particles[i].weight;
-
-		m(0) += p(0) * w; // mean x
-		m(1) += p(1) * w; // mean y
-		m(2) += cos(p(2)) * w; // theta 
-		m(3) += sin(p(2)) * w; // theta
+		int end = std::min(n, (b + 1) * blockSize);
 
-		tot_w += w;
+		// scalar accumulators, so the loop reduces over the streams of the set without touching Eigen temporaries
+		double sw = 0, sww = 0;
+		double mx = 0, my = 0, mc = 0, ms = 0;
+		double cxx = 0, cxy = 0, cyy = 0;
 
-		// linear components cov
-		for(int j = 0; j < 2; ++j)
+		for(int i = b * blockSize; i < end; ++i)
 		{
-			for(int k = 0; k < 2; ++k)
-			{
-				 cov(j,k) += w * p(j) * p(k);
-			}
+			double x = px[i];
+			double y = py[i];
+			double w = pw[i];
+
+			sw += w;
+			sww += w * w; // ESS
+
+			mx += x * w; // mean x
+			my += y * w; // mean y
+			mc += cos(pt[i]) * w; // theta 
+			ms += sin(pt[i]) * w; // theta
+
+			// linear components cov
+			cxx += w * x * x;
+			cxy += w * x * y;
+			cyy += w * y * y;
 		}
+
+		Moments& m = partial[b];
+		m.w = sw;
+		m.ww = sww;
+		m.x = mx;
+		m.y = my;
+		m.c = mc;
+		m.s = ms;
+		m.xx = cxx;
+		m.xy = cxy;
+		m.yy = cyy;
 	}
 
-	Eigen::Vector3d mean;
-	mean(0) = m(0) / tot_w; 
-	mean(1) = m(1) / tot_w; 
-	mean(2) = atan2(m(3), m(2)); 
+	SetStatistics stats;
+	for(const Moments& p : partial)
+	{
+		SetStatistics block;
+		block.moments = p;
+		stats.Add(block);
+	}
+	stats.ready = false;
+
+	return stats;
+}
+
+void SetStatistics::Add(const Eigen::Vector3f& pose, double weight)
+{
+	double x = pose(0);
+	double y = pose(1);
+	double w = weight;
+
+	moments.w += w;
+	moments.ww += w * w;
+	moments.x += x * w;
+	moments.y += y * w;
+	moments.c += cos(pose(2)) * w;
+	moments.s += sin(pose(2)) * w;
+	moments.xx += w * x * x;
+	moments.xy += w * x * y;
+	moments.yy += w * y * y;
+	ready = false;
+}
+
+void SetStatistics::Add(const SetStatistics& other)
+{
+	const Moments& p = other.moments;
+
+	moments.w += p.w;
+	moments.ww += p.ww;
+	moments.x += p.x;
+	moments.y += p.y;
+	moments.c += p.c;
+	moments.s += p.s;
+	moments.xx += p.xx;
+	moments.xy += p.xy;
+	moments.yy += p.yy;
+	ready = false;
+}
+
+void SetStatistics::finalize() const
+{
+	if (ready) return;
+	ready = true;
+
+	const Moments& m = moments;
+	double tot_w = m.w;
 
+	mean(0) = m.x / tot_w; 
+	mean(1) = m.y / tot_w; 
+	mean(2) = atan2(m.s, m.c); 
 
 	// normalize linear components cov
-	for(int j = 0; j < 2; ++j)
-	{
-		for(int k = 0; k < 2; ++k)
-		{
-			 cov(j, k) = cov(j, k) /tot_w - mean(j) * mean(k);
-		}
-	}
+	cov = Eigen::Matrix3d::Zero(3, 3);
+	cov(0, 0) = m.xx / tot_w - mean(0) * mean(0);
+	cov(0, 1) = m.xy / tot_w - mean(0) * mean(1);
+	cov(1, 0) = cov(0, 1);
+	cov(1, 1) = m.yy / tot_w - mean(1) * mean(1);
 
 	// angular covariance
-	double R = sqrt(m(2) * m(2) + m(3) * m(3));
+	double R = sqrt(m.c * m.c + m.s * m.s);
 
 	// https://github.com/ros-planning/navigation/blob/2b807bd312fac1b476851800c84cb962559cbc53/amcl/src/amcl/pf/pf.c#L690
 	//cov(2, 2) = -2 * log(R);
 
 	// https://www.ebi.ac.uk/thornton-srv/software/PROCHECK/nmr_manual/man_cv.html
 	cov(2, 2) = 1 - R / tot_w;
-
-
-	SetStatistics stats = SetStatistics(mean, cov);
-
-	return stats;
-
-}
\ No newline at end of file
+}
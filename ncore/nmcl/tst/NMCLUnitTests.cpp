@@ -18,6 +18,7 @@
 #include <string>
 #include <fstream>
 #include <chrono>
+#include <numeric>
 #include <stdlib.h>
 #include <string>
 
@@ -36,15 +37,50 @@
 #include "FloorMap.h"
 #include "ReNMCL.h"
 #include <nlohmann/json.hpp>
+#include <boost/filesystem.hpp>
 #include "NMCLFactory.h"
 #include "LidarData.h"
 #include "SemanticLikelihood.h"
 #include "SemanticVisibility.h"
+#include "MapBundle.h"
 #include "ParticleFilter.h"
+#include "ParticleSet.h"
+#include "ParticleClusters.h"
+#include "Resampling.h"
 
 std::string dataPath = PROJECT_TEST_DATA_DIR + std::string("/8/");
 std::string testPath = PROJECT_TEST_DATA_DIR + std::string("/test/floor/");
 
+//! A new folder in the system temp directory, removed with everything in it at the end of the test
+struct TempFolder
+{
+	std::string path;
+
+	TempFolder(const std::string& name)
+	{
+		boost::filesystem::path folder = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path(name + "-%%%%-%%%%");
+		boost::filesystem::create_directories(folder);
+		path = folder.string() + "/";
+	}
+
+	~TempFolder()
+	{
+		boost::system::error_code ec;
+		boost::filesystem::remove_all(path, ec);
+	}
+
+	//! Copies the files and subfolders of a folder (ending with /) here
+	void CopyFrom(const std::string& folder)
+	{
+		for (boost::filesystem::recursive_directory_iterator it(folder), end; it != end; ++it)
+		{
+			boost::filesystem::path target = path + it->path().string().substr(folder.size());
+			if (boost::filesystem::is_directory(it->path())) boost::filesystem::create_directories(target);
+			else boost::filesystem::copy_file(it->path(), target, boost::filesystem::copy_option::overwrite_if_exists);
+		}
+	}
+};
+
 
 TEST(TestSemanticVisibility, test1)
 {
@@ -70,6 +106,223 @@ TEST(TestSemanticVisibility, test1)
 	ASSERT_GE(particles[0].weight, 0.95);
 }
 
+//! The semantic test floor: the grid map, the classes and their confidences, and the detections seen from a pose in the kitchen
+struct SemanticFloor
+{
+	std::string mapFolder = testPath + "SemMaps/";
+	std::vector<std::string> classNames = {"sink", "door", "oven", "whiteboard", "table", "cardboard", "plant", "drawers", "sofa", "storage"};
+	std::vector<float> confidences = {0.7, 0.5, 0.7, 0.7, 0.6, 0.7, 0.7, 0.7, 0.8, 0.7};
+	std::shared_ptr<GMap> gmap;
+	Eigen::Vector3f pose = Eigen::Vector3f(1.3165115852616611, -7.790449181330476, -0.1909482910790089);
+
+	std::vector<Eigen::Vector2f> poses = {Eigen::Vector2f(1.0, 0.4537924009538352), Eigen::Vector2f(1.0, -0.4631433462056238),
+											Eigen::Vector2f(1.0, -0.15925215884000687), Eigen::Vector2f(1.0, -0.3750017464069384),
+											Eigen::Vector2f(1.0, -0.1250479559330543)};
+	std::vector<int> labels = {1, 4, 3, 7, 4};
+	std::vector<float> conf = {0.8995144, 0.8903151, 0.88935226, 0.81773764, 0.8013637};
+
+	SemanticFloor()
+	{
+		cv::Mat grid = cv::imread(testPath + "JMap.png");
+		gmap = std::make_shared<GMap>(GMap(grid, Eigen::Vector3f(-13.9155, -24.94537, 0.0), 0.05));
+	}
+
+	std::shared_ptr<SemanticData> Detections() const
+	{
+		return std::make_shared<SemanticData>(labels, poses, conf);
+	}
+
+	//! Detections of two tables, a door and drawers
+	void DetectTables()
+	{
+		poses = {Eigen::Vector2f(1.0, 0.4537924009538352), Eigen::Vector2f(1.0, -0.4631433462056238),
+					Eigen::Vector2f(0.8, 0.8), Eigen::Vector2f(1.0, -0.3750017464069384)};
+		labels = {1, 4, 4, 7};
+		conf = {0.8995144, 0.8903151, 0.88935226, 0.81773764};
+	}
+};
+
+//! Scores particles on a grid of the map, 20 columns step pixels apart from (u, v), with both models and asserts they agree
+void assertSameWeights(SemanticVisibility& sv, SemanticVisibility& reference, const SemanticFloor& floor, const Eigen::Vector2f& uv, float step)
+{
+	std::shared_ptr<SemanticData> semData = floor.Detections();
+	std::vector<Particle> particles;
+	for (int i = 0; i < 400; ++i)
+	{
+		Eigen::Vector2f xy = floor.gmap->Map2World(uv + step * Eigen::Vector2f(i % 20, i / 20));
+		particles.push_back(Particle(Eigen::Vector3f(xy(0), xy(1), -M_PI + 0.05 * i), 1.0));
+	}
+	std::vector<Particle> expected = particles;
+	sv.ComputeWeights(particles, semData);
+	reference.ComputeWeights(expected, semData);
+
+	for (long unsigned int i = 0; i < particles.size(); ++i)
+	{
+		ASSERT_EQ(expected[i].weight, particles[i].weight);
+	}
+}
+
+TEST(TestSemanticVisibility, test2)
+{
+	SemanticFloor floor;
+
+	// more than 64 directions, so each (cell, class) takes two words of the CSR storage
+	SemanticVisibility sv(floor.gmap, 72, floor.mapFolder, floor.classNames, floor.confidences);
+
+	std::vector<Particle> particles = {Particle(floor.pose, 1.0)};
+	sv.ComputeWeights(particles, floor.Detections());
+	ASSERT_GE(particles[0].weight, 0.95);
+}
+
+TEST(TestSemanticVisibility, test3)
+{
+	SemanticFloor floor;
+	SemanticVisibility sv(floor.gmap, 36, floor.mapFolder, floor.classNames, floor.confidences);
+
+	// one detection below the confidence of its class
+	floor.conf[4] = 0.4;
+	std::shared_ptr<SemanticData> semData = floor.Detections();
+
+	// the parallel pass over all particles gives the same weights as scoring each particle alone
+	std::vector<Particle> particles;
+	for (int i = 0; i < 200; ++i)
+	{
+		particles.push_back(Particle(Eigen::Vector3f(floor.pose(0) + 0.05 * (i % 20), floor.pose(1) + 0.05 * (i / 20), -M_PI + 0.1 * i), 1.0));
+	}
+	sv.ComputeWeights(particles, semData);
+
+	for (long unsigned int i = 0; i < particles.size(); ++i)
+	{
+		std::vector<Particle> single = {Particle(particles[i].pose, 1.0)};
+		sv.ComputeWeights(single, semData);
+		ASSERT_EQ(single[0].weight, particles[i].weight);
+	}
+}
+
+TEST(TestSemanticVisibility, test4)
+{
+	SemanticFloor floor;
+	SemanticVisibility sv(floor.gmap, 36, floor.mapFolder, floor.classNames, floor.confidences);
+
+	// a table is placed next to the robot
+	Eigen::Vector2f uv = floor.gmap->World2Map(Eigen::Vector2f(floor.pose(0), floor.pose(1)));
+	cv::Rect footprint(uv(0) + 15, uv(1) - 5, 8, 10);
+	cv::Mat tables = cv::imread(floor.mapFolder + "table.png", 0);
+	cv::rectangle(tables, footprint, 255, -1);
+	ASSERT_GT(sv.UpdateClass(4, tables, footprint), 0);
+
+	// the local update gives the map built from scratch from the edited class maps
+	TempFolder semMaps("semmaps");
+	semMaps.CopyFrom(floor.mapFolder);
+	cv::imwrite(semMaps.path + "table.png", tables);
+	SemanticVisibility rebuilt(floor.gmap, 36, semMaps.path, floor.classNames, floor.confidences);
+
+	floor.DetectTables();
+	assertSameWeights(sv, rebuilt, floor, uv - Eigen::Vector2f(10, 10), 2.0);
+}
+
+TEST(TestSemanticVisibility, test5)
+{
+	// FloorMap writes the class maps to SemMaps/ of its folder, so it works on a copy of the test floor
+	TempFolder folder("floor");
+	folder.CopyFrom(testPath);
+	std::ifstream file(folder.path + "floor.config");
+	nlohmann::json config;
+	file >> config;
+	FloorMap floorMap(config, folder.path);
+	std::string semMapDir = folder.path + "SemMaps/";
+
+	SemanticFloor floor;
+	floor.DetectTables();
+	SemanticVisibility sv(floor.gmap, 36, semMapDir, floor.classNames, floor.confidences);
+
+	std::vector<std::string> names = floorMap.GetRoomNames();
+	int roomID = std::find(names.begin(), names.end(), "Room 1") - names.begin();
+	const std::vector<Object> objs = floorMap.GetRoom(roomID).Objects();
+	auto table = std::find_if(objs.begin(), objs.end(), [](const Object& obj) {return obj.SemLabel() == 4;});
+	auto storage = std::find_if(objs.begin(), objs.end(), [](const Object& obj) {return obj.SemLabel() == 9;});
+	ASSERT_NE(table, objs.end());
+	ASSERT_NE(storage, objs.end());
+
+	// the table is moved down the room, only the pixels inside the returned box change
+	cv::Mat original = floorMap.SemMap(4);
+	Eigen::Vector4f position = table->Position();
+	cv::Rect changed = floorMap.MoveObject(roomID, table->ID(), position + Eigen::Vector4f(0, 10, 0, 10));
+	cv::Mat moved = floorMap.SemMap(4);
+	cv::Mat diff = moved != original;
+	ASSERT_GT(cv::countNonZero(diff(changed)), 0);
+	diff(changed).setTo(0);
+	ASSERT_EQ(cv::countNonZero(diff), 0);
+	ASSERT_GT(sv.UpdateClass(4, moved, changed), 0);
+
+	TempFolder semMaps("semmaps");
+	semMaps.CopyFrom(semMapDir);
+	cv::imwrite(semMaps.path + "table.png", moved);
+	SemanticVisibility rebuilt(floor.gmap, 36, semMaps.path, floor.classNames, floor.confidences);
+	Eigen::Vector2f uv(350, 72);
+	assertSameWeights(sv, rebuilt, floor, uv, 4.0);
+
+	// moving it back restores the class map and the visibility of the floor as written by FloorMap
+	changed = floorMap.MoveObject(roomID, table->ID(), position);
+	ASSERT_EQ(cv::countNonZero(floorMap.SemMap(4) != original), 0);
+	sv.UpdateClass(4, floorMap.SemMap(4), changed);
+	SemanticVisibility restored(floor.gmap, 36, semMapDir, floor.classNames, floor.confidences);
+	assertSameWeights(sv, restored, floor, uv, 4.0);
+
+	// storage is part of the occupancy map, it can't be moved
+	cv::Mat storageMap = floorMap.SemMap(9);
+	ASSERT_THROW(floorMap.MoveObject(roomID, storage->ID(), storage->Position() + Eigen::Vector4f(0, 5, 0, 5)), std::runtime_error);
+	ASSERT_EQ(cv::countNonZero(floorMap.SemMap(9) != storageMap), 0);
+}
+
+
+
+TEST(TestSemanticLikelihood, test1)
+{
+	std::string jsonPath = testPath + "floor.config";
+    using json = nlohmann::json;
+    std::ifstream file(jsonPath);
+    json config;
+    file >> config;
+    std::shared_ptr<FloorMap> fp = std::make_shared<FloorMap>(FloorMap(config, testPath));
+	SemanticLikelihood sl(fp, testPath + "SemMaps/", 8, 15);
+
+	// the distance field of a class is 0 on its objects and truncated off the map
+	cv::Mat tables = cv::imread(testPath + "SemMaps/table.png", 0);
+	std::vector<cv::Point> pixels;
+	cv::findNonZero(tables, pixels);
+	ASSERT_FALSE(pixels.empty());
+	ASSERT_EQ(sl.Distance(4, pixels[0].x, pixels[0].y), 0);
+	ASSERT_EQ(sl.Distance(4, -10, -10), 15);
+
+	// a particle in free space sees its own neighbourhood, a particle in a wall sees nothing
+	Eigen::Vector2f free(-1, -1);
+	const cv::Mat& grid = fp->Map()->Map();
+	for (int v = 0; (v < grid.rows) && (free(0) < 0); ++v)
+	{
+		for (int u = 0; u + 1 < grid.cols; ++u)
+		{
+			if (fp->Map()->IsValid2D(Eigen::Vector2f(u, v)) && fp->Map()->IsValid2D(Eigen::Vector2f(u + 1, v)))
+			{
+				free = Eigen::Vector2f(u, v);
+				break;
+			}
+		}
+	}
+	ASSERT_FALSE(sl.IsOccluded(free, free + Eigen::Vector2f(0.5, 0)));
+	ASSERT_TRUE(sl.IsOccluded(Eigen::Vector2f(-10, -10), free));
+	// detections beyond the detection range aren't trusted
+	ASSERT_TRUE(sl.IsOccluded(free, free + Eigen::Vector2f(201, 0)));
+
+	// detections of unknown classes don't change the weights
+	std::vector<Particle> particles(10, Particle(Eigen::Vector3f(1.3165115852616611, -7.790449181330476, 0), 0.5));
+	std::vector<int> labels = {100};
+	std::vector<Eigen::Vector2f> poses = {Eigen::Vector2f(1.0, 0.0)};
+	std::vector<float> conf = {0.9};
+	sl.ComputeWeights(particles, std::make_shared<SemanticData>(labels, poses, conf));
+	ASSERT_EQ(particles[9].weight, 1.0);
+}
+
 
 
 TEST(TestMixedFSR, test1) {
@@ -110,6 +363,33 @@ TEST(TestMixedFSR, test3) {
 	
 }
 
+TEST(TestMixedFSR, test4) {
+
+	// without noise, the batched update has to agree with Forward for every particle
+	MixedFSR mfsr = MixedFSR();
+	int n = 1000;
+	std::vector<Particle> particles(n);
+	for(int i = 0; i < n; ++i)
+	{
+		particles[i] = Particle(Eigen::Vector3f(0.01 * i, -0.02 * i, -M_PI + 0.0063 * i), 1.0 / n);
+	}
+	ParticleSet set(particles);
+
+	std::vector<Eigen::Vector3f> command{Eigen::Vector3f(0.05, -0.1, 0.02)};
+	std::vector<float> commandWeights{1.0f};
+	mfsr.SampleMotion(set, command, commandWeights, Eigen::Vector3f(0.0, 0.0, 0.0));
+
+	for(int i = 0; i < n; ++i)
+	{
+		Eigen::Vector3f p_gt = mfsr.Forward(particles[i].pose, command[0]);
+		Eigen::Vector3f p = set.Pose(i);
+		ASSERT_NEAR(p(0), p_gt(0), 0.0001);
+		ASSERT_NEAR(p(1), p_gt(1), 0.0001);
+		ASSERT_NEAR(sin(p(2)), sin(p_gt(2)), 0.0001);
+		ASSERT_NEAR(cos(p(2)), cos(p_gt(2)), 0.0001);
+	}
+}
+
 
 
 TEST(TestPlaceRecognition, test1)
@@ -182,6 +462,31 @@ TEST(TestPlaceRecognition, test5)
 }
 
 
+TEST(TestPlaceRecognition, test6)
+{
+	std::string jsonPath = testPath + "floor.config";
+    using json = nlohmann::json;
+    std::ifstream file(jsonPath);
+    json config;
+    file >> config;
+    FloorMap fp(config, testPath);
+
+    std::vector<std::string> dict = fp.GetRoomNames(); 
+	PlaceRecognition placeRec = PlaceRecognition(dict, testPath + "TextMaps/", fp.Map());
+
+	std::vector<int> matches = placeRec.Match({"Room 1"});
+	std::vector<std::string> confirmedMatches;
+	TextData textData = placeRec.TextBoundingBoxes(matches, confirmedMatches);
+
+	ASSERT_EQ(textData.Regions().size(), textData.TopLeft().size());
+	std::shared_ptr<const TextRegion> region = textData.Regions()[0];
+	ASSERT_TRUE(region && !region->Empty());
+	for(const Eigen::Vector2f& xy : region->positions)
+	{
+		ASSERT_TRUE(fp.Map()->IsValid(Eigen::Vector3f(xy(0), xy(1), 0)));
+	}
+}
+
 
 TEST(TestParticleFilter, test1)
 {
@@ -270,6 +575,87 @@ TEST(TestParticleFilter, test3)
 	ASSERT_EQ(particles.size(), 1);
 }
 
+TEST(TestParticleFilter, test4)
+{
+	std::string jsonPath = testPath + "floor.config";
+    using json = nlohmann::json;
+    std::ifstream file(jsonPath);
+    json config;
+    file >> config;
+    std::shared_ptr<FloorMap> fp = std::make_shared<FloorMap>(FloorMap(config, testPath));
+
+	ParticleFilter pf(fp);
+	int n = 100;
+	std::vector<Particle> particles(n, Particle(Eigen::Vector3f(1000.0, 1000.0, 0), 1.0 / n));
+	ParticleSet set(particles);
+
+	std::vector<int> ids{3, 10, 99};
+	pf.ReplaceUniform(set, ids, 0.5);
+
+	for(int i : ids)
+	{
+		ASSERT_TRUE(fp->Map()->IsValid(set.Pose(i)));
+		ASSERT_EQ(set.Weight()[i], 0.5);
+	}
+	ASSERT_EQ(set.Pose(0), Eigen::Vector3f(1000.0, 1000.0, 0));
+}
+
+
+TEST(TestParticleFilter, test5)
+{
+	std::string jsonPath = testPath + "floor.config";
+    using json = nlohmann::json;
+    std::ifstream file(jsonPath);
+    json config;
+    file >> config;
+    std::shared_ptr<FloorMap> fp = std::make_shared<FloorMap>(FloorMap(config, testPath));
+
+	ParticleFilter pf(fp);
+	ParticleSet set(6);
+	double weights[6] = {0.3, 0.1, 0.2, 0.1, 0.05, 0.25};
+	for(int i = 0; i < 6; ++i) set.Weight()[i] = weights[i];
+
+	std::vector<int> weakest = pf.Weakest(set, 3);
+	ASSERT_EQ(weakest, std::vector<int>({1, 3, 4}));
+}
+
+TEST(TestParticleFilter, test6)
+{
+	std::string jsonPath = testPath + "floor.config";
+    using json = nlohmann::json;
+    std::ifstream file(jsonPath);
+    json config;
+    file >> config;
+    std::shared_ptr<FloorMap> fp = std::make_shared<FloorMap>(FloorMap(config, testPath));
+	std::shared_ptr<FreeSpaceIndex> freeSpace = fp->FreeSpace();
+
+	// two purposes that are equally likely are hit in proportion to their free area, as with rejection sampling
+	std::vector<int> purposes;
+	for(int t = 0; t < 4; ++t)
+	{
+		if (freeSpace->PurposeArea(t) > 0) purposes.push_back(t);
+	}
+	ASSERT_GE(purposes.size(), 2u);
+	std::vector<float> probs(4, 0.0);
+	probs[purposes[0]] = 0.5;
+	probs[purposes[1]] = 0.5;
+
+	ParticleFilter pf(fp);
+	std::vector<Particle> particles;
+	int n = 20000;
+	pf.InitByRoomType(particles, n, probs);
+
+	int hits = 0;
+	for(const Particle& p : particles)
+	{
+		int purpose = fp->GetRoom(fp->GetRoomID(p.pose)).Purpose();
+		ASSERT_TRUE((purpose == purposes[0]) || (purpose == purposes[1]));
+		if (purpose == purposes[0]) ++hits;
+	}
+	double a0 = freeSpace->PurposeArea(purposes[0]);
+	double a1 = freeSpace->PurposeArea(purposes[1]);
+	ASSERT_NEAR(hits / double(n), a0 / (a0 + a1), 0.02);
+}
 
 
 TEST(TestBeamEnd, test1)
@@ -294,6 +680,205 @@ TEST(TestBeamEnd, test1)
 	ASSERT_NEAR(particles[0].weight, 0.09063308, 0.01);
 }
 
+TEST(TestBeamEnd, test2)
+{
+	GMap gmap = GMap(dataPath);
+	float sigma = 8;
+	float maxRange = 15;
+	BeamEnd be = BeamEnd(std::make_shared<GMap>(gmap), sigma, maxRange, BeamEnd::Weighting::NAIVE);
+
+	// the same beam, once alone and once with a beam that leaves the map
+	Eigen::Vector3f p3d0_gt = Eigen::Vector3f(0.33675906, -0.84122932,  1. );
+	std::vector<Eigen::Vector3f> scan1{p3d0_gt};
+	std::vector<Eigen::Vector3f> scan2{p3d0_gt, Eigen::Vector3f(1e6, 0, 1)};
+
+	std::vector<Particle> particles1{Particle(Eigen::Vector3f(0, 0, 0), 1.0)};
+	std::vector<Particle> particles2{Particle(Eigen::Vector3f(0, 0, 0), 1.0)};
+	be.ComputeWeights(particles1, std::make_shared<LidarData>(LidarData(scan1, std::vector<double>(1, 1.0))));
+	be.ComputeWeights(particles2, std::make_shared<LidarData>(LidarData(scan2, std::vector<double>(2, 1.0))));
+
+	// the beam outside the map is charged the likelihood at maxRange, whatever the table quantization
+	double penalty = 1.0 / sqrt(2 * M_PI * sigma) * exp(-0.5 * pow(maxRange / sigma, 2));
+	ASSERT_NEAR(particles2[0].weight / particles1[0].weight, penalty, 1e-4 * penalty);
+}
+
+TEST(TestBeamEnd, test3)
+{
+	GMap gmap = GMap(dataPath);
+	std::shared_ptr<GMap> map = std::make_shared<GMap>(gmap);
+	BeamEnd exact = BeamEnd(map, 8, 15, BeamEnd::Weighting::GEOMETRIC);
+	BeamEnd binned = BeamEnd(map, 8, 15, BeamEnd::Weighting::GEOMETRIC);
+	binned.SetRotationBins(360);
+
+	std::vector<Eigen::Vector3f> scan;
+	for(int i = 0; i < 90; ++i)
+	{
+		float a = i * 2 * M_PI / 90;
+		scan.push_back(Eigen::Vector3f(2.0 * cos(a), 2.0 * sin(a), 1));
+	}
+	std::shared_ptr<LidarData> data = std::make_shared<LidarData>(LidarData(scan, std::vector<double>(scan.size(), 1.0)));
+
+	// particles on cell centers with headings on bin centers project exactly like the exact model
+	float res = map->Resolution();
+	Eigen::Vector3f origin = map->Origin();
+	std::vector<Particle> p1, p2;
+	for(int i = 0; i < 8; ++i)
+	{
+		float theta = -M_PI + (45 * i + 0.5) * 2 * M_PI / 360;
+		Eigen::Vector3f pose(origin(0) + (100 + 10 * i) * res, origin(1) + (100 + 5 * i) * res, theta);
+		p1.push_back(Particle(pose, 1.0));
+		p2.push_back(Particle(pose, 1.0));
+	}
+	exact.ComputeWeights(p1, data);
+	binned.ComputeWeights(p2, data);
+
+	for(int i = 0; i < 8; ++i)
+	{
+		ASSERT_NEAR(p1[i].weight, p2[i].weight, 1e-6 * p1[i].weight);
+	}
+	ASSERT_EQ(exact.MaxProjectionError(2.0), 0);
+	ASSERT_NEAR(binned.MaxProjectionError(2.0), 1.0 + 2.0 * M_PI / 360 / res, 1e-4);
+}
+
+TEST(TestBeamEnd, test4)
+{
+	GMap gmap = GMap(dataPath);
+	std::shared_ptr<GMap> map = std::make_shared<GMap>(gmap);
+	BeamEnd exact = BeamEnd(map, 8, 15, BeamEnd::Weighting::GEOMETRIC);
+	BeamEnd coarse = BeamEnd(map, 8, 15, BeamEnd::Weighting::GEOMETRIC);
+	coarse.SetCoarseToFine(16, 0.01);
+
+	std::vector<Eigen::Vector3f> scan;
+	for(int i = 0; i < 128; ++i)
+	{
+		float a = i * 2 * M_PI / 128;
+		scan.push_back(Eigen::Vector3f(3.0 * cos(a), 3.0 * sin(a), 1));
+	}
+	std::shared_ptr<LidarData> data = std::make_shared<LidarData>(LidarData(scan, std::vector<double>(scan.size(), 1.0)));
+
+	std::vector<Particle> p1, p2;
+	for(int i = 0; i < 50; ++i)
+	{
+		Particle p(Eigen::Vector3f(-5 + 0.2 * i, 0.1 * i - 2, 0.3 * i), 1.0);
+		// one particle far outside the map, which can't beat any particle that sees an obstacle
+		if (i == 0) p.pose = Eigen::Vector3f(1000, 1000, 0);
+		p1.push_back(p);
+		p2.push_back(p);
+	}
+	exact.ComputeWeights(p1, data);
+	coarse.ComputeWeights(p2, data);
+
+	// the survivors are scored on the full scan, the best of them is among them
+	ASSERT_GT(coarse.NumPruned(), 0);
+	ASSERT_LT(coarse.NumPruned(), 50);
+	int survivors = 0;
+	for(int i = 0; i < 50; ++i)
+	{
+		if (std::abs(p1[i].weight - p2[i].weight) < 1e-9) ++survivors;
+	}
+	ASSERT_GE(survivors, 50 - coarse.NumPruned());
+
+	// without a margin nothing is stopped
+	coarse.SetCoarseToFine(16, 1e9);
+	coarse.ComputeWeights(p2, data);
+	ASSERT_EQ(coarse.NumPruned(), 0);
+	for(int i = 0; i < 50; ++i)
+	{
+		ASSERT_NEAR(p1[i].weight, p2[i].weight, 1e-9);
+	}
+}
+
+TEST(TestBeamEnd, test5)
+{
+	GMap gmap = GMap(dataPath);
+	std::shared_ptr<GMap> map = std::make_shared<GMap>(gmap);
+	BeamEnd exact = BeamEnd(map, 8, 15, BeamEnd::Weighting::LAPLACE);
+	BeamEnd memo = BeamEnd(map, 8, 15, BeamEnd::Weighting::LAPLACE);
+	memo.SetMemoization(360);
+
+	std::vector<Eigen::Vector3f> scan;
+	for(int i = 0; i < 64; ++i)
+	{
+		float a = i * 2 * M_PI / 64;
+		scan.push_back(Eigen::Vector3f(3.0 * cos(a), 3.0 * sin(a), 1));
+	}
+	std::shared_ptr<LidarData> data = std::make_shared<LidarData>(LidarData(scan, std::vector<double>(scan.size(), 1.0)));
+
+	// 10 distinct poses, each duplicated 10 times as after resampling
+	std::vector<Particle> p1, p2;
+	for(int i = 0; i < 100; ++i)
+	{
+		int k = i % 10;
+		Particle p(Eigen::Vector3f(-2 + 0.5 * k, 0.3 * k - 1, 0.6 * k), 1.0);
+		p1.push_back(p);
+		p2.push_back(p);
+	}
+	exact.ComputeWeights(p1, data);
+	memo.ComputeWeights(p2, data);
+
+	ASSERT_NEAR(memo.MemoHitRate(), 0.9, 1e-9);
+	for(int i = 0; i < 100; ++i)
+	{
+		ASSERT_EQ(p1[i].weight, p2[i].weight);
+	}
+}
+
+
+TEST(TestBeamEnd, test6)
+{
+	GMap gmap = GMap(dataPath);
+	std::shared_ptr<GMap> map = std::make_shared<GMap>(gmap);
+	BeamEnd dynamic = BeamEnd(map, 8, 15, BeamEnd::Weighting::LAPLACE);
+	cv::Rect crop = map->Crop(dynamic.RasterMargin());
+
+	// a block of new obstacles in the middle of the map, and the obstacles around it are freed
+	cv::Mat grid = map->Map().clone();
+	std::vector<Eigen::Vector2i> added, removed;
+	int centerU = crop.x + crop.width / 2;
+	int centerV = crop.y + crop.height / 2;
+	for(int v = centerV - 40; v < centerV + 40; ++v)
+	{
+		for(int u = centerU - 40; u < centerU + 40; ++u)
+		{
+			if ((std::abs(u - centerU) < 3) && (std::abs(v - centerV) < 3))
+			{
+				if (grid.at<uchar>(v, u) <= 127) added.push_back(Eigen::Vector2i(u, v));
+				grid.at<uchar>(v, u) = 255;
+			}
+			else if (grid.at<uchar>(v, u) > 127)
+			{
+				removed.push_back(Eigen::Vector2i(u, v));
+				grid.at<uchar>(v, u) = 0;
+			}
+		}
+	}
+	std::shared_ptr<GMap> edited = std::make_shared<GMap>(GMap(grid, map->Origin(), map->Resolution()));
+	ASSERT_EQ(edited->Crop(dynamic.RasterMargin()), crop);
+	ASSERT_GT(removed.size(), 0u);
+
+	dynamic.InsertObstacles(added);
+	dynamic.RemoveObstacles(removed);
+	BeamEnd fresh = BeamEnd(edited, 8, 15, BeamEnd::Weighting::LAPLACE);
+	for(int v = crop.y; v < crop.y + crop.height; ++v)
+	{
+		for(int u = crop.x; u < crop.x + crop.width; ++u)
+		{
+			ASSERT_EQ(dynamic.Raster()->Cell(u, v).likelihood, fresh.Raster()->Cell(u, v).likelihood);
+		}
+	}
+
+	// undoing the edits gives back the original model
+	dynamic.RemoveObstacles(added);
+	dynamic.InsertObstacles(removed);
+	BeamEnd original = BeamEnd(map, 8, 15, BeamEnd::Weighting::LAPLACE);
+	for(int v = crop.y; v < crop.y + crop.height; ++v)
+	{
+		for(int u = crop.x; u < crop.x + crop.width; ++u)
+		{
+			ASSERT_EQ(dynamic.Raster()->Cell(u, v).likelihood, original.Raster()->Cell(u, v).likelihood);
+		}
+	}
+}
 
 
 TEST(TestSetStatistics, test1)
@@ -365,6 +950,136 @@ TEST(TestSetStatistics, test3)
 
 }
 
+TEST(TestSetStatistics, test4)
+{
+	int n = 2 * SetStatistics::blockSize + 5;
+	ParticleSet set(n);
+	for(int i = 0; i < n; ++i) set.Set(i, Particle(Eigen::Vector3f(0.001 * i, 1.0, 0.5), 2.0));
+	std::vector<Particle> particles = set;
+	for(Particle& p : particles) p.weight = 1.0 / n;
+
+	// unnormalized weights give the same pose statistics as normalized ones
+	SetStatistics s1 = SetStatistics::ComputeParticleSetStatistics(set);
+	SetStatistics s2 = SetStatistics::ComputeParticleSetStatistics(particles);
+	ASSERT_NEAR((s1.Mean() - s2.Mean()).norm(), 0, 0.000001);
+	ASSERT_NEAR((s1.Cov() - s2.Cov()).norm(), 0, 0.000001);
+	ASSERT_NEAR(s1.SumWeights(), 2.0 * n, 0.000001);
+	ASSERT_NEAR(s1.ESS(), n, 0.000001);
+	ASSERT_NEAR(s2.ESS(), n, 0.000001);
+}
+
+TEST(TestParticleClusters, test1)
+{
+	ParticleSet set(0);
+	for(int i = 0; i < 100; ++i) set.PushBack(Particle(Eigen::Vector3f(1.0 + 0.002 * i, 2.0, 0.1), 0.007));
+	for(int i = 0; i < 100; ++i) set.PushBack(Particle(Eigen::Vector3f(-5.0, -3.0 + 0.002 * i, M_PI - 0.01), 0.003));
+	// wraps around to the same heading cell as the previous mode
+	for(int i = 0; i < 10; ++i) set.PushBack(Particle(Eigen::Vector3f(-5.0, -3.0, -M_PI + 0.01), 0.0));
+
+	ParticleClusters clusters;
+	clusters.Compute(set);
+	std::vector<PoseMode> modes = clusters.Modes(5);
+
+	ASSERT_EQ(modes.size(), 2);
+	ASSERT_NEAR(modes[0].weight, 0.7, 0.000001);
+	ASSERT_NEAR(modes[1].weight, 0.3, 0.000001);
+	ASSERT_EQ(modes[0].numParticles, 100);
+	ASSERT_EQ(modes[1].numParticles, 110);
+	ASSERT_NEAR(modes[0].stats.Mean()(0), 1.099, 0.0001);
+	ASSERT_NEAR(modes[1].stats.Mean()(1), -2.901, 0.0001);
+	ASSERT_EQ(clusters.Modes(1).size(), 1);
+}
+
+
+TEST(TestParticleSet, test1)
+{
+	std::vector<Particle> particles{Particle(Eigen::Vector3f(1.3, 1, 1), 0.25), Particle(Eigen::Vector3f(0.8, 0.7, 0), 0.75)};
+	ParticleSet set(particles);
+
+	ASSERT_EQ(set.Size(), 2);
+	ASSERT_EQ(set.Pose(1), Eigen::Vector3f(0.8, 0.7, 0));
+	ASSERT_EQ(set.Weight()[0], 0.25);
+	ASSERT_EQ(reinterpret_cast<std::uintptr_t>(set.X()) % 64, 0);
+
+	std::vector<Particle> view = set;
+	ASSERT_EQ(view[0].pose, particles[0].pose);
+	ASSERT_EQ(view[1].weight, particles[1].weight);
+
+	SetStatistics s1 = SetStatistics::ComputeParticleSetStatistics(particles);
+	SetStatistics s2 = SetStatistics::ComputeParticleSetStatistics(set);
+	ASSERT_NEAR((s1.Mean() - s2.Mean()).norm(), 0, 0.000001);
+	ASSERT_NEAR((s1.Cov() - s2.Cov()).norm(), 0, 0.000001);
+}
+
+TEST(TestParticleSet, test2)
+{
+	ParticleSet set(100);
+	for(int i = 0; i < set.Size(); ++i) set.Set(i, Particle(Eigen::Vector3f(i, 0, 0), 0.0));
+	set.Weight()[42] = 1.0;
+
+	Resampling rs;
+	rs.Resample(set);
+
+	ASSERT_EQ(set.Size(), 100);
+	for(int i = 0; i < set.Size(); ++i)
+	{
+		ASSERT_EQ(set.X()[i], 42);
+		ASSERT_NEAR(set.Weight()[i], 0.01, 0.000001);
+	}
+}
+
+
+TEST(TestResampling, test1)
+{
+	Resampling rs;
+	rs.SetTH(2.0);
+	rs.SetKLD(100, 5000, 0.05, 2.33, Eigen::Vector3f(0.5, 0.5, 0.2));
+
+	// a collapsed belief shrinks to the lower bound
+	ParticleSet tracked(1000);
+	for(int i = 0; i < tracked.Size(); ++i) tracked.Set(i, Particle(Eigen::Vector3f(1.0, 1.0, 0.1), 0.001));
+	rs.Resample(tracked);
+	ASSERT_EQ(tracked.Size(), 100);
+	ASSERT_NEAR(tracked.Weight()[0], 0.01, 0.000001);
+
+	// a belief spread over the floor grows towards the upper bound
+	ParticleSet global(1000);
+	for(int i = 0; i < global.Size(); ++i) global.Set(i, Particle(Eigen::Vector3f(i % 40, i / 40, (i % 7) - 3.0), 0.001));
+	rs.Resample(global);
+	ASSERT_GT(global.Size(), 1000);
+	ASSERT_LE(global.Size(), 5000);
+}
+
+
+TEST(TestResampling, test2)
+{
+	std::vector<Resampling::Algorithm> algorithms{Resampling::Algorithm::SYSTEMATIC, Resampling::Algorithm::STRATIFIED, Resampling::Algorithm::RESIDUAL};
+	// systematic and residual resampling copy each particle floor(n * w) or ceil(n * w) times, stratified can be off by one more
+	std::vector<float> tolerance{1.0, 2.0, 1.0};
+
+	int n = 3 * Resampling::blockSize + 17;
+	std::vector<double> weights(n);
+	for(int i = 0; i < n; ++i) weights[i] = 1 + (i * 7919) % 13;
+	double total = std::accumulate(weights.begin(), weights.end(), 0.0);
+
+	for(long unsigned int a = 0; a < algorithms.size(); ++a)
+	{
+		ParticleSet set(n);
+		for(int i = 0; i < n; ++i) set.Set(i, Particle(Eigen::Vector3f(i, 0, 0), weights[i] / total));
+
+		Resampling rs;
+		rs.SetTH(2.0);
+		rs.SetAlgorithm(algorithms[a]);
+		rs.Resample(set);
+
+		ASSERT_EQ(set.Size(), n);
+		std::vector<int> copies(n, 0);
+		for(int i = 0; i < n; ++i) ++copies[int(set.X()[i])];
+		for(int i = 0; i < n; ++i) ASSERT_LT(fabs(copies[i] - weights[i] / total * n), tolerance[a]);
+		ASSERT_NEAR(set.Weight()[n - 1], 1.0 / n, 0.000001);
+	}
+}
+
 
 
 TEST(TestNMCLFactory, test1)
@@ -422,6 +1137,96 @@ TEST(TestNMCLFactory, test3)
     particleFile.close();
 }
 
+TEST(TestNMCLFactory, test4)
+{
+	// Compile writes the bundle and FloorMap the SemMaps/ next to the config, so both work on a copy of the test floor
+	TempFolder folder("floor");
+	folder.CopyFrom(testPath);
+	std::string configPath = folder.path + "nmcltest.config";
+	std::string bundlePath = folder.path + "nmcltest.bundle";
+	NMCLFactory::Compile(configPath, bundlePath);
+	std::shared_ptr<const MapBundle> bundle = std::make_shared<const MapBundle>(bundlePath, true);
+	ASSERT_TRUE(NMCLFactory::IsCompiledFrom(*bundle, configPath));
+	{
+		// a bundle from other sources is out of date
+		MapBundleWriter writer;
+		writer.Add("sources", std::string("{}"));
+		writer.Write(bundlePath + ".stale");
+		ASSERT_FALSE(NMCLFactory::IsCompiledFrom(MapBundle(bundlePath + ".stale"), configPath));
+	}
+
+	using json = nlohmann::json;
+	std::ifstream file(folder.path + "floor.config");
+	json config;
+	file >> config;
+	FloorMap fromImages(config, folder.path);
+	FloorMap fromBundle(config, bundle, folder.path);
+	ASSERT_EQ(cv::countNonZero(fromImages.Map()->Map() != fromBundle.Map()->Map()), 0);
+	ASSERT_EQ(fromImages.GetRoomID(Eigen::Vector3f(1.0, -7.5, 0)), fromBundle.GetRoomID(Eigen::Vector3f(1.0, -7.5, 0)));
+
+	// the text map regions from the bundle are the ones computed from the images
+	PlaceRecognition textFromImages(fromImages.GetRoomNames(), folder.path + "TextMaps/", fromImages.Map());
+	PlaceRecognition textFromBundle(bundle);
+	std::vector<std::string> imageMatches;
+	std::vector<std::string> bundleMatches;
+	TextData imageText = textFromImages.TextBoundingBoxes(textFromImages.Match({"Room 1"}), imageMatches);
+	TextData bundleText = textFromBundle.TextBoundingBoxes(textFromBundle.Match({"Room 1"}), bundleMatches);
+	ASSERT_FALSE(imageMatches.empty());
+	ASSERT_EQ(imageMatches, bundleMatches);
+	ASSERT_EQ(imageText.TopLeft(), bundleText.TopLeft());
+	ASSERT_EQ(imageText.BottomRight(), bundleText.BottomRight());
+	ASSERT_EQ(imageText.Orientation(), bundleText.Orientation());
+	for (long unsigned int i = 0; i < imageText.Regions().size(); ++i)
+	{
+		const TextRegion& expected = *imageText.Regions()[i];
+		const TextRegion& region = *bundleText.Regions()[i];
+		ASSERT_EQ(expected.positions, region.positions);
+		ASSERT_EQ(expected.yaws, region.yaws);
+		ASSERT_EQ(expected.weights, region.weights);
+		ASSERT_EQ(expected.resolution, region.resolution);
+	}
+
+	// once the config names the bundle, the factory takes the regions from it and reads no text map
+	json nmclConfig;
+	std::ifstream nmclFile(configPath);
+	nmclFile >> nmclConfig;
+	nmclFile.close();
+	nmclConfig["bundle"] = "nmcltest.bundle";
+	std::ofstream out(configPath);
+	out << std::setw(4) << nmclConfig << std::endl;
+	out.close();
+	std::shared_ptr<PlaceRecognition> created = NMCLFactory::CreatePlaceRecognition(configPath, std::make_shared<FloorMap>(fromImages), folder.path + "NoTextMaps/");
+	std::vector<std::string> createdMatches;
+	TextData createdText = created->TextBoundingBoxes(created->Match({"Room 1"}), createdMatches);
+	ASSERT_EQ(createdText.TopLeft(), imageText.TopLeft());
+	ASSERT_TRUE(createdText.Regions()[0] && !createdText.Regions()[0]->Empty());
+
+	// the EDT from the bundle scores like the one computed from the map
+	BeamEnd computed(fromImages.Map(), 8, 15, BeamEnd::Weighting::LAPLACE);
+	BeamEnd loaded(fromBundle.Map(), bundle, 8, 15, BeamEnd::Weighting::LAPLACE);
+	ASSERT_THROW(BeamEnd(fromBundle.Map(), bundle, 8, 10, BeamEnd::Weighting::LAPLACE), std::runtime_error);
+
+	std::vector<Eigen::Vector3f> scan;
+	for(int i = 0; i < 90; ++i)
+	{
+		float a = i * 2 * M_PI / 90;
+		scan.push_back(Eigen::Vector3f(2.0 * cos(a), 2.0 * sin(a), 1));
+	}
+	std::shared_ptr<LidarData> data = std::make_shared<LidarData>(LidarData(scan, std::vector<double>(scan.size(), 1.0)));
+	std::vector<Particle> expected;
+	for (int i = 0; i < 100; ++i)
+	{
+		expected.push_back(Particle(Eigen::Vector3f(-2.0 + 0.1 * (i % 10), -9.0 + 0.3 * (i / 10), 0.07 * i), 1.0));
+	}
+	std::vector<Particle> particles = expected;
+	computed.ComputeWeights(expected, data);
+	loaded.ComputeWeights(particles, data);
+	for (long unsigned int i = 0; i < particles.size(); ++i)
+	{
+		ASSERT_EQ(expected[i].weight, particles[i].weight);
+	}
+}
+
 
 
 
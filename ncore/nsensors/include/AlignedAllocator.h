@@ -0,0 +1,68 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: AlignedAllocator.h                                                    #
+# ##############################################################################
+**/
+
+#ifndef ALIGNEDALLOCATOR_H
+#define ALIGNEDALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+//! An allocator that places the storage of std::vector on a cache-line boundary, so the hot loops over
+// particle/map arrays can use aligned vector loads
+template <typename T, std::size_t Alignment = 64>
+class AlignedAllocator
+{
+	public:
+
+		typedef T value_type;
+
+		template <typename U>
+		struct rebind
+		{
+			typedef AlignedAllocator<U, Alignment> other;
+		};
+
+		AlignedAllocator() noexcept {}
+
+		template <typename U>
+		AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {}
+
+		T* allocate(std::size_t n)
+		{
+			if (n == 0) return nullptr;
+
+			void* ptr = nullptr;
+			if (posix_memalign(&ptr, Alignment, n * sizeof(T)))
+			{
+				throw std::bad_alloc();
+			}
+			return static_cast<T*>(ptr);
+		}
+
+		void deallocate(T* ptr, std::size_t) noexcept
+		{
+			free(ptr);
+		}
+};
+
+template <typename T, typename U, std::size_t A>
+bool operator==(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return true; }
+
+template <typename T, typename U, std::size_t A>
+bool operator!=(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return false; }
+
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+#endif
@@ -0,0 +1,61 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: BeamSelection.h                                                       #
+# ##############################################################################
+**/
+
+#ifndef BEAMSELECTION_H
+#define BEAMSELECTION_H
+
+#include <eigen3/Eigen/Dense>
+#include <vector>
+
+
+//! Picks a fixed number of informative beams from a scan, instead of every N-th beam. The beams are grouped by the orientation of the
+// surface they hit, estimated from their neighbours in the scan, and picked round-robin over the groups so that every direction
+// the scan can constrain is represented. Inside a group the beams with the longest lever arm |p x n| come first, as they also constrain the heading.
+// Beams without a surface (isolated returns, e.g. poles far away) form their own group ordered by range. At most one beam is taken per
+// spatial cell, which drops the redundant beams on nearby walls.
+class BeamSelection
+{
+	public:
+
+		//! A constructor
+	    /*!
+	     \param numBeams is the number of beams to select
+	     \param normalBins is the number of surface orientation groups over [0, pi)
+	     \param cellSize is the size in meters of the spatial cells, at most one beam is selected per cell
+	     \param neighbourDist is the maximal distance in meters between a beam end and the neighbours used for its surface normal
+	    */
+		BeamSelection(int numBeams = 200, int normalBins = 8, float cellSize = 0.25, float neighbourDist = 0.3);
+
+		//! Returns a mask with numBeams ones (or all beams that pass the scan mask, if there are fewer)
+		/*!
+		  \param scan is a vector of homogeneous points (x, y, 1) in the base_link frame, ordered by bearing
+		  \param scanMask is the mask of the scan, beams with 0 are never selected
+		*/
+		std::vector<double> Select(const std::vector<Eigen::Vector3f>& scan, const std::vector<double>& scanMask) const;
+
+		int NumBeams() const
+		{
+			return o_numBeams;
+		}
+
+	private:
+
+		//! The surface normal at beam i from its neighbours i - 2 and i + 2, false if they are too far to lie on the same surface
+		bool normal(const std::vector<Eigen::Vector3f>& scan, int i, Eigen::Vector2f& n) const;
+
+		int o_numBeams;
+		int o_normalBins;
+		float o_cellSize;
+		float o_neighbourDist;
+
+};
+
+#endif
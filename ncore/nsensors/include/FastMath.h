@@ -0,0 +1,62 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: FastMath.h                                                            #
+# ##############################################################################
+**/
+
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <math.h>
+
+//! Branch-free helpers that the compiler can vectorize inside "#pragma omp simd" loops, unlike the libm calls.
+// They are meant for angles in the range of a few turns, e.g. particle headings.
+
+
+//! Sine and cosine with Cody-Waite reduction to [-pi/4, pi/4] and the Cephes single-precision polynomials. Absolute error is below 1e-6
+inline void FastSinCos(float x, float& s, float& c)
+{
+	const float twoOverPi = 0.636619772367581f;
+	const float dp1 = 1.5703125f;
+	const float dp2 = 4.837512969970703125e-4f;
+	const float dp3 = 7.54978995489188216e-8f;
+
+	// round to nearest through the truncating conversion, floorf is a libm call without SSE4.1
+	float v = x * twoOverPi;
+	int quadrant = int(v + copysignf(0.5f, v));
+	float q = float(quadrant);
+
+	float r = ((x - q * dp1) - q * dp2) - q * dp3;
+	float r2 = r * r;
+
+	float sr = ((-1.9515295891e-4f * r2 + 8.3321608736e-3f) * r2 - 1.6666654611e-1f) * r2 * r + r;
+	float cr = ((2.443315711809948e-5f * r2 - 1.388731625493765e-3f) * r2 + 4.166664568298827e-2f) * r2 * r2 - 0.5f * r2 + 1.0f;
+
+	// odd quadrants swap sine and cosine, the signs follow bit 1 of the quadrant. Arithmetic blends instead of selects keep the loop vectorizable
+	float swap = float(quadrant & 1);
+	float signS = 1.0f - 2.0f * float((quadrant >> 1) & 1);
+	float signC = 1.0f - 2.0f * float(((quadrant + 1) >> 1) & 1);
+
+	s = signS * (sr + swap * (cr - sr));
+	c = signC * (cr + swap * (sr - cr));
+}
+
+//! Wraps an angle to [-pi, pi) without the data-dependent loops of Wrap2Pi
+inline float FastWrap2Pi(float angle)
+{
+	const float twoPi = 2.0 * M_PI;
+	const float invTwoPi = 1.0 / (2.0 * M_PI);
+
+	float v = (angle + float(M_PI)) * invTwoPi;
+	// floor through truncation, valid down to -8 turns
+	float k = float(int(v + 8.0f)) - 8.0f;
+
+	return angle - twoPi * k;
+}
+
+#endif
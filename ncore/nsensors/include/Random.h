@@ -0,0 +1,130 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: Random.h                                                              #
+# ##############################################################################
+**/
+
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+
+
+//! Separates the consumers of a single seed, so that e.g. the motion model and the resampler never draw from the same counters
+enum class RandomDomain : uint32_t
+{
+	MOTION = 1,
+	RESAMPLING = 2,
+	SAMPLING = 3
+};
+
+
+//! A single stream of a Philox4x32-10 counter-based generator. The n-th output depends only on (seed, domain, block, epoch, n),
+// so streams can be handed to different threads or particle blocks and still produce the same numbers regardless of scheduling.
+class RandomStream
+{
+	public:
+
+		//! A constructor
+	    /*!
+	     \param seed is the 64-bit key of the generator
+	     \param domain identifies the consumer of the stream
+	     \param block is the stream index inside the domain, e.g. a particle block
+	     \param epoch is the step of the filter the stream belongs to
+	    */
+		RandomStream(uint64_t seed = 0, uint32_t domain = 0, uint32_t block = 0, uint32_t epoch = 0);
+
+		//! Next raw 32-bit output
+		uint32_t Next()
+		{
+			if (o_pos == 4)
+			{
+				refill();
+			}
+			return o_buffer[o_pos++];
+		}
+
+		//! Uniform sample in [0, 1)
+		double Uniform()
+		{
+			return Next() * (1.0 / 4294967296.0);
+		}
+
+		//! Normal sample with zero mean and standard deviation sigma (Box-Muller, the second value of each pair is kept for the next call)
+		float Gaussian(float sigma);
+
+		//! Fills out with n uniform samples in [0, 1)
+		void Uniform(float* out, int n);
+
+		//! Fills out with n normal samples with zero mean and standard deviation sigma. Produces the same sequence as n calls to Gaussian(sigma)
+		void Gaussian(float* out, int n, float sigma);
+
+		//! Philox4x32-10 bijection, maps a 128-bit counter and a 64-bit key to 128 random bits
+		static void Philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+
+
+	private:
+
+		void refill();
+		void gaussianPair(float& z0, float& z1);
+
+		uint32_t o_key[2];
+		uint32_t o_counter[4];
+		uint32_t o_buffer[4];
+		int o_pos = 4;
+		bool o_hasSpare = false;
+		float o_spare = 0;
+};
+
+
+//! Hands out RandomStreams for one domain. Advance() is called once per filter step, so every step draws from fresh counters
+class RandomGenerator
+{
+	public:
+
+		RandomGenerator(uint64_t seed = 0, RandomDomain domain = RandomDomain::SAMPLING)
+		{
+			o_seed = seed;
+			o_domain = uint32_t(domain);
+		}
+
+		//! Returns the stream of the given block for the current epoch
+		RandomStream Stream(uint32_t block) const
+		{
+			return RandomStream(o_seed, o_domain, block, o_epoch);
+		}
+
+		void Advance()
+		{
+			++o_epoch;
+		}
+
+		void SetSeed(uint64_t seed)
+		{
+			o_seed = seed;
+			o_epoch = 0;
+		}
+
+		uint64_t Seed() const
+		{
+			return o_seed;
+		}
+
+		uint32_t Epoch() const
+		{
+			return o_epoch;
+		}
+
+	private:
+
+		uint64_t o_seed = 0;
+		uint32_t o_domain = 0;
+		uint32_t o_epoch = 0;
+};
+
+#endif
@@ -0,0 +1,123 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: BeamSelection.cpp                                                     #
+# ##############################################################################
+**/
+
+#include "BeamSelection.h"
+
+#include <math.h>
+#include <algorithm>
+#include <unordered_set>
+#include <cstdint>
+#include <utility>
+
+
+BeamSelection::BeamSelection(int numBeams, int normalBins, float cellSize, float neighbourDist)
+{
+	o_numBeams = numBeams;
+	o_normalBins = std::max(normalBins, 1);
+	o_cellSize = cellSize;
+	o_neighbourDist = neighbourDist;
+}
+
+
+bool BeamSelection::normal(const std::vector<Eigen::Vector3f>& scan, int i, Eigen::Vector2f& n) const
+{
+	int k = 2;
+	if ((i - k < 0) || (i + k >= (int)scan.size())) return false;
+
+	Eigen::Vector2f p = scan[i].head(2);
+	Eigen::Vector2f prev = scan[i - k].head(2);
+	Eigen::Vector2f next = scan[i + k].head(2);
+
+	if (((prev - p).norm() > o_neighbourDist) || ((next - p).norm() > o_neighbourDist)) return false;
+
+	Eigen::Vector2f t = next - prev;
+	if (t.norm() < 1e-6) return false;
+
+	n = Eigen::Vector2f(-t(1), t(0)).normalized();
+
+	return true;
+}
+
+
+std::vector<double> BeamSelection::Select(const std::vector<Eigen::Vector3f>& scan, const std::vector<double>& scanMask) const
+{
+	int n = scan.size();
+	std::vector<double> mask(n, 0.0);
+
+	// one group per normal orientation, the last one for beams without a surface. Each holds (score, beam)
+	std::vector<std::vector<std::pair<float, int>>> groups(o_normalBins + 1);
+	for(int i = 0; i < n; ++i)
+	{
+		if (scanMask[i] <= 0.0) continue;
+
+		Eigen::Vector2f p = scan[i].head(2);
+		Eigen::Vector2f nrm;
+		if (normal(scan, i, nrm))
+		{
+			// the normal and its flip constrain the same direction
+			float angle = atan2(nrm(1), nrm(0));
+			if (angle < 0) angle += M_PI;
+			int g = std::min(int(angle / M_PI * o_normalBins), o_normalBins - 1);
+			float lever = std::abs(p(0) * nrm(1) - p(1) * nrm(0));
+			groups[g].push_back(std::make_pair(lever, i));
+		}
+		else
+		{
+			groups[o_normalBins].push_back(std::make_pair(p.norm(), i));
+		}
+	}
+
+	for(auto& group : groups)
+	{
+		// index order breaks ties, so the selection doesn't depend on the sort implementation
+		std::sort(group.begin(), group.end(), [](const std::pair<float, int>& a, const std::pair<float, int>& b)
+		{
+			return (a.first > b.first) || ((a.first == b.first) && (a.second < b.second));
+		});
+	}
+
+	std::unordered_set<int64_t> cells;
+	auto cellKey = [&](int i)
+	{
+		int64_t cx = floor(scan[i](0) / o_cellSize);
+		int64_t cy = floor(scan[i](1) / o_cellSize);
+		return int64_t((uint64_t(cx) << 32) ^ (uint64_t(cy) & 0xFFFFFFFF));
+	};
+
+	// round-robin over the groups, first one beam per cell, then fill up with the rest if the scan is too small for that
+	int selected = 0;
+	for(int pass = 0; pass < 2; ++pass)
+	{
+		std::vector<size_t> next(groups.size(), 0);
+		bool progress = true;
+		while ((selected < o_numBeams) && progress)
+		{
+			progress = false;
+			for(size_t g = 0; (g < groups.size()) && (selected < o_numBeams); ++g)
+			{
+				while (next[g] < groups[g].size())
+				{
+					int i = groups[g][next[g]].second;
+					++next[g];
+					if (mask[i] > 0.0) continue;
+					if ((pass == 0) && (!cells.insert(cellKey(i)).second)) continue;
+
+					mask[i] = 1.0;
+					++selected;
+					progress = true;
+					break;
+				}
+			}
+		}
+	}
+
+	return mask;
+}
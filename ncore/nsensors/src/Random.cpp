@@ -0,0 +1,133 @@
+/**
+# ##############################################################################
+#  Copyright (c) 2021- University of Bonn                            		   #
+#  All rights reserved.                                                        #
+#                                                                              #
+#  Author: Nicky Zimmerman                                     				   #
+#                                                                              #
+#  File: Random.cpp                                                            #
+# ##############################################################################
+**/
+
+#include "Random.h"
+#include <math.h>
+
+
+RandomStream::RandomStream(uint64_t seed, uint32_t domain, uint32_t block, uint32_t epoch)
+{
+	o_key[0] = uint32_t(seed);
+	o_key[1] = uint32_t(seed >> 32);
+
+	// word 0 counts the draws, the rest identifies the stream
+	o_counter[0] = 0;
+	o_counter[1] = block;
+	o_counter[2] = epoch;
+	o_counter[3] = domain;
+}
+
+void RandomStream::Philox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+{
+	const uint32_t M0 = 0xD2511F53;
+	const uint32_t M1 = 0xCD9E8D57;
+	const uint32_t W0 = 0x9E3779B9;
+	const uint32_t W1 = 0xBB67AE85;
+
+	uint32_t c0 = counter[0];
+	uint32_t c1 = counter[1];
+	uint32_t c2 = counter[2];
+	uint32_t c3 = counter[3];
+	uint32_t k0 = key[0];
+	uint32_t k1 = key[1];
+
+	for(int r = 0; r < 10; ++r)
+	{
+		uint64_t p0 = uint64_t(M0) * c0;
+		uint64_t p1 = uint64_t(M1) * c2;
+
+		uint32_t hi0 = uint32_t(p0 >> 32);
+		uint32_t lo0 = uint32_t(p0);
+		uint32_t hi1 = uint32_t(p1 >> 32);
+		uint32_t lo1 = uint32_t(p1);
+
+		c0 = hi1 ^ c1 ^ k0;
+		c1 = lo1;
+		c2 = hi0 ^ c3 ^ k1;
+		c3 = lo0;
+
+		k0 += W0;
+		k1 += W1;
+	}
+
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
+}
+
+void RandomStream::refill()
+{
+	Philox(o_counter, o_key, o_buffer);
+	++o_counter[0];
+	o_pos = 0;
+}
+
+void RandomStream::gaussianPair(float& z0, float& z1)
+{
+	// 1 - u is in (0, 1], so the log is always finite
+	float u1 = 1.0 - Uniform();
+	float u2 = Uniform();
+
+	float r = sqrt(-2.0f * logf(u1));
+	float a = 2.0f * M_PI * u2;
+
+	z0 = r * cosf(a);
+	z1 = r * sinf(a);
+}
+
+float RandomStream::Gaussian(float sigma)
+{
+	if (o_hasSpare)
+	{
+		o_hasSpare = false;
+		return sigma * o_spare;
+	}
+
+	float z0, z1;
+	gaussianPair(z0, z1);
+	o_spare = z1;
+	o_hasSpare = true;
+
+	return sigma * z0;
+}
+
+void RandomStream::Uniform(float* out, int n)
+{
+	// 24 bits, so the float conversion can not round up to 1
+	for(int i = 0; i < n; ++i)
+	{
+		out[i] = (Next() >> 8) * (1.0f / 16777216.0f);
+	}
+}
+
+void RandomStream::Gaussian(float* out, int n, float sigma)
+{
+	int i = 0;
+	if ((n > 0) && o_hasSpare)
+	{
+		out[i++] = sigma * o_spare;
+		o_hasSpare = false;
+	}
+
+	for(; i + 1 < n; i += 2)
+	{
+		float z0, z1;
+		gaussianPair(z0, z1);
+		out[i] = sigma * z0;
+		out[i + 1] = sigma * z1;
+	}
+
+	if (i < n)
+	{
+		out[i] = Gaussian(sigma);
+	}
+}
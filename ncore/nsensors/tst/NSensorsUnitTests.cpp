@@ -16,6 +16,7 @@
 #include <string>
 #include <fstream>
 #include <chrono>
+#include <numeric>
 #include <stdlib.h>
 #include <string>
 
@@ -24,6 +25,9 @@
 #include "Lidar2D.h"
 #include "OptiTrack.h"
 #include "Camera.h"
+#include "Random.h"
+#include "FastMath.h"
+#include "BeamSelection.h"
 
 std::string dataPath = PROJECT_TEST_DATA_DIR + std::string("/8/");
 std::string configPath = PROJECT_TEST_DATA_DIR + std::string("/config/");
@@ -285,6 +289,145 @@ TEST(TestLidar2D, test5)
 	ASSERT_EQ(heading[1], minAngle + reso);
 }
 
+TEST(TestUtils, test6)
+{
+	for(float x = -10.0; x < 10.0; x += 0.001)
+	{
+		float s, c;
+		FastSinCos(x, s, c);
+		ASSERT_NEAR(s, sin(x), 0.000001);
+		ASSERT_NEAR(c, cos(x), 0.000001);
+
+		float w = FastWrap2Pi(x);
+		ASSERT_GE(w, -M_PI - 0.000001);
+		ASSERT_LE(w, M_PI + 0.000001);
+		ASSERT_NEAR(sin(w), sin(x), 0.0001);
+	}
+}
+
+TEST(TestRandom, test1)
+{
+	// known answers of the Philox4x32-10 reference implementation (Random123)
+	uint32_t counter[4] = {0, 0, 0, 0};
+	uint32_t key[2] = {0, 0};
+	uint32_t out[4];
+	RandomStream::Philox(counter, key, out);
+	ASSERT_EQ(out[0], 0x6627e8d5);
+	ASSERT_EQ(out[1], 0xe169c58d);
+	ASSERT_EQ(out[2], 0xbc57ac4c);
+	ASSERT_EQ(out[3], 0x9b00dbd8);
+
+	uint32_t counter2[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344};
+	uint32_t key2[2] = {0xa4093822, 0x299f31d0};
+	RandomStream::Philox(counter2, key2, out);
+	ASSERT_EQ(out[0], 0xd16cfe09);
+	ASSERT_EQ(out[1], 0x94fdcceb);
+	ASSERT_EQ(out[2], 0x5001e420);
+	ASSERT_EQ(out[3], 0x24126ea1);
+}
+
+TEST(TestRandom, test2)
+{
+	RandomGenerator rng(42, RandomDomain::MOTION);
+	RandomStream s1 = rng.Stream(3);
+	RandomStream s2 = rng.Stream(3);
+	RandomStream s3 = rng.Stream(4);
+
+	int same = 0;
+	for(int i = 0; i < 100; ++i)
+	{
+		uint32_t a = s1.Next();
+		ASSERT_EQ(a, s2.Next());
+		if (a == s3.Next()) ++same;
+	}
+	ASSERT_LT(same, 2);
+
+	// a new epoch gives a different stream for the same block
+	rng.Advance();
+	RandomStream s4 = rng.Stream(3);
+	RandomStream s5 = RandomGenerator(42, RandomDomain::MOTION).Stream(3);
+	ASSERT_NE(s4.Next(), s5.Next());
+
+	// batched normals follow the same sequence as single draws
+	RandomStream g1 = rng.Stream(7);
+	RandomStream g2 = rng.Stream(7);
+	std::vector<float> batch(9);
+	g1.Gaussian(0.5);
+	g1.Gaussian(batch.data(), 9, 2.0);
+	g2.Gaussian(0.5);
+	for(int i = 0; i < 9; ++i)
+	{
+		ASSERT_EQ(batch[i], g2.Gaussian(2.0));
+	}
+}
+
+TEST(TestRandom, test3)
+{
+	RandomStream stream(7);
+	int n = 100000;
+	std::vector<float> z(n);
+	stream.Gaussian(z.data(), n, 2.0);
+
+	double mean = 0;
+	double var = 0;
+	for(int i = 0; i < n; ++i) mean += z[i];
+	mean /= n;
+	for(int i = 0; i < n; ++i) var += (z[i] - mean) * (z[i] - mean);
+	var /= n;
+
+	ASSERT_NEAR(mean, 0.0, 0.03);
+	ASSERT_NEAR(sqrt(var), 2.0, 0.03);
+
+	std::vector<float> u(n);
+	stream.Uniform(u.data(), n);
+	double acc = 0;
+	for(int i = 0; i < n; ++i)
+	{
+		ASSERT_GE(u[i], 0.0);
+		ASSERT_LT(u[i], 1.0);
+		acc += u[i];
+	}
+	ASSERT_NEAR(acc / n, 0.5, 0.01);
+}
+
+
+
+TEST(TestBeamSelection, test1)
+{
+	// a long wall along x at y = 1, densely sampled, and one isolated return far away
+	std::vector<Eigen::Vector3f> scan;
+	for(int i = 0; i < 400; ++i)
+	{
+		scan.push_back(Eigen::Vector3f(-2.0 + 0.01 * i, 1.0, 1));
+	}
+	scan.push_back(Eigen::Vector3f(12.0, -3.0, 1));
+	// a short wall along y at x = 3
+	for(int i = 0; i < 50; ++i)
+	{
+		scan.push_back(Eigen::Vector3f(3.0, -1.0 + 0.01 * i, 1));
+	}
+	std::vector<double> scanMask(scan.size(), 1.0);
+	// the masked beams are never picked
+	for(int i = 0; i < 100; ++i) scanMask[i] = 0.0;
+
+	BeamSelection bs(20, 8, 0.25, 0.3);
+	std::vector<double> mask = bs.Select(scan, scanMask);
+
+	ASSERT_EQ(mask.size(), scan.size());
+	ASSERT_EQ(std::accumulate(mask.begin(), mask.end(), 0.0), 20);
+	for(int i = 0; i < 100; ++i) ASSERT_EQ(mask[i], 0.0);
+
+	// the rare long range return and both walls are represented
+	ASSERT_EQ(mask[400], 1.0);
+	ASSERT_GT(std::accumulate(mask.begin() + 401, mask.end(), 0.0), 0);
+	ASSERT_GT(std::accumulate(mask.begin() + 100, mask.begin() + 400, 0.0), 0);
+
+	// fewer candidates than requested gives all of them
+	BeamSelection all(1000);
+	mask = all.Select(scan, scanMask);
+	ASSERT_EQ(std::accumulate(mask.begin(), mask.end(), 0.0), scan.size() - 100);
+}
+
 
 
 int main(int argc, char **argv) {
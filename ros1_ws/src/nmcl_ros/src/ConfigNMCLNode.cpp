@@ -97,9 +97,12 @@ public:
 		//srand48(21);
 		o_mtx = new std::mutex();   
 		o_renmcl = NMCLFactory::Create(dataFolder + nmclconfig); 
+		o_beamSelection = NMCLFactory::CreateBeamSelection(dataFolder + nmclconfig);
+		// the beam selection picks from the full scan instead of every o_dsFactor-th beam
+		if (o_beamSelection) o_dsFactor = 1;
 
 		o_dict = o_renmcl->GetFloorMap()->GetRoomNames(); 
-		o_placeRec = std::make_shared<PlaceRecognition>(PlaceRecognition(o_dict, dataFolder + "/TextMaps/"));
+		o_placeRec = NMCLFactory::CreatePlaceRecognition(dataFolder + nmclconfig, o_renmcl->GetFloorMap(), dataFolder + "/TextMaps/");
 
 		nav_msgs::OdometryConstPtr odom = ros::topic::waitForMessage<nav_msgs::Odometry>(odomTopic, ros::Duration(60)); 
 		o_prevPose = OdomMsg2Pose2D(odom);
@@ -252,7 +255,7 @@ public:
 				std::vector<std::string> confirmedMatches;
 	 			TextData textData = o_placeRec->TextBoundingBoxes(validMatches, confirmedMatches);
 				o_mtx->lock(); 
-				o_renmcl->Relocalize(textData.BottomRight(), textData.TopLeft(), textData.Orientation(), camAngle);
+				o_renmcl->Relocalize(textData, camAngle);
 				o_mtx->unlock();
 				for (int p = 0; p < confirmedMatches.size(); ++p)
 				{
@@ -422,7 +425,7 @@ public:
 
 			float sum = std::accumulate(o_scanMask.begin(), o_scanMask.end(), 0.0); 
 			{
-				LidarData data = LidarData(points_3d, o_scanMask);
+				LidarData data = o_beamSelection ? LidarData(points_3d, o_beamSelection->Select(points_3d, o_scanMask)) : LidarData(points_3d, o_scanMask);
 				o_mtx->lock();
 				auto t1 = std::chrono::high_resolution_clock::now();
 				o_renmcl->Correct(std::make_shared<LidarData>(data)); 
@@ -517,6 +520,7 @@ private:
 	std::shared_ptr<PlaceRecognition> o_placeRec;
 
 	int o_dsFactor = 10;
+	std::shared_ptr<BeamSelection> o_beamSelection;
 	std::vector<double> o_scanMask;
 	std::string o_mapTopic;
 	std::string o_baseLinkTF;